@@ -0,0 +1,434 @@
+/*
+  Fusor Node Connector - MsgPack codec benchmark
+
+  Times the paths that move bytes, on representative payloads and the same inputs the connector uses:
+
+    decode      - deserializeMsgPack of node definitions (small, 4 KB, 32 KB) from
+                    buffer  mutable char buffer parsed in place (NodeConnector::loadDefinitionFromFlash)
+                    file    flash file (loadDefinitionFromFlash without memory for the buffer, patched downloads)
+                    stream  byte stream, like the hub response in NodeConnector::_fetchMsgPack
+    encode      - measureMsgPack + serializeMsgPack of sync out batches (1, 50, 500 vars),
+                  as in SMHooks::afterCycle
+    storage     - PersistentStorage record write / read loop (50 vars)
+
+  For each case it prints latency (min / avg / max, us), throughput (KB/s) and
+  heap allocations per operation.
+
+  Baselines are measured on the board itself: the first run (or a run with BENCH_RECORD 1)
+  stores its results in `/bench.bin`, following runs compare against them. A case slower than
+  its baseline by more than BENCH_TOLERANCE %, or allocating more, is a regression and the run
+  ends with "BENCHMARK FAILED", so serial output can be checked by a script.
+  Re-record after intentional changes, or after changing board, core version or CPU frequency.
+
+  Payloads are generated with a fixed seed, results are reproducible on the same
+  board, core version and CPU frequency.
+
+  IMPORTANT: rewrites `/variables.bin`, `/bench.mpk` and `/bench.bin` on the flash file system.
+*/
+
+#include <NodeConnector.h>
+#include <PrintWrapper/PrintWrapper.h>
+#include <PerfCounters/PerfCounters.h>
+#include <PersistentStorage/PersistentStorage.h>
+
+#define BENCH_ITERATIONS 20
+#define BENCH_STORAGE_ITERATIONS 5
+#define BENCH_STORAGE_VARS 50
+
+// allowed slowdown against the recorded baseline, %
+#define BENCH_TOLERANCE 20
+
+// 1 - store results of this run as the new baseline
+#define BENCH_RECORD 0
+
+#define BENCH_MAX_CASES 16
+#define BENCH_NAME_SIZE 24
+
+const char BENCH_BASELINE_FILE[] = "/bench.bin";
+const char BENCH_DEFINITION_FILE[] = "/bench.mpk";
+
+typedef struct BenchResult
+{
+  char name[BENCH_NAME_SIZE];
+  uint32_t avg;    // us
+  uint32_t allocs; // per operation (storage: heap bytes lost over the run)
+} BenchResult;
+
+typedef struct BenchBaseline
+{
+  uint32_t cpuMHz;
+  uint8_t count;
+  BenchResult results[BENCH_MAX_CASES];
+} BenchBaseline;
+
+#ifdef ESP32
+size_t decodeSizes[] = {256, 4096, 32768};
+#else
+// 32 KB definition does not fit ESP8266 heap next to its JSON document
+size_t decodeSizes[] = {256, 4096};
+#endif
+size_t encodeSizes[] = {1, 50, 500};
+
+FileSystem fs;
+BenchBaseline baseline;
+BenchBaseline measured;
+bool hasBaseline = false;
+uint8_t failures = 0;
+
+/*
+ * ArduinoJson allocator counting heap calls, same malloc as DynamicJsonDocument
+ */
+unsigned long benchAllocs = 0;
+
+struct CountingAllocator
+{
+  void *allocate(size_t size)
+  {
+    benchAllocs++;
+    return malloc(size);
+  }
+
+  void deallocate(void *pointer)
+  {
+    free(pointer);
+  }
+
+  void *reallocate(void *pointer, size_t size)
+  {
+    benchAllocs++;
+    return realloc(pointer, size);
+  }
+};
+
+typedef BasicJsonDocument<CountingAllocator> BenchJsonDocument;
+
+/*
+ * Memory stream read byte by byte, like WiFiClient in NodeConnector::_fetchMsgPack
+ */
+class BenchStream : public Stream
+{
+public:
+  BenchStream(const uint8_t *data, size_t size) : _data(data), _size(size) {}
+
+  void rewind() { _position = 0; }
+
+  int available() override { return _size - _position; }
+  int read() override { return _position < _size ? _data[_position++] : -1; }
+  int peek() override { return _position < _size ? _data[_position] : -1; }
+  size_t write(uint8_t) override { return 0; }
+
+private:
+  const uint8_t *_data;
+  size_t _size;
+  size_t _position = 0;
+};
+
+// variable names live for the whole run, documents store only pointers
+char names[500][8];
+
+/**
+ * Build definition like document of roughly `size` msgpack bytes:
+ * state machine states with actions and transitions, sync out and storage options
+ */
+void buildDefinition(BenchJsonDocument &doc, size_t size)
+{
+  doc.clear();
+  JsonObject states = doc.createNestedObject("s");
+  JsonObject syncOut = doc.createNestedObject("o");
+  JsonObject storage = doc.createNestedObject("p");
+
+  for (uint16_t i = 0; i < 500 && measureMsgPack(doc) < size; i++)
+  {
+    JsonObject state = states.createNestedObject(names[i]);
+    JsonObject action = state.createNestedArray("a").createNestedObject();
+    action["f"] = "set";
+    JsonArray params = action.createNestedArray("p");
+    params.add(names[i]);
+    params.add(random(1000) / 10.0f);
+
+    JsonObject transition = state.createNestedArray("t").createNestedObject();
+    transition["c"] = "x > 10";
+    transition["s"] = names[(i + 1) % 500];
+
+    JsonObject option = syncOut.createNestedObject(names[i]);
+    option["s"] = "p";
+    option["p"] = "nxa";
+    option["f"] = "c";
+    option["l"] = 10;
+
+    if (i % 4 == 0)
+      storage.createNestedObject(names[i])["r"] = true;
+  }
+}
+
+void loadBaseline()
+{
+  if (BENCH_RECORD || !fs.exists(BENCH_BASELINE_FILE))
+    return;
+
+  File file = fs.open(BENCH_BASELINE_FILE, "r");
+  hasBaseline = file.read((uint8_t *)&baseline, sizeof(baseline)) == sizeof(baseline);
+  file.close();
+
+  if (hasBaseline && baseline.cpuMHz != ESP.getCpuFreqMHz())
+  {
+    Serial << F("Baseline was recorded at ") << baseline.cpuMHz << F(" MHz, recording a new one\n");
+    hasBaseline = false;
+  }
+}
+
+void saveBaseline()
+{
+  measured.cpuMHz = ESP.getCpuFreqMHz();
+
+  File file = fs.open(BENCH_BASELINE_FILE, "w");
+  file.write((const uint8_t *)&measured, sizeof(measured));
+  file.close();
+}
+
+BenchResult *findBaseline(const char *name)
+{
+  for (uint8_t i = 0; hasBaseline && i < baseline.count && i < BENCH_MAX_CASES; i++)
+    if (!strcmp(baseline.results[i].name, name))
+      return &baseline.results[i];
+
+  return nullptr;
+}
+
+void report(const char *name, PerfStat *stat, size_t bytes, unsigned long allocs, const __FlashStringHelper *allocLabel)
+{
+  unsigned long avg = stat->avg();
+  // bytes per us * 1000000 / 1024 = KB/s
+  unsigned long throughput = avg ? (unsigned long)((unsigned long long)bytes * 1000000ull / 1024ull / avg) : 0;
+  unsigned long allocsPerOp = allocs / (stat->count ? stat->count : 1);
+
+  Serial << name << ": " << bytes << " B, us min/avg/max "
+         << stat->min << "/" << avg << "/" << stat->max
+         << ", " << throughput << " KB/s, " << allocLabel << " " << allocsPerOp;
+
+  if (measured.count < BENCH_MAX_CASES)
+  {
+    BenchResult *result = &measured.results[measured.count++];
+    strncpy(result->name, name, BENCH_NAME_SIZE - 1);
+    result->name[BENCH_NAME_SIZE - 1] = '\0';
+    result->avg = avg;
+    result->allocs = allocsPerOp;
+  }
+
+  BenchResult *base = findBaseline(name);
+  if (base)
+  {
+    bool slow = avg > base->avg + base->avg * BENCH_TOLERANCE / 100;
+    bool allocating = allocsPerOp > base->allocs;
+
+    if (slow || allocating)
+    {
+      failures++;
+      Serial << F(" REGRESSION (baseline ") << base->avg << F(" us, ") << allocLabel << " " << base->allocs << ")";
+    }
+  }
+
+  Serial << "\n";
+}
+
+void benchDecode(size_t targetSize)
+{
+  size_t capacity = targetSize * 3 + 1024;
+  BenchJsonDocument source(capacity);
+  buildDefinition(source, targetSize);
+
+  size_t size = measureMsgPack(source);
+  uint8_t *encoded = (uint8_t *)malloc(size + 1);
+  char *buffer = (char *)malloc(size);
+  if (!encoded || !buffer)
+  {
+    Serial << F("decode ") << targetSize << F(": out of memory\n");
+    free(encoded);
+    free(buffer);
+    failures++;
+    return;
+  }
+  serializeMsgPack(source, (char *)encoded, size + 1);
+  source.clear();
+
+  File file = fs.open(BENCH_DEFINITION_FILE, "w");
+  file.write(encoded, size);
+  file.close();
+
+  BenchStream stream(encoded, size);
+
+  // document is reused like NodeConnector::nodeDefinition, only decoding is timed
+  BenchJsonDocument target(capacity);
+  char name[BENCH_NAME_SIZE];
+
+  for (uint8_t input = 0; input < 3; input++)
+  {
+    static const char *inputs[] = {"buffer", "file", "stream"};
+    snprintf(name, BENCH_NAME_SIZE, "decode %u %s", (unsigned int)targetSize, inputs[input]);
+
+    PerfStat stat;
+    benchAllocs = 0;
+    file = fs.open(BENCH_DEFINITION_FILE, "r");
+
+    for (uint8_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+      DeserializationError error;
+
+      // in place parsing rewrites strings, each iteration starts from a fresh copy
+      memcpy(buffer, encoded, size);
+      file.seek(0);
+      stream.rewind();
+
+      unsigned long start = micros();
+      if (input == 0)
+        error = deserializeMsgPack(target, buffer, size, DeserializationOption::NestingLimit(JSON_NESTING_LIMIT));
+      else if (input == 1)
+        error = deserializeMsgPack(target, file, DeserializationOption::NestingLimit(JSON_NESTING_LIMIT));
+      else
+        error = deserializeMsgPack(target, stream, DeserializationOption::NestingLimit(JSON_NESTING_LIMIT));
+      stat.add(diff(start, micros()));
+
+      if (error)
+      {
+        Serial << name << F(": ") << error.c_str() << "\n";
+        failures++;
+        break;
+      }
+    }
+
+    file.close();
+    report(name, &stat, size, benchAllocs, F("allocs/op"));
+  }
+
+  fs.remove(BENCH_DEFINITION_FILE);
+  free(encoded);
+  free(buffer);
+}
+
+void benchEncode(size_t count)
+{
+  PerfStat stat;
+  size_t size = 0;
+  benchAllocs = 0;
+
+  for (uint8_t i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    unsigned long start = micros();
+
+    // same steps as SMHooks::_post, document is allocated per batch
+    BenchJsonDocument output(JSON_OBJECT_SIZE(count));
+    for (uint16_t v = 0; v < count; v++)
+    {
+      // mix of int and float values
+      if (v % 2)
+        output[(const char *)names[v]] = (float)v / 3.0f;
+      else
+        output[(const char *)names[v]] = (long int)v;
+    }
+
+    size = measureMsgPack(output);
+    uint8_t buffer[size + 1];
+    serializeMsgPack(output, (char *)buffer, size + 1);
+
+    stat.add(diff(start, micros()));
+  }
+
+  char name[BENCH_NAME_SIZE];
+  snprintf(name, BENCH_NAME_SIZE, "encode %u", (unsigned int)count);
+  report(name, &stat, size, benchAllocs, F("allocs/op"));
+}
+
+void benchStorage(StateMachineController *sm)
+{
+  DefinitionArena arena;
+  BenchJsonDocument options(JSON_OBJECT_SIZE(BENCH_STORAGE_VARS) + BENCH_STORAGE_VARS * JSON_OBJECT_SIZE(1));
+
+  for (uint16_t v = 0; v < BENCH_STORAGE_VARS; v++)
+  {
+    options.createNestedObject((const char *)names[v])[ON_RESTART] = true;
+    sm->setVar(names[v], (float)v / 3.0f, false);
+  }
+
+  arena.begin(PersistentStorage::arenaSize(options.as<JsonVariant>()));
+  PersistentStorage storage(&arena);
+  storage.init(options.as<JsonVariant>(), &(sm->compute.store));
+
+  // warm up, file system allocates its buffers on first use
+  storage.saveOnReboot();
+  storage.load();
+
+  PerfStat stat;
+  size_t heapBefore = ESP.getFreeHeap();
+
+  for (uint8_t i = 0; i < BENCH_STORAGE_ITERATIONS; i++)
+  {
+    // storage writes only if some value differs from the tracked one
+    sm->setVar(names[0], (float)(1000 + i), false);
+
+    unsigned long start = micros();
+    storage.saveOnReboot();
+    storage.load();
+    stat.add(diff(start, micros()));
+  }
+
+  // file system calls can't be counted, but they must not leak
+  size_t heapAfter = ESP.getFreeHeap();
+  unsigned long lost = heapAfter < heapBefore ? heapBefore - heapAfter : 0;
+
+  storage.reset();
+  arena.release();
+
+  // name length + "vNNN" + value per record, written and read back
+  size_t bytes = 2 * BENCH_STORAGE_VARS * (sizeof(size_t) + 4 + sizeof(VarStruct));
+  report("storage 50", &stat, bytes, lost * stat.count, F("heap lost B"));
+
+  // no baseline needed, storage must never leak
+  if (lost && !findBaseline("storage 50"))
+    failures++;
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  delay(1000);
+
+  randomSeed(42);
+  for (uint16_t i = 0; i < 500; i++)
+    snprintf(names[i], sizeof(names[i]), "v%03u", i);
+
+  Serial << F("\nMsgPack benchmark, CPU ") << ESP.getCpuFreqMHz() << F(" MHz, heap ") << ESP.getFreeHeap() << "\n";
+
+  if (!fs.begin(true))
+  {
+    Serial << F("BENCHMARK FAILED (no file system)\n");
+    return;
+  }
+
+  loadBaseline();
+
+  for (size_t size : decodeSizes)
+    benchDecode(size);
+
+  for (size_t count : encodeSizes)
+    benchEncode(count);
+
+  StateMachineController sm("bench", _nc_sleepFunction, _nc_getTime);
+  benchStorage(&sm);
+
+  if (!hasBaseline && !failures && fs.begin())
+  {
+    // storage case unmounts the file system when done
+    saveBaseline();
+    fs.end();
+    Serial << F("BASELINE RECORDED\n");
+  }
+  else if (failures)
+    Serial << F("BENCHMARK FAILED (") << failures << F(" regressions)\n");
+  else
+    Serial << F("BENCHMARK PASSED\n");
+}
+
+void loop()
+{
+  delay(1000);
+}
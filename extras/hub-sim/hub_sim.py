@@ -0,0 +1,940 @@
+#!/usr/bin/env python3
+"""
+Fusor Hub emulator and multi node load simulator.
+
+Emulates hub endpoints used by the node connector:
+
+  GET  /definitions/sm/<node-id>         - node definition (msgpack), honours If-Modified-Since
+  POST /node/<node-id>/batch             - sync out values (msgpack map, or compact
+                                           [version, id, value, ...] array, see "i" option)
+  POST /node/<node-id>/boot              - boot timeline (NC_BOOT_POST), summarized per phase
+  POST /nodes/batch                      - batches of the virtual nodes of a device (NodeHost),
+                                           [node-id, batch, node-id, batch, ...]
+  GET  /aggregate/batch/flat?<n.f>&...   - sync in params, last values posted by other nodes
+  GET  /aggregate/batch/compact?<n.f>=<id>&...
+                                         - same as [id, value, ...] array
+  GET  /                                 - liveness, used by hub failover probes
+
+Responses are LZSS compressed for clients sending `accept-encoding: x-lzss`, compressed
+posts (`content-encoding: x-lzss`) are accepted unless `--no-compression` is given.
+
+Definitions carry `ETag` (FNV-1a of the msgpack bytes). Clients sending `If-None-Match` of a
+version the hub still knows, together with `A-IM: x-nc-patch`, get a `226 IM Used` binary patch
+instead of the full definition. `--mutate-every` changes a threshold periodically to exercise it.
+
+and drives it with N simulated nodes, running on a thread pool with a simulated clock.
+Simulated nodes follow connector sync out rules (instant, on change with threshold,
+preprocessing frames by cycles or duration, priority lanes) closely enough to reproduce
+request rates and payload sizes, so batching and backoff changes can be sized before
+flashing hundreds of boards.
+
+Real boards can be pointed to the emulator as well (`--serve-only`). If they sync out
+`@nc.cycle.avg` / `@nc.cycle.max`, connector CPU time per cycle is reported across nodes.
+
+Usage:
+
+  python3 hub_sim.py --nodes 200 --duration 60 --speed 10 --definition definition.json
+  python3 hub_sim.py --serve-only --port 3000 --definition definition.json
+  python3 hub_sim.py --nodes 200 --compact    # numeric ids, compare payload sizes
+  python3 hub_sim.py --nodes 200 --mutate-every 120   # definition rollouts as patches
+  python3 hub_sim.py --nodes 200 --nodes-per-device 4  # virtual nodes merging their requests
+
+Python 3 standard library only.
+"""
+
+import argparse
+import json
+import random
+import struct
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+from email.utils import formatdate, parsedate_to_datetime
+from http.client import HTTPConnection
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+# ---------------------------------------------------------------------------
+# Minimal msgpack (nil, bool, int, float, str, bin, array, map)
+# ---------------------------------------------------------------------------
+
+
+class Raw(bytes):
+    """Already encoded msgpack, packed as it is"""
+
+
+def pack(value):
+    if isinstance(value, Raw):
+        return bytes(value)
+    if value is None:
+        return b"\xc0"
+    if value is True:
+        return b"\xc3"
+    if value is False:
+        return b"\xc2"
+    if isinstance(value, int):
+        if 0 <= value < 0x80:
+            return struct.pack("B", value)
+        if -32 <= value < 0:
+            return struct.pack("b", value)
+        if -0x80000000 <= value < 0x80000000:
+            return b"\xd2" + struct.pack(">i", value)
+        return b"\xd3" + struct.pack(">q", value)
+    if isinstance(value, float):
+        return b"\xca" + struct.pack(">f", value)
+    if isinstance(value, str):
+        data = value.encode()
+        if len(data) < 32:
+            return struct.pack("B", 0xA0 | len(data)) + data
+        if len(data) < 0x100:
+            return b"\xd9" + struct.pack("B", len(data)) + data
+        return b"\xda" + struct.pack(">H", len(data)) + data
+    if isinstance(value, (list, tuple)):
+        head = struct.pack("B", 0x90 | len(value)) if len(value) < 16 else b"\xdc" + struct.pack(">H", len(value))
+        return head + b"".join(pack(v) for v in value)
+    if isinstance(value, dict):
+        head = struct.pack("B", 0x80 | len(value)) if len(value) < 16 else b"\xde" + struct.pack(">H", len(value))
+        return head + b"".join(pack(k) + pack(v) for k, v in value.items())
+    raise TypeError("can't pack %r" % type(value))
+
+
+def unpack(data):
+    value, _ = _unpack(data, 0)
+    return value
+
+
+def _unpack(data, pos):
+    b = data[pos]
+    pos += 1
+    if b < 0x80:
+        return b, pos
+    if b >= 0xE0:
+        return b - 0x100, pos
+    if 0xA0 <= b < 0xC0:
+        n = b & 0x1F
+        return data[pos:pos + n].decode(), pos + n
+    if 0x90 <= b < 0xA0:
+        return _unpack_array(data, pos, b & 0x0F)
+    if 0x80 <= b < 0x90:
+        return _unpack_map(data, pos, b & 0x0F)
+    if b == 0xC0:
+        return None, pos
+    if b in (0xC2, 0xC3):
+        return b == 0xC3, pos
+    fixed = {0xCA: ">f", 0xCB: ">d", 0xCC: ">B", 0xCD: ">H", 0xCE: ">I", 0xCF: ">Q",
+             0xD0: ">b", 0xD1: ">h", 0xD2: ">i", 0xD3: ">q"}
+    if b in fixed:
+        size = struct.calcsize(fixed[b])
+        return struct.unpack(fixed[b], data[pos:pos + size])[0], pos + size
+    sized = {0xD9: (">B", "str"), 0xDA: (">H", "str"), 0xDB: (">I", "str"),
+             0xC4: (">B", "bin"), 0xC5: (">H", "bin"), 0xC6: (">I", "bin"),
+             0xDC: (">H", "array"), 0xDD: (">I", "array"), 0xDE: (">H", "map"), 0xDF: (">I", "map")}
+    if b in sized:
+        fmt, kind = sized[b]
+        size = struct.calcsize(fmt)
+        n = struct.unpack(fmt, data[pos:pos + size])[0]
+        pos += size
+        if kind == "str":
+            return data[pos:pos + n].decode(), pos + n
+        if kind == "bin":
+            return bytes(data[pos:pos + n]), pos + n
+        if kind == "array":
+            return _unpack_array(data, pos, n)
+        return _unpack_map(data, pos, n)
+    raise ValueError("unsupported msgpack type 0x%02x" % b)
+
+
+def _unpack_array(data, pos, n):
+    result = []
+    for _ in range(n):
+        value, pos = _unpack(data, pos)
+        result.append(value)
+    return result, pos
+
+
+def _unpack_map(data, pos, n):
+    result = {}
+    for _ in range(n):
+        key, pos = _unpack(data, pos)
+        value, pos = _unpack(data, pos)
+        result[key] = value
+    return result, pos
+
+
+# ---------------------------------------------------------------------------
+# LZSS "x-lzss" content encoding, same format as src/Lzss/Lzss.h
+# ---------------------------------------------------------------------------
+
+LZSS_OFFSET_BITS = 10
+LZSS_LENGTH_BITS = 6
+LZSS_WINDOW = 1 << LZSS_OFFSET_BITS
+LZSS_MIN_MATCH = 3
+LZSS_MAX_MATCH = LZSS_MIN_MATCH + (1 << LZSS_LENGTH_BITS) - 1
+LZSS_MAX_CHAIN = 16
+COMPRESS_MIN_SIZE = 256  # NC_COMPRESS_MIN_SIZE
+HOST_BATCH_PERIOD = 1000  # NC_HOST_BATCH_PERIOD
+
+
+def lzss_compress(data):
+    out = bytearray()
+    positions = {}  # 3 byte prefix -> positions, newest last
+    flags = 0
+    bit = 8
+    i = 0
+    while i < len(data):
+        if bit == 8:
+            flags = len(out)
+            out.append(0)
+            bit = 0
+        best_length, best_distance = 0, 0
+        max_length = min(LZSS_MAX_MATCH, len(data) - i)
+        if max_length >= LZSS_MIN_MATCH:
+            for candidate in reversed(positions.get(data[i:i + LZSS_MIN_MATCH], [])[-LZSS_MAX_CHAIN:]):
+                if i - candidate > LZSS_WINDOW:
+                    break
+                length = 0
+                while length < max_length and data[candidate + length] == data[i + length]:
+                    length += 1
+                if length > best_length:
+                    best_length, best_distance = length, i - candidate
+                    if length == max_length:
+                        break
+        if best_length >= LZSS_MIN_MATCH:
+            token = ((best_distance - 1) << LZSS_LENGTH_BITS) | (best_length - LZSS_MIN_MATCH)
+            out += struct.pack(">H", token)
+            advance = best_length
+        else:
+            out[flags] |= 1 << bit
+            out.append(data[i])
+            advance = 1
+        bit += 1
+        for _ in range(advance):
+            if i + LZSS_MIN_MATCH <= len(data):
+                positions.setdefault(data[i:i + LZSS_MIN_MATCH], []).append(i)
+            i += 1
+    return bytes(out)
+
+
+def lzss_decompress(data):
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        flags = data[pos]
+        pos += 1
+        for bit in range(8):
+            if pos >= len(data):
+                break
+            if flags & (1 << bit):
+                out.append(data[pos])
+                pos += 1
+            else:
+                token = struct.unpack(">H", data[pos:pos + 2])[0]
+                pos += 2
+                distance = (token >> LZSS_LENGTH_BITS) + 1
+                for _ in range((token & ((1 << LZSS_LENGTH_BITS) - 1)) + LZSS_MIN_MATCH):
+                    out.append(out[-distance])
+    return bytes(out)
+
+
+# ---------------------------------------------------------------------------
+# Definition versions and patches, same format as src/DefinitionPatch/DefinitionPatch.h
+# ---------------------------------------------------------------------------
+
+PATCH_END, PATCH_COPY, PATCH_INSERT = 0, 1, 2
+PATCH_BLOCK = 8  # shortest copy worth an operation
+
+
+def definition_etag(data):
+    value = 2166136261
+    for byte in data:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return '"%08x"' % value
+
+
+def _varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        out.append(byte | (0x80 if value else 0))
+        if not value:
+            return bytes(out)
+
+
+def make_patch(base, target):
+    """COPY / INSERT operations turning base into target, greedy over PATCH_BLOCK byte blocks"""
+    index = {}
+    for pos in range(len(base) - PATCH_BLOCK + 1):
+        index.setdefault(base[pos:pos + PATCH_BLOCK], pos)
+
+    out = bytearray()
+    pending = bytearray()
+    i = 0
+    while i < len(target):
+        pos = index.get(target[i:i + PATCH_BLOCK])
+        if pos is None:
+            pending.append(target[i])
+            i += 1
+            continue
+        length = PATCH_BLOCK
+        while i + length < len(target) and pos + length < len(base) and target[i + length] == base[pos + length]:
+            length += 1
+        if pending:
+            out += bytes([PATCH_INSERT]) + _varint(len(pending)) + pending
+            pending = bytearray()
+        out += bytes([PATCH_COPY]) + _varint(pos) + _varint(length)
+        i += length
+    if pending:
+        out += bytes([PATCH_INSERT]) + _varint(len(pending)) + pending
+    return bytes(out + bytes([PATCH_END]))
+
+
+def apply_patch(base, patch):
+    def varint():
+        nonlocal pos
+        value, shift = 0, 0
+        while True:
+            byte = patch[pos]
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value
+
+    out = bytearray()
+    pos = 0
+    while True:
+        op = patch[pos]
+        pos += 1
+        if op == PATCH_END:
+            return bytes(out)
+        if op == PATCH_COPY:
+            offset = varint()
+            length = varint()
+            out += base[offset:offset + length]
+        elif op == PATCH_INSERT:
+            length = varint()
+            out += patch[pos:pos + length]
+            pos += length
+        else:
+            raise ValueError("bad patch op %d" % op)
+
+
+def mutate(definition):
+    """Change one threshold / period, as a fleet wide rollout would"""
+    for options in (definition.get("o") or {}).values():
+        if isinstance(options, dict) and random.random() < 0.5:
+            key = "t" if "t" in options else "l" if "l" in options else None
+            if key:
+                options[key] = options[key] + 1
+                return
+    options = next(iter((definition.get("o") or {}).values()), None)
+    if isinstance(options, dict):
+        options["t"] = options.get("t", 0) + 1
+
+
+# ---------------------------------------------------------------------------
+# Statistics
+# ---------------------------------------------------------------------------
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p * len(values)))]
+
+
+class Stats:
+    def __init__(self):
+        self._lock = threading.Lock()
+        self.requests = {}  # endpoint -> [count, errors, bytes in, bytes out, latencies ms]
+        self.cycle_cpu = []  # simulated node encode CPU per cycle, us
+        self.node_cycle = {}  # node id -> {"@nc.cycle.avg": x, "@nc.cycle.max": y} posted by real nodes
+        self.boots = {}  # node id -> last posted boot timeline
+
+    def request(self, endpoint, ok, size_in, size_out, latency):
+        with self._lock:
+            entry = self.requests.setdefault(endpoint, [0, 0, 0, 0, []])
+            entry[0] += 1
+            entry[1] += 0 if ok else 1
+            entry[2] += size_in
+            entry[3] += size_out
+            if latency is not None:
+                entry[4].append(latency)
+
+    def cpu(self, us):
+        with self._lock:
+            self.cycle_cpu.append(us)
+
+    def node_counters(self, node_id, values):
+        with self._lock:
+            counters = self.node_cycle.setdefault(node_id, {})
+            for name in ("@nc.cycle.avg", "@nc.cycle.max"):
+                if name in values:
+                    counters[name] = values[name]
+
+    def boot(self, node_id, timeline):
+        with self._lock:
+            self.boots[node_id] = timeline
+
+    def report(self, seconds):
+        """@param seconds simulated time, so rates match a real fleet"""
+        with self._lock:
+            print("\n%-22s %8s %8s %7s %10s %10s %9s %9s" %
+                  ("endpoint", "requests", "req/s", "errors", "avg in B", "avg out B", "p50 ms", "p99 ms"))
+            for endpoint, (count, errors, size_in, size_out, latencies) in sorted(self.requests.items()):
+                print("%-22s %8d %8.1f %7d %10.0f %10.0f %9.1f %9.1f" % (
+                    endpoint, count, count / seconds, errors, size_in / count, size_out / count,
+                    percentile(latencies, 0.5), percentile(latencies, 0.99)))
+
+            if self.cycle_cpu:
+                print("\nsimulated node encode CPU per cycle: p50 %.0f us, p99 %.0f us" %
+                      (percentile(self.cycle_cpu, 0.5), percentile(self.cycle_cpu, 0.99)))
+
+            avg = [c["@nc.cycle.avg"] for c in self.node_cycle.values() if "@nc.cycle.avg" in c]
+            peak = [c["@nc.cycle.max"] for c in self.node_cycle.values() if "@nc.cycle.max" in c]
+            if avg or peak:
+                print("connector CPU per cycle (@nc.cycle.*, %d nodes): avg p50 %.0f us, max p99 %.0f us" %
+                      (len(self.node_cycle), percentile(avg, 0.5), percentile(peak, 0.99)))
+
+            if self.boots:
+                totals = [boot.get("t", 0) / 1000.0 for boot in self.boots.values()]
+                print("\nboot to first cycle (%d nodes): p50 %.0f ms, p99 %.0f ms" %
+                      (len(self.boots), percentile(totals, 0.5), percentile(totals, 0.99)))
+                phases = {}  # top level phases only, nested ones are included in them
+                for boot in self.boots.values():
+                    for name, _, duration, _, depth in boot.get("p", []):
+                        if not depth:
+                            phases.setdefault(name, []).append(duration / 1000.0)
+                for name, durations in phases.items():
+                    print("  %-10s p50 %8.1f ms  p99 %8.1f ms" %
+                          (name, percentile(durations, 0.5), percentile(durations, 0.99)))
+
+
+# ---------------------------------------------------------------------------
+# Hub emulator
+# ---------------------------------------------------------------------------
+
+
+class Hub:
+    def __init__(self, definition, latency_ms, error_rate, stats, compression=True):
+        self.compression = compression
+        self.history = {}  # etag -> msgpack of every version served
+        self.patches = {}  # (base etag, etag) -> patch
+        self.update(definition)
+        self.latency_ms = latency_ms
+        self.error_rate = error_rate
+        self.stats = stats
+        self.values = {}  # "node-id.field" -> last value
+        self._lock = threading.Lock()
+
+    def update(self, definition):
+        self.definition = pack(definition)
+        self.definition_lzss = lzss_compress(self.definition) if self.compression else None
+        self.etag = definition_etag(self.definition)
+        self.history[self.etag] = self.definition
+        # compact payload schema version is the last modified stamp in unix time
+        self.version = max(int(time.time()), getattr(self, "version", 0) + 1)
+        self.modified = formatdate(self.version, usegmt=True)
+        self.names = {options["i"]: name for name, options in (definition.get("o") or {}).items()
+                      if isinstance(options, dict) and "i" in options}
+
+    def handler(hub):
+        class Handler(BaseHTTPRequestHandler):
+            protocol_version = "HTTP/1.1"
+            disable_nagle_algorithm = True
+
+            def log_message(self, *args):
+                pass
+
+            def do_GET(self):
+                self._handle("GET")
+
+            def do_POST(self):
+                self._handle("POST")
+
+            def _handle(self, method):
+                started = time.perf_counter()
+                size = int(self.headers.get("content-length") or 0)
+                body = self.rfile.read(size) if size else b""
+                path, _, query = self.path.partition("?")
+
+                if hub.latency_ms:
+                    time.sleep(random.expovariate(1.0 / hub.latency_ms) / 1000.0)
+
+                encoded = self.headers.get("content-encoding") == "x-lzss"
+                if path != "/" and random.random() < hub.error_rate:
+                    endpoint, status, payload, headers = _endpoint(path), 503, b"", {}
+                elif encoded and not hub.compression:
+                    endpoint, status, payload, headers = _endpoint(path), 415, b"", {}
+                else:
+                    request = lzss_decompress(body) if encoded else body
+                    endpoint, status, payload, headers = hub.route(method, path, query, request, self.headers)
+
+                if (hub.compression and "x-lzss" in (self.headers.get("accept-encoding") or "")
+                        and len(payload) >= COMPRESS_MIN_SIZE):
+                    payload = hub.definition_lzss if payload is hub.definition else lzss_compress(payload)
+                    headers = dict(headers, **{"content-encoding": "x-lzss"})
+
+                self.send_response(status)
+                self.send_header("date", formatdate(time.time(), usegmt=True))
+                self.send_header("content-length", str(len(payload)))
+                for name, value in headers.items():
+                    self.send_header(name, value)
+                self.end_headers()
+                self.wfile.write(payload)
+
+                hub.stats.request("hub " + endpoint, status < 400, len(body), len(payload),
+                                  (time.perf_counter() - started) * 1000.0)
+
+        return Handler
+
+    def batch(self, node_id, values):
+        """Store sync out values of a node, @returns HTTP status"""
+        if isinstance(values, list):
+            if not values or values[0] != self.version:
+                return 409
+            pairs = zip(values[1::2], values[2::2])
+            values = {self.names.get(id, str(id)): value for id, value in pairs}
+        with self._lock:
+            for name, value in values.items():
+                self.values[node_id + "." + name] = value
+        self.stats.node_counters(node_id, values)
+        return 201
+
+    def route(self, method, path, query, body, headers):
+        parts = path.strip("/").split("/")
+
+        if method == "GET" and path.startswith("/definitions/sm/"):
+            base = headers.get("if-none-match")
+            if base == self.etag or (not base and headers.get("if-modified-since") == self.modified):
+                return "definitions", 304, b"", {}
+            response = {"content-type": "application/msgpack", "last-modified": self.modified, "etag": self.etag}
+            if base in self.history and "x-nc-patch" in (headers.get("a-im") or ""):
+                key = (base, self.etag)
+                if key not in self.patches:
+                    self.patches[key] = make_patch(self.history[base], self.definition)
+                return "definitions", 226, self.patches[key], dict(response, im="x-nc-patch")
+            return "definitions", 200, self.definition, response
+
+        if method == "POST" and len(parts) == 3 and parts[0] == "node" and parts[2] == "batch":
+            return "batch", self.batch(parts[1], unpack(body) if body else {}), b"", {}
+
+        if method == "POST" and path == "/nodes/batch":
+            # batches of all nodes are stored, 409 if any of them was rejected
+            items = unpack(body) if body else []
+            statuses = [self.batch(node_id, batch) for node_id, batch in zip(items[0::2], items[1::2])]
+            return "nodes batch", max(statuses, default=201), b"", {}
+
+        if method == "POST" and len(parts) == 3 and parts[0] == "node" and parts[2] == "boot":
+            self.stats.boot(parts[1], unpack(body) if body else {})
+            return "boot", 201, b"", {}
+
+        if method == "GET" and path == "/aggregate/batch/flat":
+            with self._lock:
+                result = {field: self.values.get(field, 0) for field in query.split("&") if field}
+            return "aggregate", 200, pack(result), {"content-type": "application/msgpack"}
+
+        if method == "GET" and path == "/aggregate/batch/compact":
+            result = []
+            with self._lock:
+                for field, _, id in (item.partition("=") for item in query.split("&") if item):
+                    result += [int(id), self.values.get(field, 0)]
+            return "aggregate", 200, pack(result), {"content-type": "application/msgpack"}
+
+        if method == "GET" and path == "/":
+            return "probe", 200, b"", {}
+
+        return "unknown", 404, b"", {}
+
+
+def _endpoint(path):
+    if path.startswith("/definitions/"):
+        return "definitions"
+    if path.startswith("/node/"):
+        return "boot" if path.endswith("/boot") else "batch"
+    if path.startswith("/nodes/"):
+        return "nodes batch"
+    if path.startswith("/aggregate/"):
+        return "aggregate"
+    return "unknown"
+
+
+# ---------------------------------------------------------------------------
+# Simulated node
+# ---------------------------------------------------------------------------
+
+
+class SimClock:
+    """Simulated milliseconds, running `speed` times faster than real time"""
+
+    def __init__(self, speed):
+        self.speed = speed
+        self.start = time.monotonic()
+
+    def millis(self):
+        return int((time.monotonic() - self.start) * 1000.0 * self.speed)
+
+    def sleep(self, ms):
+        time.sleep(ms / 1000.0 / self.speed)
+
+
+class Variable:
+    def __init__(self, name, options):
+        self.name = name
+        self.sync_type = options.get("s", "i")
+        self.preprocessing = options.get("p", "l")
+        self.frame_type = options.get("f", "c")
+        self.frame_length = int(options.get("l", 1)) or 1
+        self.threshold = float(options.get("t", 1))
+        self.priority = options.get("u", "n")
+        self.id = options.get("i")
+        self.value = random.uniform(0, 100)
+        self.last_sent = None
+        self.frame = []
+        self.frame_start = None
+
+    def sample(self):
+        # random walk, roughly like a noisy sensor
+        self.value += random.gauss(0, 1)
+        return round(self.value, 2)
+
+    def update(self, value, cycle, ms):
+        """@returns value to emit in this cycle or None"""
+        if self.sync_type == "c":
+            if self.last_sent is None or abs(value - self.last_sent) >= self.threshold:
+                self.last_sent = value
+                return value
+            return None
+
+        if self.sync_type == "p":
+            now = cycle if self.frame_type == "c" else ms // 1000 if self.frame_type == "w" else ms
+            if self.frame_start is None:
+                self.frame_start = now
+            self.frame.append(value)
+            if now - self.frame_start < self.frame_length:
+                return None
+            values = [_aggregate(self.frame, letter) for letter in self.preprocessing]
+            self.frame = []
+            self.frame_start = now
+            if self.frame_type == "w":
+                values.insert(0, int(time.time()))
+            return values[0] if len(values) == 1 else values
+
+        return value
+
+
+def _aggregate(values, letter):
+    if letter == "f":
+        return values[0]
+    if letter == "a":
+        return sum(values) / len(values)
+    if letter == "n":
+        return min(values)
+    if letter == "x":
+        return max(values)
+    if letter == "c":
+        return len(values)
+    if letter == "s":
+        return sum(values)
+    if letter in ("q", "m"):
+        return percentile(values, 0.95 if letter == "q" else 0.5)
+    return values[-1]
+
+
+class Node:
+    def __init__(self, node_id, host, port, clock, cycle_ms, duration_ms, stats):
+        self.node_id = node_id
+        self.host = host
+        self.port = port
+        self.clock = clock
+        self.cycle_ms = cycle_ms
+        self.duration_ms = duration_ms
+        self.stats = stats
+        self.connection = HTTPConnection(host, port, timeout=10)
+        self.modified = None
+        self.compression = False  # hub answered compressed, so posts above COMPRESS_MIN_SIZE are too
+
+    def request(self, endpoint, method, path, body=None, headers=None):
+        headers = dict(headers or {})
+        if method == "GET":
+            headers["accept-encoding"] = "x-lzss"
+        elif self.compression and body and len(body) >= COMPRESS_MIN_SIZE:
+            packed = lzss_compress(body)
+            if len(packed) < len(body):
+                body = packed
+                headers["content-encoding"] = "x-lzss"
+
+        started = time.perf_counter()
+        try:
+            self.connection.request(method, path, body=body, headers=headers)
+            response = self.connection.getresponse()
+            payload = response.read()
+            status = response.status
+        except OSError:
+            self.connection.close()
+            self.connection = HTTPConnection(self.host, self.port, timeout=10)
+            status, payload, response = 0, b"", None
+        latency = (time.perf_counter() - started) * 1000.0
+        ok = 200 <= status < 400
+        self.stats.request("node " + endpoint, ok, len(body or b""), len(payload), latency)
+
+        if status == 415:
+            self.compression = False
+        if response is not None and response.getheader("content-encoding") == "x-lzss":
+            self.compression = True
+            payload = lzss_decompress(payload)
+        return status, payload, response
+
+    def fetch_definition(self, delta=True):
+        """Same as NodeConnector: offer the held version for a patch, verify, fall back to full"""
+        headers = {"accept": "application/msgpack"}
+        if self.definition and delta:
+            headers.update({"if-modified-since": self.modified or "", "a-im": "x-nc-patch",
+                            "if-none-match": definition_etag(self.definition)})
+        status, payload, response = self.request("definitions", "GET", "/definitions/sm/" + self.node_id,
+                                                 headers=headers)
+        if status not in (200, 226):
+            return status == 304
+        data = apply_patch(self.definition, payload) if status == 226 else payload
+        if response.getheader("etag") not in (None, definition_etag(data)):
+            return status == 226 and self.fetch_definition(delta=False)
+        self.definition = data
+        self.modified = response.getheader("last-modified")
+        return True
+
+    def setup(self):
+        """Fetch definition and derive sync options, @returns False if there is none"""
+        self.definition = None
+        if not self.fetch_definition():
+            return False
+        definition = unpack(self.definition)
+
+        self.variables = [Variable(name, options) for name, options in (definition.get("o") or {}).items()]
+        sync_in = definition.get("i") or {}
+        self.fields = [f for f in sync_in.get("f", []) if f]
+        self.sync_delay = int(sync_in.get("d", 60000))
+
+        # same rules as the connector: compact only if every variable / field has an id
+        self.compact = bool(self.variables) and all(variable.id for variable in self.variables)
+        self.version = int(parsedate_to_datetime(self.modified).timestamp()) if self.modified else 0
+        ids = sync_in.get("n") or []
+        if len(ids) == len(self.fields) and all(ids):
+            self.sync_in_path = "/aggregate/batch/compact?" + "&".join("%s=%d" % pair for pair in zip(self.fields, ids))
+        else:
+            self.sync_in_path = "/aggregate/batch/flat?" + "&".join(self.fields)
+
+        self.batch_path = "/node/%s/batch" % self.node_id
+        self.last_low = 0
+        self.last_check = self.clock.millis()
+        return True
+
+    def collect(self, cycle, ms):
+        """One cycle of variable updates, @returns encoded batches as [(urgent, body), ...]"""
+        started = time.thread_time_ns()
+        lanes = {"h": {}, "n": {}, "l": {}}
+        for variable in self.variables:
+            value = variable.update(variable.sample(), cycle, ms)
+            if value is not None:
+                lanes.get(variable.priority, lanes["n"])[variable.id if self.compact else variable.name] = value
+
+        batches = [lanes["h"]]
+        normal = dict(lanes["n"])
+        if ms - self.last_low >= 10000:
+            normal.update(lanes["l"])
+            self.last_low = ms
+        batches.append(normal)
+        if self.compact:
+            batches = [[self.version] + [item for pair in batch.items() for item in pair] if batch else None
+                       for batch in batches]
+        encoded = [(urgent, pack(batch)) for urgent, batch in zip((True, False), batches) if batch]
+        self.stats.cpu((time.thread_time_ns() - started) / 1000.0)
+        return encoded
+
+    def check_definition(self, ms):
+        """Definition check, as NodeConnector.loop does every `timeOut` ms (default 1 min)"""
+        self.last_check = ms
+        if self.fetch_definition() and self.modified:
+            self.version = int(parsedate_to_datetime(self.modified).timestamp())
+
+    def run(self):
+        if not self.setup():
+            return
+
+        last_sync_in = -self.sync_delay
+        cycle = 0
+
+        while self.clock.millis() < self.duration_ms:
+            cycle += 1
+            ms = self.clock.millis()
+
+            for _, body in self.collect(cycle, ms):
+                self.request("batch", "POST", self.batch_path, body, {"content-type": "application/msgpack"})
+
+            if self.fields and ms - last_sync_in >= self.sync_delay:
+                last_sync_in = ms
+                self.request("aggregate", "GET", self.sync_in_path, headers={"accept": "application/msgpack"})
+
+            if ms - self.last_check >= 60000:
+                self.check_definition(ms)
+
+            self.clock.sleep(self.cycle_ms)
+
+        self.connection.close()
+
+
+class Device:
+    """Virtual nodes of one device (NodeHost): cycled together, batches and sync in polls merged"""
+
+    def __init__(self, nodes, clock, cycle_ms, duration_ms):
+        self.nodes = nodes
+        self.clock = clock
+        self.cycle_ms = cycle_ms
+        self.duration_ms = duration_ms
+
+    def run(self):
+        nodes = [node for node in self.nodes if node.setup()]
+        if not nodes:
+            return
+        client = nodes[0]  # one hub connection for the device
+
+        # each field once, names only: compact ids are per node
+        fields = list(dict.fromkeys(field for node in nodes for field in node.fields))
+        sync_delay = min((node.sync_delay for node in nodes if node.fields), default=0)
+        sync_in_path = "/aggregate/batch/flat?" + "&".join(fields)
+
+        pending, urgent, last_flush = [], False, 0
+        last_sync_in = -sync_delay
+        next_check = 0
+        cycle = 0
+
+        while self.clock.millis() < self.duration_ms:
+            cycle += 1
+            ms = self.clock.millis()
+
+            for node in nodes:
+                for is_urgent, body in node.collect(cycle, ms):
+                    pending += [node.node_id, Raw(body)]
+                    urgent = urgent or is_urgent
+
+            # BatchMux: urgent batches right away, others every NC_HOST_BATCH_PERIOD
+            if pending and (urgent or ms - last_flush >= HOST_BATCH_PERIOD):
+                client.request("nodes batch", "POST", "/nodes/batch", pack(pending),
+                               {"content-type": "application/msgpack"})
+                pending, urgent, last_flush = [], False, ms
+
+            if fields and ms - last_sync_in >= sync_delay:
+                last_sync_in = ms
+                client.request("aggregate", "GET", sync_in_path, headers={"accept": "application/msgpack"})
+
+            # one node per cycle
+            node = nodes[next_check]
+            if ms - node.last_check >= 60000:
+                next_check = (next_check + 1) % len(nodes)
+                node.check_definition(ms)
+
+            self.clock.sleep(self.cycle_ms)
+
+        for node in self.nodes:
+            node.connection.close()
+
+
+# ---------------------------------------------------------------------------
+
+
+DEFAULT_DEFINITION = {
+    "s": {},
+    "o": {
+        "temperature": {"s": "p", "p": "nxa", "f": "d", "l": 60000},
+        "humidity": {"s": "c", "t": 2},
+        "door": {"s": "c", "t": 1, "u": "h"},
+        "rssi": {"s": "p", "p": "a", "f": "c", "l": 100, "u": "l"},
+    },
+    "i": {"f": ["node-0.temperature"], "d": 60000},
+}
+
+
+def with_ids(definition):
+    """Number sync out variables and sync in fields missing an id (\"i\" / \"n\" options)"""
+    for id, options in enumerate((definition.get("o") or {}).values(), 1):
+        options.setdefault("i", id)
+    sync_in = definition.get("i") or {}
+    if sync_in.get("f"):
+        sync_in.setdefault("n", list(range(1, len(sync_in["f"]) + 1)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Fusor Hub emulator and node load simulator")
+    parser.add_argument("--port", type=int, default=3000)
+    parser.add_argument("--definition", help="node definition JSON file (same for all nodes)")
+    parser.add_argument("--nodes", type=int, default=100, help="simulated nodes")
+    parser.add_argument("--threads", type=int, default=0, help="worker threads, defaults to number of nodes")
+    parser.add_argument("--duration", type=float, default=60, help="simulated seconds")
+    parser.add_argument("--speed", type=float, default=1, help="simulated clock speed-up")
+    parser.add_argument("--cycle", type=float, default=100, help="simulated state machine cycle, ms")
+    parser.add_argument("--hub-latency", type=float, default=0, help="mean injected hub latency, ms")
+    parser.add_argument("--hub-errors", type=float, default=0, help="share of requests failing with 503")
+    parser.add_argument("--serve-only", action="store_true", help="run hub emulator for real nodes")
+    parser.add_argument("--compact", action="store_true", help="assign numeric ids, nodes use compact payloads")
+    parser.add_argument("--no-compression", action="store_true", help="hub neither sends nor takes x-lzss payloads")
+    parser.add_argument("--nodes-per-device", type=int, default=1,
+                        help="virtual nodes per device (NodeHost), merging their batches and sync in polls")
+    parser.add_argument("--mutate-every", type=float, default=0,
+                        help="simulated seconds between definition changes, nodes pick them up as patches")
+    args = parser.parse_args()
+
+    definition = DEFAULT_DEFINITION
+    if args.definition:
+        with open(args.definition) as file:
+            definition = json.load(file)
+
+    if args.compact:
+        with_ids(definition)
+
+    stats = Stats()
+    hub = Hub(definition, args.hub_latency, args.hub_errors, stats, not args.no_compression)
+    server = ThreadingHTTPServer(("127.0.0.1" if not args.serve_only else "0.0.0.0", args.port), hub.handler())
+    server.daemon_threads = True
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+
+    if args.mutate_every:
+        def rollouts():
+            speed = 1 if args.serve_only else args.speed
+            while True:
+                time.sleep(args.mutate_every / speed)
+                mutate(definition)
+                hub.update(definition)
+
+        threading.Thread(target=rollouts, daemon=True).start()
+
+    started = time.monotonic()
+    try:
+        if args.serve_only:
+            print("Hub emulator listening on port %d, Ctrl+C to stop" % args.port)
+            while True:
+                time.sleep(1)
+        else:
+            clock = SimClock(args.speed)
+            duration_ms = args.duration * 1000.0
+            nodes = [Node("node-%d" % i, "127.0.0.1", args.port, clock, args.cycle, duration_ms, stats)
+                     for i in range(args.nodes)]
+            per_device = max(args.nodes_per_device, 1)
+            if per_device > 1:
+                nodes = [Device(nodes[i:i + per_device], clock, args.cycle, duration_ms)
+                         for i in range(0, len(nodes), per_device)]
+            with ThreadPoolExecutor(max_workers=args.threads or len(nodes)) as pool:
+                for future in [pool.submit(node.run) for node in nodes]:
+                    future.result()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.shutdown()
+
+    seconds = time.monotonic() - started
+    speed = 1 if args.serve_only else args.speed
+    print("\n%d nodes, %.1f s real time, %.1f s simulated" % (args.nodes, seconds, seconds * speed))
+    stats.report(seconds * speed)
+
+
+if __name__ == "__main__":
+    main()
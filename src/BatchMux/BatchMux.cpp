@@ -0,0 +1,148 @@
+#include "../Log/Log.h"
+#include "../Utils/Utils.h"
+#include "../MemoryTracker/MemoryTracker.h"
+#include "BatchMux.h"
+
+#if NC_FEATURE_NODE_HOST
+
+void BatchMux::init(HubClient *hub)
+{
+    _hub = hub;
+}
+
+/**
+ * Collect encoded batch of a node, posting collected ones first if there is no room left
+ * @param nodeId batch owner, must outlive the mux
+ * @param path node's own batch path, used if batch is too large to be merged
+ * @param urgent post with the next flush, retried like high priority batches
+ * @returns false if batch was lost
+ */
+bool BatchMux::add(const char *nodeId, const char *path, const uint8_t *batch, size_t size, bool urgent)
+{
+    size_t idLength = strlen(nodeId);
+    size_t itemSize = _stringHeaderSize(idLength) + idLength + size;
+    uint8_t attempts = urgent ? 1 + NC_HIGH_PRIORITY_RETRY : 1;
+
+    if (!_buffer && BATCH_MUX_HEADER + itemSize <= NC_HOST_BATCH_SIZE)
+        _buffer = (uint8_t *)__nc_mem.alloc(MEM_SYNC_OUT, NC_HOST_BATCH_SIZE);
+
+    if (!_buffer || BATCH_MUX_HEADER + itemSize > NC_HOST_BATCH_SIZE)
+    {
+        int httpCode = _post(path, batch, size, attempts);
+        return httpCode >= 200 && httpCode < 300;
+    }
+
+    if (_size + itemSize > NC_HOST_BATCH_SIZE)
+        flush();
+
+    _writeString(nodeId, idLength);
+    memcpy(_buffer + _size, batch, size);
+    _size += size;
+
+    _count++;
+    _urgent = _urgent || urgent;
+
+    return true;
+}
+
+/**
+ * Collected batches have to be posted: urgent one is waiting or period is over
+ */
+bool BatchMux::isDue()
+{
+    return _count && (_urgent || getTimeout(_lastFlush) >= NC_HOST_BATCH_PERIOD);
+}
+
+/**
+ * Post collected batches as one request, they are dropped if it fails
+ * @returns HTTP status, 0 if there was nothing to post
+ */
+int BatchMux::flush()
+{
+    if (!_count)
+        return 0;
+
+    // array header goes right in front of the items
+    uint32_t items = (uint32_t)_count * 2;
+    uint8_t *start;
+    if (items < 16)
+    {
+        start = _buffer + BATCH_MUX_HEADER - 1;
+        start[0] = 0x90 | items;
+    }
+    else
+    {
+        start = _buffer + BATCH_MUX_HEADER - 3;
+        start[0] = 0xDC;
+        start[1] = items >> 8;
+        start[2] = items;
+    }
+
+    int httpCode = _post(ENDPOINT_NODES_BATCH, start, _size - (start - _buffer), _urgent ? 1 + NC_HIGH_PRIORITY_RETRY : 1);
+    if (httpCode < 200 || httpCode >= 300)
+        NC_LOG_WARN(F("Merged batch dropped"), nullptr, (long)_count);
+
+    _size = BATCH_MUX_HEADER;
+    _count = 0;
+    _urgent = false;
+    _lastFlush = millis();
+
+    return httpCode;
+}
+
+/**
+ * Last post failed or was slower than NC_CONGESTION_LATENCY
+ */
+bool BatchMux::congested()
+{
+    return _congested;
+}
+
+int BatchMux::_post(const char *path, const uint8_t *payload, size_t size, uint8_t attempts)
+{
+    int httpCode = 0;
+    for (uint8_t i = 0; i < attempts; i++)
+    {
+        unsigned long start = millis();
+        // batch that is not urgent can wait for a probe of a standby hub
+        httpCode = _hub->postMsgPack(path, payload, size, !_urgent);
+
+        bool success = httpCode >= 200 && httpCode < 300;
+        _congested = !success || diff(start, millis()) > NC_CONGESTION_LATENCY;
+        if (success)
+            break;
+    }
+
+    return httpCode;
+}
+
+/**
+ * Append msgpack string
+ */
+void BatchMux::_writeString(const char *str, size_t length)
+{
+    uint8_t *out = _buffer + _size;
+    if (length < 32)
+        *out++ = 0xA0 | length;
+    else if (length < 256)
+    {
+        *out++ = 0xD9;
+        *out++ = length;
+    }
+    else
+    {
+        *out++ = 0xDA;
+        *out++ = length >> 8;
+        *out++ = length;
+    }
+
+    memcpy(out, str, length);
+    _size = out + length - _buffer;
+}
+
+size_t BatchMux::_stringHeaderSize(size_t length)
+{
+    return length < 32 ? 1 : length < 256 ? 2 : 3;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef batchmux_h
+#define batchmux_h
+
+#include <Arduino.h>
+
+#include "../NodeConnectorConfig.h"
+#include "../HubClient/HubClient.h"
+
+/*
+ * Sync out batches of the virtual nodes of a host (see NodeHost.h), posted in one request.
+ *
+ * Nodes hand their encoded batches over instead of posting them. Host posts what is collected
+ * every NC_HOST_BATCH_PERIOD ms, or right after the cycle if a batch is urgent (high priority lane),
+ * to `/nodes/batch` as
+ *
+ *   [ "<node-id>", <batch>, "<node-id>", <batch>, ... ]
+ *
+ * where each batch is exactly what the node would post to `/node/<node-id>/batch` (map or
+ * compact array), copied as encoded. A node may appear more than once, eg. with its high
+ * and normal lane batches. Batch that does not fit NC_HOST_BATCH_SIZE is posted alone
+ * to the node's own path.
+ */
+
+#define BATCH_MUX_HEADER 3 // msgpack array header (fixarray or array 16), written in front of the batches on flush
+
+const char ENDPOINT_NODES_BATCH[] = "/nodes/batch";
+
+class BatchMux
+{
+public:
+    void init(HubClient *);
+
+    bool add(const char *, const char *, const uint8_t *, size_t, bool);
+    bool isDue();
+    int flush();
+    bool congested();
+
+private:
+    HubClient *_hub = nullptr;
+    uint8_t *_buffer = nullptr;
+    size_t _size = BATCH_MUX_HEADER; // used bytes, header space included
+    uint16_t _count = 0;             // collected batches
+    bool _urgent = false;
+    bool _congested = false;
+    unsigned long _lastFlush = 0;
+
+    int _post(const char *, const uint8_t *, size_t, uint8_t);
+    void _writeString(const char *, size_t);
+    static size_t _stringHeaderSize(size_t);
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "../PrintWrapper/PrintWrapper.h"
+#include "BootTimeline.h"
+
+#if NC_FEATURE_BOOT_TIMELINE
+
+BootTimeline __nc_boot;
+
+/**
+ * Start a phase, phases started before this one ends are nested in it
+ * @param name string literal, kept by pointer
+ * @returns phase index for `end`, BOOT_PHASE_NONE if not recorded
+ */
+uint8_t BootTimeline::begin(const char *name)
+{
+    if (_finished || _count >= NC_BOOT_PHASES)
+        return BOOT_PHASE_NONE;
+
+    BootPhase *phase = &_phases[_count];
+    phase->name = name;
+    phase->start = micros();
+    phase->duration = 0;
+    phase->bytes = 0;
+    phase->depth = _depth++;
+
+    return _count++;
+}
+
+/**
+ * @param bytes bytes read, written or transferred by the phase
+ */
+void BootTimeline::end(uint8_t index, uint32_t bytes)
+{
+    if (index >= _count)
+        return;
+
+    BootPhase *phase = &_phases[index];
+    phase->duration = diff(phase->start, micros());
+    phase->bytes += bytes;
+
+    if (_depth)
+        _depth--;
+}
+
+/**
+ * Close the timeline, call at the end of the first state machine cycle
+ */
+void BootTimeline::finish()
+{
+    if (_finished)
+        return;
+
+    _total = micros();
+    _finished = true;
+}
+
+bool BootTimeline::isFinished()
+{
+    return _finished;
+}
+
+uint8_t BootTimeline::count()
+{
+    return _count;
+}
+
+const BootPhase *BootTimeline::phase(uint8_t index)
+{
+    return index < _count ? &_phases[index] : nullptr;
+}
+
+/**
+ * @returns us from reset to the end of the first cycle, 0 until then
+ */
+uint32_t BootTimeline::total()
+{
+    return _total;
+}
+
+size_t BootTimeline::jsonSize()
+{
+    return JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(_count) + _count * JSON_ARRAY_SIZE(5);
+}
+
+/**
+ * @param definitionHash hash of the definition the node booted with
+ */
+void BootTimeline::toJson(DynamicJsonDocument *output, uint32_t definitionHash)
+{
+    (*output)["fw"] = NC_FIRMWARE_VERSION;
+    (*output)["d"] = definitionHash;
+    (*output)["t"] = _total;
+
+    JsonArray phases = output->createNestedArray("p");
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        JsonArray item = phases.createNestedArray();
+        item.add(_phases[i].name);
+        item.add(_phases[i].start);
+        item.add(_phases[i].duration);
+        item.add(_phases[i].bytes);
+        item.add(_phases[i].depth);
+    }
+}
+
+void BootTimeline::report(Print &out)
+{
+    out << F("Boot timeline (us): ") << _total << "\n";
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        BootPhase *phase = &_phases[i];
+        for (uint8_t d = 0; d <= phase->depth; d++)
+            out << "  ";
+
+        out << phase->name << F(" @") << phase->start << F(" +") << phase->duration;
+        if (phase->bytes)
+            out << F(", ") << phase->bytes << F(" B");
+        out << "\n";
+    }
+}
+
+#endif
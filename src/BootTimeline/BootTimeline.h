@@ -0,0 +1,70 @@
+#ifndef boottimeline_h
+#define boottimeline_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "../NodeConnectorConfig.h"
+#include "../Utils/Utils.h"
+
+/*
+ * Timeline of named boot phases, from reset to the end of the first state machine cycle.
+ *
+ * Each phase keeps its start (us since reset), duration (us), bytes moved and nesting depth,
+ * eg. "fetch" contains "wifi" and "parse", "init" contains "storage" and "params".
+ * Phases started after the first cycle are not recorded.
+ *
+ * With NC_BOOT_POST the timeline is posted to the hub once (`/node/<node-id>/boot`), as
+ *
+ *   { "fw": NC_FIRMWARE_VERSION, "d": <definition hash>, "t": <total us>,
+ *     "p": [[name, start, duration, bytes, depth], ...] }
+ */
+
+#define BOOT_PHASE_NONE 0xFF
+
+typedef struct BootPhase
+{
+    const char *name; // string literal
+    uint32_t start;
+    uint32_t duration;
+    uint32_t bytes;
+    uint8_t depth;
+} BootPhase;
+
+class BootTimeline
+{
+public:
+    uint8_t begin(const char *);
+    void end(uint8_t, uint32_t bytes = 0);
+    void finish();
+
+    bool isFinished();
+    uint8_t count();
+    const BootPhase *phase(uint8_t);
+    uint32_t total();
+
+    size_t jsonSize();
+    void toJson(DynamicJsonDocument *, uint32_t);
+    void report(Print &);
+
+private:
+    BootPhase _phases[NC_BOOT_PHASES];
+    uint8_t _count = 0;
+    uint8_t _depth = 0;
+    uint32_t _total = 0;
+    bool _finished = false;
+};
+
+extern BootTimeline __nc_boot;
+
+#if NC_FEATURE_BOOT_TIMELINE
+#define NC_BOOT_BEGIN(var, name) uint8_t var = __nc_boot.begin(name)
+#define NC_BOOT_END(var, bytes) __nc_boot.end(var, bytes)
+#define NC_BOOT_CALL(call) __nc_boot.call
+#else
+#define NC_BOOT_BEGIN(var, name) ((void)0)
+#define NC_BOOT_END(var, bytes) ((void)0)
+#define NC_BOOT_CALL(call) ((void)0)
+#endif
+
+#endif
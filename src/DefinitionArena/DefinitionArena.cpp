@@ -0,0 +1,115 @@
+#include "../Log/Log.h"
+#include "DefinitionArena.h"
+
+DefinitionArena::~DefinitionArena()
+{
+    release();
+}
+
+/**
+ * Prepare arena for a new definition
+ * @param size estimated size of all definition lifetime allocations
+ */
+void DefinitionArena::begin(size_t size)
+{
+    release();
+    _addBlock(size);
+}
+
+/**
+ * Free all arena memory at once
+ * IMPORTANT: all objects living in the arena must be dropped before
+ */
+void DefinitionArena::release()
+{
+    while (_head)
+    {
+        ArenaBlock *next = _head->next;
+        __nc_mem.free(MEM_DEFINITION, _head, sizeof(ArenaBlock) + _head->size);
+        _head = next;
+    }
+
+    for (uint8_t i = 0; i < MEM_TAG_COUNT; i++)
+        _used[i] = 0;
+}
+
+void *DefinitionArena::alloc(MemoryTag tag, size_t size)
+{
+    size = ARENA_SIZE(size);
+
+    // estimate was too small, grow by a new block
+    if (!reserve(size))
+        return nullptr;
+
+    void *memory = (uint8_t *)(_head + 1) + _head->used;
+    _head->used += size;
+    _used[tag] += size;
+    return memory;
+}
+
+/**
+ * Make sure next allocation of `size` bytes succeeds, growing arena if needed
+ * @returns false if there is no memory for it
+ */
+bool DefinitionArena::reserve(size_t size)
+{
+    size = ARENA_SIZE(size);
+
+    if (_head && _head->size - _head->used >= size)
+        return true;
+
+    NC_LOG_DEBUG(F("Arena grows by"), nullptr, (unsigned long)size);
+    return _addBlock(size > ARENA_MIN_BLOCK_SIZE ? size : ARENA_MIN_BLOCK_SIZE);
+}
+
+char *DefinitionArena::copy(MemoryTag tag, const char *str)
+{
+    char *result = (char *)alloc(tag, strlen(str) + 1);
+    if (result)
+        strcpy(result, str);
+    return result;
+}
+
+size_t DefinitionArena::used()
+{
+    size_t total = 0;
+    for (ArenaBlock *block = _head; block; block = block->next)
+        total += block->used;
+    return total;
+}
+
+size_t DefinitionArena::used(MemoryTag tag)
+{
+    return _used[tag];
+}
+
+size_t DefinitionArena::capacity()
+{
+    size_t total = 0;
+    for (ArenaBlock *block = _head; block; block = block->next)
+        total += block->size;
+    return total;
+}
+
+uint8_t DefinitionArena::blockCount()
+{
+    uint8_t count = 0;
+    for (ArenaBlock *block = _head; block; block = block->next)
+        count++;
+    return count;
+}
+
+ArenaBlock *DefinitionArena::_addBlock(size_t size)
+{
+    size = ARENA_SIZE(size);
+
+    ArenaBlock *block = (ArenaBlock *)__nc_mem.alloc(MEM_DEFINITION, sizeof(ArenaBlock) + size);
+    if (!block)
+        return nullptr;
+
+    block->next = _head;
+    block->size = size;
+    block->used = 0;
+    _head = block;
+    return block;
+}
@@ -0,0 +1,108 @@
+#ifndef definitionarena_h
+#define definitionarena_h
+
+#include <new>
+#include <stddef.h>
+#include <Arduino.h>
+
+#include "../MemoryTracker/MemoryTracker.h"
+
+/*
+ * Arena for everything derived from the node definition (urls, sync out configs,
+ * persistent storage records, copied keys, map nodes).
+ *
+ * Memory is carved from one block sized when definition is loaded
+ * and released in one shot when definition is replaced.
+ * If size estimate was too small, arena grows by extra blocks.
+ * Individual allocations are never freed.
+ */
+
+#define ARENA_ALIGNMENT sizeof(void *)
+#define ARENA_MIN_BLOCK_SIZE 256
+
+// bytes an allocation of `size` takes from a block
+#define ARENA_SIZE(size) (((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+// approximate size of std::map node (color, parent, left, right + value), used for arena size estimates
+#define ARENA_MAP_NODE_SIZE(value_type) (4 * sizeof(void *) + sizeof(value_type))
+
+typedef struct ArenaBlock
+{
+    ArenaBlock *next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+class DefinitionArena
+{
+public:
+    ~DefinitionArena();
+
+    void begin(size_t);
+    void release();
+
+    void *alloc(MemoryTag, size_t);
+    bool reserve(size_t);
+    char *copy(MemoryTag, const char *);
+
+    template <typename T, typename... Args>
+    T *create(MemoryTag tag, Args... args)
+    {
+        void *memory = alloc(tag, sizeof(T));
+        return memory ? new (memory) T(args...) : nullptr;
+    }
+
+    size_t used();
+    size_t used(MemoryTag);
+    size_t capacity();
+    uint8_t blockCount();
+
+private:
+    ArenaBlock *_head = nullptr;
+    size_t _used[MEM_TAG_COUNT] = {0};
+
+    ArenaBlock *_addBlock(size_t);
+};
+
+/*
+ * STL allocator carving container nodes from the arena.
+ * Deallocation is a no-op, memory comes back with `DefinitionArena::release`.
+ *
+ * Containers cannot report a failed allocation, so callers `reserve` room for a node
+ * before inserting and give up if there is none. If arena is out of memory anyway,
+ * `allocate` throws std::bad_alloc (returns nullptr in builds without exceptions).
+ */
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    ArenaAllocator(DefinitionArena *arena, MemoryTag tag) : arena(arena), tag(tag) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena), tag(other.tag) {}
+
+    T *allocate(size_t n)
+    {
+        void *memory = arena->alloc(tag, n * sizeof(T));
+#if __cpp_exceptions
+        if (!memory)
+            throw std::bad_alloc();
+#endif
+        return (T *)memory;
+    }
+
+    void deallocate(T *, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+
+    DefinitionArena *arena;
+    MemoryTag tag;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "DefinitionCache.h"
+
+DefinitionCache::DefinitionCache()
+{
+    setNamespace(nullptr);
+}
+
+/**
+ * Keep the record of a virtual node apart from other nodes on the device
+ * @param ns path prefix, eg. "/pump", nullptr for the device itself
+ */
+void DefinitionCache::setNamespace(const char *ns)
+{
+    filePath(_path, ns, DEFINITION_CACHE_PATH);
+}
+
+/**
+ * Cache key of a definition loaded by a node
+ * @param definitionHash hash of the definition file
+ */
+uint32_t DefinitionCache::key(uint32_t definitionHash, const char *nodeId)
+{
+    return nodeId ? hashBytes(definitionHash, (const uint8_t *)nodeId, strlen(nodeId)) : definitionHash;
+}
+
+/**
+ * Read the record if it belongs to the definition
+ * @returns true if cached plan can be used
+ */
+bool DefinitionCache::load(FileSystem *fs, uint32_t key)
+{
+    _valid = false;
+
+    if (!fs->exists(_path))
+        return false;
+
+    File file = fs->open(_path, "r");
+    size_t read = file.read((uint8_t *)&_record, sizeof(_record));
+    file.close();
+
+    _valid = read == sizeof(_record) &&
+             _record.magic == DEFINITION_CACHE_MAGIC &&
+             _record.features == _features() &&
+             _record.key == key;
+
+    return _valid;
+}
+
+/**
+ * Remember the plan of the definition, written only if it changed
+ * @returns true if record was written
+ */
+bool DefinitionCache::store(FileSystem *fs, uint32_t key, size_t arenaSize)
+{
+    if (_valid && _record.key == key && _record.arenaSize == arenaSize)
+        return false;
+
+    _record.magic = DEFINITION_CACHE_MAGIC;
+    _record.features = _features();
+    _record.key = key;
+    _record.arenaSize = arenaSize;
+
+    File file = fs->open(_path, "w");
+    _valid = file.write((const uint8_t *)&_record, sizeof(_record)) == sizeof(_record);
+    file.close();
+
+    return _valid;
+}
+
+/**
+ * @returns cached arena size of the definition, 0 if it is not known
+ */
+size_t DefinitionCache::arenaSize(uint32_t key)
+{
+    return _valid && _record.key == key ? _record.arenaSize : 0;
+}
+
+uint32_t DefinitionCache::_features()
+{
+    return NC_FEATURE_SYNC_OUT |
+           NC_FEATURE_SYNC_IN << 1 |
+           NC_FEATURE_PERSISTENCE << 2 |
+           NC_FEATURE_TIME_FUNCTIONS << 3 |
+           NC_FEATURE_THREADED << 4 |
+           (uint32_t)sizeof(void *) << 8;
+}
@@ -0,0 +1,54 @@
+#ifndef definitioncache_h
+#define definitioncache_h
+
+#include <Arduino.h>
+
+#include "../NodeConnectorConfig.h"
+#include "../FileSystem/FileSystem.h"
+#include "../Utils/Utils.h"
+
+/*
+ * Boot plan of a node definition, keyed by definition hash.
+ *
+ * Written after the first successful init of a definition, it lets the next boots
+ * size the definition arena (incl. storage records allocated after init) without walking the definition options,
+ * and detect a stale or foreign file without parsing it.
+ * Derived structures themselves are not cached: they point into the parsed definition,
+ * which the state machine needs anyway.
+ *
+ * IMPORTANT: file system must be mounted (FileSystem::begin) around load / store
+ */
+
+#define DEFINITION_CACHE_MAGIC 0x4E434332ul // "NCC2", change when record layout or meaning changes
+
+const char DEFINITION_CACHE_PATH[] = "/smd.idx";
+
+typedef struct DefinitionCacheRecord
+{
+    uint32_t magic;
+    uint32_t features; // NC_FEATURE_* the record was built with
+    uint32_t key;      // definition hash and node id
+    uint32_t arenaSize;
+} DefinitionCacheRecord;
+
+class DefinitionCache
+{
+public:
+    DefinitionCache();
+
+    static uint32_t key(uint32_t, const char *);
+    void setNamespace(const char *);
+
+    bool load(FileSystem *, uint32_t);
+    bool store(FileSystem *, uint32_t, size_t);
+    size_t arenaSize(uint32_t);
+
+private:
+    DefinitionCacheRecord _record = {0, 0, 0, 0};
+    char _path[FILE_PATH_SIZE]; // DEFINITION_CACHE_PATH in node namespace
+    bool _valid = false;
+
+    static uint32_t _features();
+};
+
+#endif
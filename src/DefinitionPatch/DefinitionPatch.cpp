@@ -0,0 +1,93 @@
+#include "DefinitionPatch.h"
+
+/**
+ * @param etag at least DEFINITION_ETAG_LENGTH chars
+ */
+void formatEtag(uint32_t hash, char *etag)
+{
+    snprintf(etag, DEFINITION_ETAG_LENGTH, "\"%08lx\"", (unsigned long)hash);
+}
+
+/**
+ * @returns false if etag is not a quoted (optionally weak) hash
+ */
+bool parseEtag(const char *etag, uint32_t *hash)
+{
+    if (!etag)
+        return false;
+
+    if (etag[0] == 'W' && etag[1] == '/')
+        etag += 2;
+
+    if (*etag++ != '"')
+        return false;
+
+    uint32_t value = 0;
+    uint8_t digits = 0;
+    for (; *etag && *etag != '"'; etag++, digits++)
+    {
+        char c = *etag | 0x20; // lower case
+        if (c >= '0' && c <= '9')
+            value = (value << 4) | (c - '0');
+        else if (c >= 'a' && c <= 'f')
+            value = (value << 4) | (c - 'a' + 10);
+        else
+            return false;
+    }
+
+    if (*etag != '"' || !digits || digits > 8)
+        return false;
+
+    *hash = value;
+    return true;
+}
+
+/**
+ * Hash of the whole file, read from the beginning
+ */
+uint32_t hashFile(File *file)
+{
+    uint8_t buffer[PATCH_CHUNK];
+    uint32_t hash = HASH_SEED;
+    size_t count;
+
+    file->seek(0);
+    while ((count = file->read(buffer, PATCH_CHUNK)) > 0)
+        hash = hashBytes(hash, buffer, count);
+
+    return hash;
+}
+
+DefinitionWriter::DefinitionWriter(File *output) : _output(output)
+{
+}
+
+bool DefinitionWriter::_write(const uint8_t *data, size_t length)
+{
+    if (_output->write(data, length) != length)
+        return false;
+
+    hash = hashBytes(hash, data, length);
+    size += length;
+    return true;
+}
+
+/**
+ * Copy a range of the current definition
+ */
+bool DefinitionWriter::_copy(File *base, uint32_t offset, uint32_t length)
+{
+    if (length > base->size() || offset > base->size() - length || !base->seek(offset))
+        return false;
+
+    uint8_t buffer[PATCH_CHUNK];
+    while (length)
+    {
+        size_t chunk = length < PATCH_CHUNK ? length : PATCH_CHUNK;
+        if (base->read(buffer, chunk) != chunk || !_write(buffer, chunk))
+            return false;
+        length -= chunk;
+    }
+
+    return true;
+}
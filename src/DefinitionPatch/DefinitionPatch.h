@@ -0,0 +1,154 @@
+#ifndef definitionpatch_h
+#define definitionpatch_h
+
+#include <Arduino.h>
+
+#include "../FileSystem/FileSystem.h"
+#include "../Utils/Utils.h"
+
+/*
+ * Definition updates as binary patches (RFC 3229 style delta encoding).
+ *
+ * Node sends `If-None-Match: "<hash>"` of its stored definition with `A-IM: x-nc-patch`.
+ * Hub that still knows that version answers `226 IM Used` with a patch, otherwise
+ * the full definition (200). Either way `ETag` carries the hash of the new definition,
+ * which the written file has to match.
+ *
+ * Patch is a sequence of operations, numbers are unsigned LEB128 varints:
+ *
+ *   0x01 <offset> <length>  - copy bytes of the current definition
+ *   0x02 <length> <bytes>   - insert bytes
+ *   0x00                    - end
+ */
+
+#define PATCH_END 0x00
+#define PATCH_COPY 0x01
+#define PATCH_INSERT 0x02
+
+#define PATCH_CHUNK 64            // bytes copied at once (stack)
+#define DEFINITION_ETAG_LENGTH 11 // "\"0123abcd\"" + \0
+
+const char DELTA_PATCH[] = "x-nc-patch";
+
+void formatEtag(uint32_t, char *);
+bool parseEtag(const char *, uint32_t *);
+uint32_t hashFile(File *);
+
+/**
+ * Writes new definition file from a full download or a patch, hashing what is written
+ */
+class DefinitionWriter
+{
+public:
+    DefinitionWriter(File *);
+
+    uint32_t hash = HASH_SEED;
+    size_t size = 0;
+
+    /**
+     * Write definition read from the source
+     * @param base current definition file if source is a patch, nullptr for full content
+     * @param length of full content if known (Content-Length), otherwise it is read
+     *  until the source times out
+     * @returns false on write error, incomplete content or malformed patch
+     */
+    template <typename TReader>
+    bool receive(TReader &source, File *base, int length = -1)
+    {
+        return base ? _patch(source, base) : _full(source, length);
+    }
+
+private:
+    File *_output;
+
+    bool _write(const uint8_t *, size_t);
+    bool _copy(File *, uint32_t, uint32_t);
+
+    template <typename TReader>
+    bool _full(TReader &source, int length)
+    {
+        uint8_t buffer[PATCH_CHUNK];
+        size_t count;
+
+        if (length >= 0)
+        {
+            // stop at the end of the body instead of waiting for the stream to time out
+            for (size_t left = length; left; left -= count)
+            {
+                count = source.readBytes((char *)buffer, left < PATCH_CHUNK ? left : PATCH_CHUNK);
+                if (!count || !_write(buffer, count))
+                    return false;
+            }
+
+            return size > 0;
+        }
+
+        while ((count = source.readBytes((char *)buffer, PATCH_CHUNK)) > 0)
+            if (!_write(buffer, count))
+                return false;
+
+        return size > 0;
+    }
+
+    template <typename TReader>
+    bool _patch(TReader &source, File *base)
+    {
+        uint8_t buffer[PATCH_CHUNK];
+
+        for (;;)
+        {
+            uint8_t op;
+            if (source.readBytes((char *)&op, 1) != 1)
+                return false;
+
+            uint32_t offset = 0;
+            uint32_t length = 0;
+
+            switch (op)
+            {
+            case PATCH_END:
+                return true;
+
+            case PATCH_COPY:
+                if (!_varint(source, &offset) || !_varint(source, &length) || !_copy(base, offset, length))
+                    return false;
+                break;
+
+            case PATCH_INSERT:
+                if (!_varint(source, &length))
+                    return false;
+
+                while (length)
+                {
+                    size_t chunk = length < PATCH_CHUNK ? length : PATCH_CHUNK;
+                    if (source.readBytes((char *)buffer, chunk) != chunk || !_write(buffer, chunk))
+                        return false;
+                    length -= chunk;
+                }
+                break;
+
+            default:
+                return false;
+            }
+        }
+    }
+
+    template <typename TReader>
+    bool _varint(TReader &source, uint32_t *value)
+    {
+        *value = 0;
+        for (uint8_t shift = 0; shift < 32; shift += 7)
+        {
+            uint8_t byte;
+            if (source.readBytes((char *)&byte, 1) != 1)
+                return false;
+
+            *value |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+};
+
+#endif
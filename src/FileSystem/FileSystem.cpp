@@ -80,4 +80,24 @@ File FileSystem::open(const char *path, const char *mode)
 void FileSystem::remove(const char *path)
 {
     SPIFFS.remove(path);
-}
\ No newline at end of file
+}
+
+/**
+ * Rename, replacing the target if it exists
+ */
+bool FileSystem::rename(const char *from, const char *to)
+{
+    if (SPIFFS.exists(to))
+        SPIFFS.remove(to);
+
+    return SPIFFS.rename(from, to);
+}
+
+/**
+ * Path of a file in a namespace, eg. "/pump" + "/smd.mpk"
+ * @param ns path prefix of a virtual node, nullptr or "" for the device itself
+ */
+void filePath(char *path, const char *ns, const char *name)
+{
+    snprintf(path, FILE_PATH_SIZE, "%s%s", ns ? ns : "", name);
+}
@@ -9,6 +9,10 @@
 #endif
 // https://github.com/espressif/arduino-esp32/blob/master/libraries/SPIFFS/src/SPIFFS.cpp
 
+#define FILE_PATH_SIZE 32 // SPIFFS object name length, with \0
+
+void filePath(char *, const char *, const char *);
+
 class FileSystem
 {
 public:
@@ -18,6 +22,7 @@ public:
     size_t totalBytes();
     File open(const char *, const char *);
     void remove(const char *);
+    bool rename(const char *, const char *);
 
 private:
     bool _begin(bool formatOnFail = false);
@@ -1,11 +1,15 @@
 #include <Arduino.h>
 
 #include "../PrintWrapper/PrintWrapper.h"
+#include "../Log/Log.h"
+#include "../MemoryTracker/MemoryTracker.h"
 #include "HubClient.h"
 
-HubClient::HubClient() : _localTimeHandler()
+HubClient::HubClient()
 {
   timeStamp[0] = 0;
+  lastModified[0] = 0;
+  etag[0] = 0;
 }
 
 void HubClient::init(const char *ssid, const char *password, const char *staticIp, const char *gateway, const char *subnet)
@@ -17,6 +21,253 @@ void HubClient::init(const char *ssid, const char *password, const char *staticI
   _subnet = subnet;
 }
 
+/**
+ * Set hub base addresses, comma separated, eg. "http://10.0.0.2:3000,http://10.0.0.3:3000".
+ * Requests go to the healthiest hub, scored by response time and error rate.
+ * IMPORTANT: addresses are not copied, string must outlive the client
+ */
+void HubClient::setHubs(const char *addresses)
+{
+  _hubCount = 0;
+  _current = 0;
+
+  const char *start = addresses;
+  while (start && *start && _hubCount < MAX_HUBS)
+  {
+    while (*start == ' ' || *start == ',')
+      start++;
+
+    const char *end = start;
+    while (*end && *end != ',')
+      end++;
+
+    // trim trailing spaces and slash, paths start with one
+    const char *last = end;
+    while (last > start && (last[-1] == ' ' || last[-1] == '/'))
+      last--;
+
+    if (last > start)
+    {
+      HubEndpoint *hub = &_hubs[_hubCount++];
+      hub->address = start;
+      hub->length = last - start;
+      hub->latency = 0.0f;
+      hub->errorRate = 0.0f;
+      hub->failures = 0;
+      hub->measured = false;
+      hub->compression = false;
+    }
+
+    start = end;
+  }
+}
+
+/**
+ * Check one of the standby or failed hubs, so its score stays up to date.
+ * Runs at most once per HUB_PROBE_PERIOD and blocks for up to HUB_PROBE_TIMEOUT,
+ * so it is called from the network task only (NC_FEATURE_THREADED).
+ * Without the task low priority posts probe instead, see `postMsgPack`.
+ */
+void HubClient::probe()
+{
+  if (!_isProbeDue())
+    return;
+
+  // don't wake up WiFi just for a probe
+  if (WiFi.status() != WL_CONNECTED)
+    return;
+
+  uint8_t hub = _nextStandby();
+
+  char url[MAX_HUB_URL_SIZE];
+  _url(hub, "/", url);
+
+  unsigned long start = millis();
+
+  _setTimeout(HUB_PROBE_TIMEOUT);
+  _http.begin(_client, url);
+  int httpCode = _http.GET();
+  _http.end();
+  _setTimeout(HTTPCLIENT_DEFAULT_TCP_TIMEOUT);
+
+  _record(hub, httpCode, start);
+}
+
+/**
+ * Post to a standby or failed hub instead of a probe, limited by HUB_PROBE_TIMEOUT
+ * @returns HTTP status, 0 if no probe was due
+ */
+int HubClient::_probePost(const char *path, const uint8_t *payload, size_t size)
+{
+  if (!_isProbeDue())
+    return 0;
+
+  uint8_t hub = _nextStandby();
+
+  char url[MAX_HUB_URL_SIZE];
+  _url(hub, path, url);
+
+  unsigned long start = millis();
+
+  // plain, every hub takes it
+  _setTimeout(HUB_PROBE_TIMEOUT);
+  int httpCode = _post(url, payload, size, nullptr);
+  _setTimeout(HTTPCLIENT_DEFAULT_TCP_TIMEOUT);
+
+  _record(hub, httpCode, start);
+  NC_LOG_DEBUG(F("Probed hub"), nullptr, httpCode);
+
+  return httpCode;
+}
+
+/**
+ * At most once per HUB_PROBE_PERIOD, only if there is another hub
+ */
+bool HubClient::_isProbeDue()
+{
+  if (_hubCount < 2 || diff(_lastProbe, millis()) < HUB_PROBE_PERIOD)
+    return false;
+
+  _lastProbe = millis();
+  return true;
+}
+
+/**
+ * Round robin over hubs not in use
+ */
+uint8_t HubClient::_nextStandby()
+{
+  _nextProbe = (_nextProbe + 1) % _hubCount;
+  if (_nextProbe == _current)
+    _nextProbe = (_nextProbe + 1) % _hubCount;
+
+  return _nextProbe;
+}
+
+void HubClient::_setTimeout(uint16_t timeout)
+{
+  _http.setTimeout(timeout);
+  // ESP32 HTTPClient does not limit TCP connect by `setTimeout`
+#ifdef ESP32
+  _http.setConnectTimeout(timeout);
+#endif
+}
+
+/**
+ * Pick hub for the next request.
+ * Current hub is kept unless it is down or another one scores clearly better.
+ * @param exclude hub which just failed (MAX_HUBS - none)
+ */
+uint8_t HubClient::_selectHub(uint8_t exclude)
+{
+  uint8_t best = MAX_HUBS;
+  float bestScore = 0.0f;
+
+  if (_current != exclude)
+  {
+    best = _current;
+    bestScore = _score(_current) * HUB_SWITCH_RATIO;
+  }
+
+  for (uint8_t i = 0; i < _hubCount; i++)
+  {
+    if (i == exclude || i == _current)
+      continue;
+
+    float score = _score(i);
+    if (best == MAX_HUBS || score < bestScore)
+    {
+      best = i;
+      bestScore = score;
+    }
+  }
+
+  if (best == MAX_HUBS)
+    return _current;
+
+  if (exclude == MAX_HUBS && best != _current)
+  {
+    NC_LOG_WARN(F("Switching hub"), nullptr, (int)best);
+    _current = best;
+  }
+
+  return best;
+}
+
+/**
+ * Lower is better, roughly expected response time in ms
+ */
+float HubClient::_score(uint8_t index)
+{
+  HubEndpoint *hub = &_hubs[index];
+
+  float score = hub->measured ? hub->latency : HUB_ERROR_PENALTY;
+  score += hub->errorRate * HUB_ERROR_PENALTY;
+  if (hub->failures >= HUB_FAIL_LIMIT)
+    score += HUB_DOWN_PENALTY;
+
+  return score;
+}
+
+/**
+ * Update hub health by request result
+ * @returns true if hub has responded (server errors and transport failures count as no response)
+ */
+bool HubClient::_record(uint8_t index, int httpCode, unsigned long start)
+{
+  HubEndpoint *hub = &_hubs[index];
+  bool responded = httpCode > 0 && httpCode < 500;
+
+  // exponential moving averages, 1/4 weight of the new sample
+  hub->errorRate = hub->errorRate * 0.75f + (responded ? 0.0f : 0.25f);
+
+  if (responded)
+  {
+    float latency = (float)diff(start, millis());
+    hub->latency = hub->measured ? hub->latency * 0.75f + latency * 0.25f : latency;
+    hub->measured = true;
+    hub->failures = 0;
+  }
+  else if (hub->failures < 255)
+  {
+    hub->failures++;
+    if (hub->failures == HUB_FAIL_LIMIT)
+      NC_LOG_WARN(F("Hub down"), nullptr, (int)index);
+  }
+
+  return responded;
+}
+
+void HubClient::_url(uint8_t index, const char *path, char *url)
+{
+  HubEndpoint *hub = &_hubs[index];
+  size_t length = hub->length < MAX_HUB_URL_SIZE - 1 ? hub->length : MAX_HUB_URL_SIZE - 1;
+
+  memcpy(url, hub->address, length);
+  url[length] = '\0';
+  strncat(url, path, MAX_HUB_URL_SIZE - 1 - length);
+}
+
+/**
+ * Start joining the access point without waiting for it (single network, no scan).
+ * From now on requests never block on WiFi: while station is not connected they fail at once.
+ */
+void HubClient::onAsync()
+{
+  _async = true;
+  _connected = false;
+  strcpy(ip, "-");
+
+  _station();
+  WiFi.setAutoReconnect(true);
+  WiFi.begin(_ssid, _password);
+}
+
+bool HubClient::isAsync()
+{
+  return _async;
+}
+
 void HubClient::off()
 {
   WiFi.mode(WIFI_OFF);
@@ -28,6 +279,13 @@ void HubClient::on()
 {
   // WiFi.forceSleepWake();
   // delay(1);
+  _station();
+  _wifiMulti.addAP(_ssid, _password);
+  // WiFi.begin(_ssid, _password);
+}
+
+void HubClient::_station()
+{
   WiFi.persistent(false);
   WiFi.mode(WIFI_STA);
   if (strlen(_staticIp))
@@ -41,12 +299,22 @@ void HubClient::on()
       WiFi.config(staticIP, gateway, subnet);
     }
   }
-  _wifiMulti.addAP(_ssid, _password);
-  // WiFi.begin(_ssid, _password);
 }
 
 bool HubClient::isConnected()
 {
+  if (_async)
+  {
+    bool connected = WiFi.status() == WL_CONNECTED;
+    if (connected && !_connected)
+      WiFi.localIP().toString().toCharArray(ip, 16);
+    else if (!connected && _connected)
+      NC_PERF_ADD(reconnects, 1);
+
+    _connected = connected;
+    return connected;
+  }
+
   // return WiFi.status() == WL_CONNECTED;
   return _wifiMulti.run(MAX_CONNECT_TIMEOUT) == WL_CONNECTED;
 }
@@ -132,7 +400,12 @@ bool HubClient::ensureConnection()
   if (isConnected())
     return true;
 
+  // station reconnects by itself, requests fail fast until it does
+  if (_async)
+    return false;
+
   Serial << F("Reconnecting Wifi\n");
+  NC_PERF_ADD(reconnects, 1);
   off();
   on();
   if (connect())
@@ -142,53 +415,181 @@ bool HubClient::ensureConnection()
   return false;
 }
 
-void HubClient::postMsgPack(const char *url, const uint8_t *payload, size_t size)
+/**
+ * Post to the healthiest hub, fail over to the next one if hub does not respond
+ * @param path url path on the hub
+ * @param probe payload that can wait, once per HUB_PROBE_PERIOD it goes to a standby or failed hub
+ *   first, so a recovered one can take over again without the network task
+ * @returns HTTP status, negative HTTPClient error or 0 if there is no connection
+ */
+int HubClient::postMsgPack(const char *path, const uint8_t *payload, size_t size, bool probe)
 {
-  if (!ensureConnection())
-    return;
+  if (!ensureConnection() || !_hubCount)
+    return 0;
+
+  if (probe)
+  {
+    int probed = _probePost(path, payload, size);
+    if (probed >= 200 && probed < 300)
+      return probed;
+  }
+
+  char url[MAX_HUB_URL_SIZE];
+  int httpCode = 0;
+  uint8_t hub = _selectHub(MAX_HUBS);
+
+#if NC_FEATURE_COMPRESSION
+  // compressed on the first try that goes to a hub known to take it
+  uint8_t *packed = nullptr;
+  size_t packedSize = 0;
+  bool compress = size >= NC_COMPRESS_MIN_SIZE;
+#endif
+
+  for (uint8_t attempt = 0; attempt < _hubCount && attempt < 2; attempt++)
+  {
+    if (attempt)
+      hub = _selectHub(hub);
+
+    _url(hub, path, url);
+
+    NC_LOG_DEBUG(F("Posting data to"), path);
+
+    NC_PERF_START(postStart);
+    unsigned long start = millis();
+
+#if NC_FEATURE_COMPRESSION
+    if (compress && _hubs[hub].compression && !packed)
+    {
+      packed = (uint8_t *)malloc(size);
+      packedSize = packed ? lzssCompress(payload, size, packed, size) : 0;
+      __nc_mem.transient(size);
+      compress = packedSize > 0;
+    }
 
-  // dont use F() to reduce latency
-  Serial << "Posting data to: " << url << "\n";
+    if (compress && _hubs[hub].compression)
+    {
+      httpCode = _post(url, packed, packedSize, CONTENT_ENCODING_LZSS);
+
+      // 415 Unsupported Media Type, hub does not take compressed posts after all
+      if (httpCode == 415)
+      {
+        _hubs[hub].compression = false;
+        httpCode = _post(url, payload, size, nullptr);
+      }
+    }
+    else
+#endif
+      httpCode = _post(url, payload, size, nullptr);
+
+    NC_PERF_CALL(postDone(postStart, httpCode));
+
+    if (_record(hub, httpCode, start))
+      break;
+  }
+
+#if NC_FEATURE_COMPRESSION
+  free(packed);
+#endif
+
+  if (httpCode != 201)
+    NC_LOG_WARN(F("Failed posting"), path, httpCode);
+
+  return httpCode;
+}
 
+int HubClient::_post(const char *url, const uint8_t *payload, size_t size, const char *encoding)
+{
   _http.begin(_client, url);
   _http.addHeader(HEADER_CONTENT_TYPE, CONTENT_TYPE_MSG_PACK);
-  int httpCode = _http.POST((uint8_t *)payload, size);
-  if (httpCode != 201)
-    Serial << F("Failed posting:") << httpCode << "\n";
+  if (encoding)
+    _http.addHeader(HEADER_CONTENT_ENCODING, encoding);
 
+  int httpCode = _http.POST((uint8_t *)payload, size);
   _http.end();
+
+  return httpCode;
 }
 
-WiFiClient *HubClient::openMsgPackStream(const char *url, const char *ifModifiedSince)
+/**
+ * Open response stream from the healthiest hub, fail over to the next one if hub does not respond
+ * @param path url path on the hub
+ * @param ifNoneMatch entity tag of the version held by the node
+ * @param deltas accepted delta encodings (A-IM), response may then be a delta against that version
+ */
+WiFiClient *HubClient::openMsgPackStream(const char *path, const char *ifModifiedSince, const char *ifNoneMatch, const char *deltas)
 {
-  if (!ensureConnection())
+  if (!ensureConnection() || !_hubCount)
     return nullptr;
 
-  _http.useHTTP10(true); // see https://arduinojson.org/v6/how-to/use-arduinojson-with-esp8266httpclient/
-  _http.begin(_client, url);
-  _http.addHeader(HEADER_ACCEPT, CONTENT_TYPE_MSG_PACK);
-  if (ifModifiedSince && ifModifiedSince[0])
-    _http.addHeader(HEADER_IF_MODIFIED_SINCE, ifModifiedSince);
+  char url[MAX_HUB_URL_SIZE];
+  int httpCode = 0;
+  unsigned long rtt = 0;
+  uint8_t hub = _selectHub(MAX_HUBS);
 
-  const char *responseHeaders[] = {"Date", "Last-Modified"};
-  _http.collectHeaders(responseHeaders, sizeof(responseHeaders) / sizeof(char *));
+  for (uint8_t attempt = 0; attempt < _hubCount && attempt < 2; attempt++)
+  {
+    if (attempt)
+    {
+      _http.end();
+      hub = _selectHub(hub);
+    }
 
-  int httpCode = _http.GET();
+    _url(hub, path, url);
 
-  String dateHeader = _http.header("Date");
-  _localTimeHandler.update(dateHeader);
-  dateHeader.toCharArray(timeStamp, HTTP_TIME_STAMP_LENGTH);
+    NC_PERF_START(fetchStart);
+    unsigned long start = millis();
 
-  if (httpCode == 200)
+    _http.useHTTP10(true); // see https://arduinojson.org/v6/how-to/use-arduinojson-with-esp8266httpclient/
+    _http.begin(_client, url);
+    _http.addHeader(HEADER_ACCEPT, CONTENT_TYPE_MSG_PACK);
+    if (ifModifiedSince && ifModifiedSince[0])
+      _http.addHeader(HEADER_IF_MODIFIED_SINCE, ifModifiedSince);
+    if (ifNoneMatch && ifNoneMatch[0])
+    {
+      _http.addHeader(HEADER_IF_NONE_MATCH, ifNoneMatch);
+      if (deltas)
+        _http.addHeader(HEADER_A_IM, deltas);
+    }
+#if NC_FEATURE_COMPRESSION
+    _http.addHeader(HEADER_ACCEPT_ENCODING, CONTENT_ENCODING_LZSS);
+#endif
+
+    const char *responseHeaders[] = {"Date", "Last-Modified", "Content-Encoding", "ETag"};
+    _http.collectHeaders(responseHeaders, sizeof(responseHeaders) / sizeof(char *));
+
+    httpCode = _http.GET();
+    rtt = diff(start, millis());
+
+    NC_PERF_CALL(fetchDone(fetchStart, httpCode));
+
+    if (_record(hub, httpCode, start))
+      break;
+  }
+
+  _http.header("Date").toCharArray(timeStamp, HTTP_TIME_STAMP_LENGTH);
+#if NC_FEATURE_TIME_FUNCTIONS
+  __nc_time.update(timeStamp, rtt);
+#endif
+
+  _http.header("Last-Modified").toCharArray(lastModified, HTTP_TIME_STAMP_LENGTH);
+  _http.header("ETag").toCharArray(etag, HTTP_ETAG_SIZE);
+  _compressed = false;
+  _delta = httpCode == HTTP_IM_USED;
+
+  if (httpCode == 200 || _delta)
   {
+#if NC_FEATURE_COMPRESSION
+    _compressed = _http.header("Content-Encoding") == CONTENT_ENCODING_LZSS;
+    if (_compressed)
+      _hubs[hub].compression = true;
+#endif
 
     return _http.getStreamPtr();
   }
   else if (httpCode == 304)
   {
     // 304 (NOT MODIFIED) as a response to Last-Modified header
-    // do not use F() to reduce latency
-    Serial << "Definition up to date\n";
+    NC_LOG_DEBUG(F("Not modified"), path);
     return nullptr;
   }
   else
@@ -202,3 +603,27 @@ void HubClient::closeMsgPackStream()
 {
   _http.end();
 }
+
+/**
+ * @returns true if the stream opened last is LZSS compressed, read it through LzssReader
+ */
+bool HubClient::isCompressed()
+{
+  return _compressed;
+}
+
+/**
+ * @returns true if the stream opened last is a delta (226 IM Used) against the version sent in If-None-Match
+ */
+bool HubClient::isDelta()
+{
+  return _delta;
+}
+
+/**
+ * @returns Content-Length of the stream opened last, -1 if hub did not send it
+ */
+int HubClient::contentLength()
+{
+  return _http.getSize();
+}
@@ -13,35 +13,74 @@
 #include <HTTPClient.h>
 #endif
 
+#include "../NodeConnectorConfig.h"
 #include "../LocalTimeHandler/LocalTimeHandler.h"
+#include "../PerfCounters/PerfCounters.h"
+#if NC_FEATURE_COMPRESSION
+#include "../Lzss/Lzss.h"
+#endif
 
 #define MAX_CONNECT_RETRY 5
 #define MAX_CONNECT_TIMEOUT 5000
 #define HTTP_TIME_STAMP_LENGTH 30
 // ex. "Wed, 21 Oct 2015 07:28:00 GMT" + /0
+#define HTTP_ETAG_SIZE 16
+#define HTTP_IM_USED 226 // delta encoded response, see https://www.rfc-editor.org/rfc/rfc3229
+
+// Hub failover (see HubClient.cpp)
+#define MAX_HUBS 3
+#define MAX_HUB_URL_SIZE 256
+#define HUB_FAIL_LIMIT 2                     // consecutive failures until hub is considered down
+#define HUB_ERROR_PENALTY MAX_CONNECT_TIMEOUT // score (ms) added for 100% error rate, also score of unmeasured hub
+#define HUB_DOWN_PENALTY 1000000
+#define HUB_SWITCH_RATIO 0.75f // other hub must score this much better to take over
+#define HUB_PROBE_PERIOD 30000
+#define HUB_PROBE_TIMEOUT 2000
 
 const char HEADER_CONTENT_TYPE[] = "content-type";
 const char HEADER_ACCEPT[] = "accept";
 const char HEADER_IF_MODIFIED_SINCE[] = "if-modified-since";
+const char HEADER_ACCEPT_ENCODING[] = "accept-encoding";
+const char HEADER_CONTENT_ENCODING[] = "content-encoding";
+const char HEADER_IF_NONE_MATCH[] = "if-none-match";
+const char HEADER_A_IM[] = "a-im";
 
 const char CONTENT_TYPE_MSG_PACK[] = "application/msgpack";
 
+typedef struct HubEndpoint
+{
+  const char *address; // not terminated, points into hub address list
+  uint8_t length;
+  float latency;   // ms, moving average
+  float errorRate; // 0..1, moving average
+  uint8_t failures;
+  bool measured;
+  bool compression; // hub answered with compressed content, so it takes compressed posts
+} HubEndpoint;
+
 class HubClient
 {
 public:
   HubClient();
   void init(const char *, const char *, const char *, const char *, const char *);
+  void setHubs(const char *);
+  void probe();
   bool connect();
   void off();
   void on();
+  void onAsync();
+  bool isAsync();
   bool isConnected();
   bool ensureConnection();
   void listNetworks();
 
-  WiFiClient *openMsgPackStream(const char *, const char *);
+  WiFiClient *openMsgPackStream(const char *, const char *, const char * = nullptr, const char * = nullptr);
   void closeMsgPackStream();
+  bool isCompressed();
+  bool isDelta();
+  int contentLength();
 
-  void postMsgPack(const char *, const uint8_t *, size_t);
+  int postMsgPack(const char *, const uint8_t *, size_t, bool probe = false);
 
   char ip[16];
 
@@ -51,6 +90,12 @@ public:
   // <day-name>, <day> <month> <year> <hour>:<minute>:<second> GMT
   char timeStamp[HTTP_TIME_STAMP_LENGTH];
 
+  // Last-Modified of the resource, same format as `timeStamp`, empty if hub did not send it
+  char lastModified[HTTP_TIME_STAMP_LENGTH];
+
+  // see https://developer.mozilla.org/en-US/docs/Web/HTTP/Headers/ETag
+  char etag[HTTP_ETAG_SIZE];
+
 private:
   const char *_ssid;
   const char *_password;
@@ -58,6 +103,27 @@ private:
   const char *_gateway;
   const char *_subnet;
 
+  HubEndpoint _hubs[MAX_HUBS];
+  uint8_t _hubCount = 0;
+  uint8_t _current = 0;
+  uint8_t _nextProbe = 0;
+  unsigned long _lastProbe = 0;
+  bool _compressed = false;
+  bool _delta = false;
+  bool _async = false;     // WiFi joins and reconnects in the background, nothing waits for it
+  bool _connected = false; // last seen async state
+
+  void _station();
+  uint8_t _selectHub(uint8_t);
+  bool _isProbeDue();
+  uint8_t _nextStandby();
+  int _probePost(const char *, const uint8_t *, size_t);
+  void _setTimeout(uint16_t);
+  float _score(uint8_t);
+  bool _record(uint8_t, int, unsigned long);
+  void _url(uint8_t, const char *, char *);
+  int _post(const char *, const uint8_t *, size_t, const char *);
+
   // see https://github.com/esp8266/Arduino/blob/master/libraries/ESP8266HTTPClient/src/ESP8266HTTPClient.cpp
   HTTPClient _http;
   WiFiClient _client;
@@ -66,8 +132,6 @@ private:
 #else
   WiFiMulti _wifiMulti;
 #endif
-
-  LocalTimeHandler _localTimeHandler;
 };
 
 #endif
@@ -1,49 +1,174 @@
-#include <TimeLib.h>
-
-#include "../PrintWrapper/PrintWrapper.h"
+#include "../Log/Log.h"
+#include "../Utils/Utils.h"
 #include "LocalTimeHandler.h"
 
+#if NC_FEATURE_TIME_FUNCTIONS
+
+LocalTimeHandler __nc_time;
+
+static time_t _nc_timeProvider()
+{
+    return __nc_time.now();
+}
+
 /**
  * Handles local system time by interpreting Date header form the HTTP requests.
  * Time is in GMT (0 offset). Please adjust to your device time zone,
  * if providing for the user.
+ * @param timeStamp Date header, eg. "Wed, 21 Oct 2015 07:28:00 GMT"
+ * @param rtt request round trip time, ms
  */
-
-void LocalTimeHandler::update(String timeStamp)
+void LocalTimeHandler::update(const char *timeStamp, unsigned long rtt)
 {
-    // Time format: "Wed, 21 Oct 2015 07:28:00 GMT"
-    //               01234567890123456789012345678
+    time_t date;
+    if (!parseHttpDate(timeStamp, &date))
+        return;
 
-    // All time related types and functions are from TimeLib.h
-    // https://github.com/PaulStoffregen/Time
+    _calendarValid = false;
 
-    tmElements_t tm;
+    // Date is truncated to seconds and was stamped about half of round trip ago
+    unsigned long long target = (unsigned long long)date * 1000ull + 500ull + rtt / 2;
 
-    tm.Day = (uint8_t)timeStamp.substring(5, 7).toInt();
-    tm.Month = _translateMonth(timeStamp.substring(8, 11));
-    tm.Year = (uint8_t)timeStamp.substring(12, 16).toInt();
-    tm.Hour = (uint8_t)timeStamp.substring(17, 19).toInt();
-    tm.Minute = (uint8_t)timeStamp.substring(20, 22).toInt();
-    tm.Second = (uint8_t)timeStamp.substring(23, 25).toInt();
+    if (!_initialized)
+    {
+        _anchor = target;
+        _anchorMillis = millis();
+        _correction = 0;
+        _initialized = true;
+
+        // TimeLib `now()` is resynced from this clock every 5 minutes
+        setSyncProvider(_nc_timeProvider);
+
+        NC_LOG_INFO(F("Local system time set"), nullptr, (long)date);
+        return;
+    }
+
+    // start new slew from the current (partially corrected) time
+    unsigned long long current = nowMs();
+    _anchor = current;
+    _anchorMillis = millis();
 
-    time_t time = makeTime(tm);
+    long long offset = (long long)target - (long long)current;
 
-    if (_timeDiff(now(), time) >= MIN_DIFFERENCE || !_initialized)
+    if (offset > TIME_STEP_LIMIT || offset < -TIME_STEP_LIMIT)
     {
-        Serial << F("Local system time updated to: ") << timeStamp.substring(5, 25) << "\n";
-        setTime(time);
-        _initialized = true;
+        _anchor = target;
+        _correction = 0;
+        setTime(now());
+        NC_LOG_WARN(F("Local system time stepped, s"), nullptr, (long)(offset / 1000));
     }
+    else if (offset >= TIME_DEADBAND || offset <= -TIME_DEADBAND)
+    {
+        _correction = (long)offset;
+        NC_LOG_DEBUG(F("Local system time slewing, ms"), nullptr, _correction);
+    }
+    else
+    {
+        _correction = 0;
+    }
+}
+
+bool LocalTimeHandler::isSet()
+{
+    return _initialized;
+}
+
+time_t LocalTimeHandler::now()
+{
+    return (time_t)(nowMs() / 1000ull);
+}
+
+/**
+ * Calendar snapshot of the current cycle
+ * @returns nullptr if it has to be computed, see `calendar(float)`
+ */
+const LocalCalendar *LocalTimeHandler::calendar()
+{
+    return _calendarValid ? &_calendar : nullptr;
+}
+
+/**
+ * Compute calendar snapshot for the current time
+ * @param tz time zone offset, hours
+ */
+const LocalCalendar *LocalTimeHandler::calendar(float tz)
+{
+    // days before each month in a non leap year
+    static const uint16_t monthStart[] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+
+    time_t local = now() + (time_t)(round((tz * 3600.0f)));
+
+    tmElements_t tm;
+    breakTime(local, tm);
+
+    _calendar.time = local;
+    _calendar.secondsSinceMidnight = (long)(local % SECS_PER_DAY);
+    _calendar.year = tmYearToCalendar(tm.Year);
+    _calendar.month = tm.Month;
+    _calendar.day = tm.Day;
+    _calendar.weekDay = tm.Wday;
+    _calendar.hour = tm.Hour;
+    _calendar.minute = tm.Minute;
+    _calendar.second = tm.Second;
+
+    uint16_t year = _calendar.year;
+    bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    _calendar.dayOfYear = monthStart[tm.Month - 1] + tm.Day + (leap && tm.Month > 2 ? 1 : 0);
+
+    _calendarValid = true;
+    return &_calendar;
 }
 
-time_t LocalTimeHandler::_timeDiff(time_t a, time_t b)
+/**
+ * Drop calendar snapshot, called before each state machine cycle and on time zone change
+ */
+void LocalTimeHandler::invalidateCalendar()
 {
-    return a > b ? a - b : b - a;
+    _calendarValid = false;
 }
 
-uint8_t LocalTimeHandler::_translateMonth(String monthStr)
+/**
+ * Current unix time in milliseconds, 0 until synced with the hub
+ */
+unsigned long long LocalTimeHandler::nowMs()
 {
-    String months = "janfebmaraprmayjunjulaugsepoctnovdec";
-    monthStr.toLowerCase();
-    return (uint8_t)(months.indexOf(monthStr) / 3 + 1);
-}
\ No newline at end of file
+    if (!_initialized)
+        return 0;
+
+    _fold();
+
+    unsigned long elapsed = millis() - _anchorMillis;
+    return _anchor + elapsed + _slewed(elapsed);
+}
+
+/**
+ * Move anchor to the current moment, applied part of the correction goes into the anchor
+ */
+void LocalTimeHandler::_fold()
+{
+    unsigned long ms = millis();
+    unsigned long elapsed = ms - _anchorMillis;
+    if (elapsed < TIME_FOLD_PERIOD)
+        return;
+
+    long slewed = _slewed(elapsed);
+    _anchor += elapsed + slewed;
+    _correction -= slewed;
+    _anchorMillis = ms;
+}
+
+/**
+ * Part of the correction applied after `elapsed` ms.
+ * Clock runs at most TIME_SLEW_RATE / 1000 faster or slower, so it stays monotonic.
+ */
+long LocalTimeHandler::_slewed(unsigned long elapsed)
+{
+    unsigned long limit = elapsed / 1000 * TIME_SLEW_RATE + elapsed % 1000 * TIME_SLEW_RATE / 1000;
+
+    if (_correction >= 0)
+        return (unsigned long)_correction < limit ? _correction : (long)limit;
+
+    return (unsigned long)(-_correction) < limit ? _correction : -(long)limit;
+}
+
+#endif
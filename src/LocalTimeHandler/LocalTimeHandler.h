@@ -2,22 +2,69 @@
 #define localtimehandler_h
 
 #include <Arduino.h>
+#include <TimeLib.h>
 
-// lets update time only if it differs by 2 or more seconds
-#define MIN_DIFFERENCE 2
+#include "../NodeConnectorConfig.h"
 
+// Date header has 1 s resolution, smaller offsets are measurement noise
+#define TIME_DEADBAND 1000
+// larger offsets (first sync, hub clock changed) are stepped instead of slewed, ms
+#define TIME_STEP_LIMIT 60000
+// slew speed, ms corrected per second of running time (5%)
+#define TIME_SLEW_RATE 50
+// anchor is moved forward at least this often, so millis() wrap is never crossed, ms
+#define TIME_FOLD_PERIOD 3600000ul
+
+/*
+ * Calendar fields of the local time, computed once per state machine cycle
+ */
+typedef struct LocalCalendar
+{
+    time_t time; // local unix time
+    long secondsSinceMidnight;
+    uint16_t year;
+    uint16_t dayOfYear; // 1..366
+    uint8_t month;      // 1..12
+    uint8_t day;        // 1..31
+    uint8_t weekDay;    // 1..7, Sunday is 1
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+} LocalCalendar;
+
+/*
+ * Hub synced wall clock (UTC).
+ *
+ * Kept as unix milliseconds anchored to millis(). Offsets reported by the hub
+ * are corrected gradually (slewed), so the clock never jumps and never runs backwards
+ * under the state machine. TimeLib `now()` follows this clock through its sync provider.
+ */
 class LocalTimeHandler
 {
 public:
-    void update(String);
+    void update(const char *, unsigned long);
+
+    bool isSet();
+    time_t now();
+    unsigned long long nowMs();
+
+    const LocalCalendar *calendar();
+    const LocalCalendar *calendar(float);
+    void invalidateCalendar();
 
 private:
     bool _initialized = false;
-    unsigned long _lastSyncTime;
+    unsigned long long _anchor = 0; // unix ms at `_anchorMillis`, including correction applied so far
+    unsigned long _anchorMillis = 0;
+    long _correction = 0; // ms still to be slewed
 
-    uint8_t _translateMonth(String);
+    LocalCalendar _calendar;
+    bool _calendarValid = false;
 
-    time_t _timeDiff(time_t, time_t);
+    void _fold();
+    long _slewed(unsigned long);
 };
 
+extern LocalTimeHandler __nc_time;
+
 #endif
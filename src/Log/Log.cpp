@@ -0,0 +1,140 @@
+#include "../PrintWrapper/PrintWrapper.h"
+#include "Log.h"
+
+#define LOG_RING_MASK (NC_LOG_RING_SIZE - 1)
+
+LogRing __nc_log;
+
+void LogRing::push(uint8_t level, const __FlashStringHelper *message, const char *subject)
+{
+    if (_reserve(level, message, subject))
+        _commit();
+}
+
+void LogRing::push(uint8_t level, const __FlashStringHelper *message, const char *subject, long value)
+{
+    LogRecord *record = _reserve(level, message, subject);
+    if (!record)
+        return;
+
+    record->valueType = LOG_VALUE_INT;
+    record->vInt = value;
+    _commit();
+}
+
+void LogRing::push(uint8_t level, const __FlashStringHelper *message, const char *subject, int value)
+{
+    push(level, message, subject, (long)value);
+}
+
+void LogRing::push(uint8_t level, const __FlashStringHelper *message, const char *subject, unsigned long value)
+{
+    push(level, message, subject, (long)value);
+}
+
+void LogRing::push(uint8_t level, const __FlashStringHelper *message, const char *subject, float value)
+{
+    LogRecord *record = _reserve(level, message, subject);
+    if (!record)
+        return;
+
+    record->valueType = LOG_VALUE_FLOAT;
+    record->vFloat = value;
+    _commit();
+}
+
+/**
+ * Print up to `limit` oldest records and release them
+ * Intended to be called when connector has nothing else to do
+ */
+uint16_t LogRing::drain(Print &out, uint16_t limit)
+{
+    uint16_t count = 0;
+
+    uint16_t tail = _tail.load(std::memory_order_relaxed);
+
+    // records up to head are fully written (published with release in `_commit`)
+    while (count < limit && tail != _head.load(std::memory_order_acquire))
+    {
+        _print(out, &_records[tail & LOG_RING_MASK]);
+        tail++;
+        _tail.store(tail, std::memory_order_release);
+        count++;
+    }
+
+    if (dropped && tail == _head.load(std::memory_order_acquire))
+    {
+        out << F("Log records dropped: ") << dropped << "\n";
+        dropped = 0;
+    }
+
+    return count;
+}
+
+/**
+ * Print all pending records
+ */
+uint16_t LogRing::dump(Print &out)
+{
+    return drain(out, NC_LOG_RING_SIZE);
+}
+
+uint16_t LogRing::size()
+{
+    return (uint16_t)(_head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire));
+}
+
+LogRecord *LogRing::_reserve(uint8_t level, const __FlashStringHelper *message, const char *subject)
+{
+#if NC_FEATURE_THREADED
+    _lock.lock();
+#endif
+
+    // ring is full, newest records are dropped to keep producer wait-free
+    uint16_t head = _head.load(std::memory_order_relaxed);
+    if ((uint16_t)(head - _tail.load(std::memory_order_acquire)) >= NC_LOG_RING_SIZE)
+    {
+        dropped++;
+#if NC_FEATURE_THREADED
+        _lock.unlock();
+#endif
+        return nullptr;
+    }
+
+    LogRecord *record = &_records[head & LOG_RING_MASK];
+    record->time = millis();
+    record->level = level;
+    record->message = message;
+    record->subject[0] = '\0';
+    if (subject)
+        strncat(record->subject, subject, NC_LOG_SUBJECT_SIZE - 1);
+    record->valueType = LOG_VALUE_NONE;
+    return record;
+}
+
+void LogRing::_commit()
+{
+    // publish record only after it is fully written
+    _head.store((uint16_t)(_head.load(std::memory_order_relaxed) + 1), std::memory_order_release);
+
+#if NC_FEATURE_THREADED
+    _lock.unlock();
+#endif
+}
+
+void LogRing::_print(Print &out, LogRecord *record)
+{
+    static const char levels[] = "-EWID";
+
+    out << "[" << record->time << "] " << levels[record->level] << " " << record->message;
+
+    if (record->subject[0])
+        out << " " << record->subject;
+
+    if (record->valueType == LOG_VALUE_INT)
+        out << (record->subject[0] ? "=" : " ") << record->vInt;
+    else if (record->valueType == LOG_VALUE_FLOAT)
+        out << (record->subject[0] ? "=" : " ") << record->vFloat;
+
+    out << "\n";
+}
@@ -0,0 +1,108 @@
+#ifndef nclog_h
+#define nclog_h
+
+#include <atomic>
+#include <Arduino.h>
+
+#include "../NodeConnectorConfig.h"
+#include "../SpinLock/SpinLock.h"
+
+/*
+ * Deferred logging.
+ *
+ * Log calls do not print anything. They only store compact binary record
+ * (time, level, message pointer, optional subject and value) into a ring buffer.
+ * Records are formatted and printed later, when connector is idle (see `LogRing::drain`).
+ *
+ * Calls above NC_LOG_LEVEL are compiled out completely.
+ *
+ * Usage:
+ *   NC_LOG_DEBUG(F("Emitting"));
+ *   NC_LOG_INFO(F("Posting data to"), url);
+ *   NC_LOG_WARN(F("Failed posting"), nullptr, httpCode);
+ *   NC_LOG_DEBUG(F("Emit"), name, value);
+ *
+ * Subject is copied into the record (up to NC_LOG_SUBJECT_SIZE - 1 characters),
+ * so stack buffers are fine. Message must be a flash string, only its pointer is stored.
+ */
+
+#define LOG_VALUE_NONE 0
+#define LOG_VALUE_INT 1
+#define LOG_VALUE_FLOAT 2
+
+typedef struct LogRecord
+{
+    unsigned long time;
+    const __FlashStringHelper *message;
+    char subject[NC_LOG_SUBJECT_SIZE]; // empty if none
+    union
+    {
+        long vInt;
+        float vFloat;
+    };
+    uint8_t level;
+    uint8_t valueType;
+} LogRecord;
+
+static_assert(NC_LOG_RING_SIZE && !(NC_LOG_RING_SIZE & (NC_LOG_RING_SIZE - 1)) && NC_LOG_RING_SIZE <= 32768,
+              "NC_LOG_RING_SIZE must be a power of 2");
+
+class LogRing
+{
+public:
+    void push(uint8_t, const __FlashStringHelper *, const char *subject = nullptr);
+    void push(uint8_t, const __FlashStringHelper *, const char *, long);
+    void push(uint8_t, const __FlashStringHelper *, const char *, int);
+    void push(uint8_t, const __FlashStringHelper *, const char *, unsigned long);
+    void push(uint8_t, const __FlashStringHelper *, const char *, float);
+
+    uint16_t drain(Print &, uint16_t limit = NC_LOG_RING_SIZE);
+    uint16_t dump(Print &);
+
+    uint16_t size();
+    unsigned long dropped = 0;
+
+private:
+    LogRecord _records[NC_LOG_RING_SIZE];
+
+    // producers write head, single consumer (drain) writes tail, see SpscQueue
+    std::atomic<uint16_t> _head{0};
+    std::atomic<uint16_t> _tail{0};
+
+#if NC_FEATURE_THREADED
+    // network task is a second producer
+    SpinLock _lock;
+#endif
+
+    LogRecord *_reserve(uint8_t, const __FlashStringHelper *, const char *);
+    void _commit();
+    void _print(Print &, LogRecord *);
+};
+
+extern LogRing __nc_log;
+
+#if NC_LOG_LEVEL >= NC_LOG_LEVEL_ERROR
+#define NC_LOG_ERROR(...) __nc_log.push(NC_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define NC_LOG_ERROR(...) ((void)0)
+#endif
+
+#if NC_LOG_LEVEL >= NC_LOG_LEVEL_WARN
+#define NC_LOG_WARN(...) __nc_log.push(NC_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define NC_LOG_WARN(...) ((void)0)
+#endif
+
+#if NC_LOG_LEVEL >= NC_LOG_LEVEL_INFO
+#define NC_LOG_INFO(...) __nc_log.push(NC_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define NC_LOG_INFO(...) ((void)0)
+#endif
+
+#if NC_LOG_LEVEL >= NC_LOG_LEVEL_DEBUG
+#define NC_LOG_DEBUG(...) __nc_log.push(NC_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define NC_LOG_DEBUG(...) ((void)0)
+#endif
+
+#endif
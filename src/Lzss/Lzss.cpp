@@ -0,0 +1,197 @@
+#include "Lzss.h"
+
+#define LZSS_NONE 0xFFFF
+#define LZSS_MAX_INPUT (LZSS_NONE - 1) // positions are kept in 16 bits
+
+static uint8_t _lzssHash(const uint8_t *data)
+{
+    return (data[0] << 5) ^ (data[1] << 2) ^ data[2];
+}
+
+/**
+ * Compress a buffer, greedy matching over hash chains
+ * @param capacity size of output buffer
+ * @returns compressed size, 0 if output does not fit or is not smaller than input
+ */
+size_t lzssCompress(const uint8_t *input, size_t size, uint8_t *output, size_t capacity)
+{
+    if (size < LZSS_MIN_MATCH || size > LZSS_MAX_INPUT)
+        return 0;
+
+    // position of the latest occurrence of each hash, and of the previous one for each window slot
+    uint16_t *head = (uint16_t *)malloc((LZSS_HASH_SIZE + LZSS_WINDOW) * sizeof(uint16_t));
+    if (!head)
+        return 0;
+
+    uint16_t *prev = head + LZSS_HASH_SIZE;
+    memset(head, 0xFF, LZSS_HASH_SIZE * sizeof(uint16_t));
+
+    if (capacity > size - 1)
+        capacity = size - 1;
+
+    size_t out = 0;
+    size_t flags = 0;
+    uint8_t bit = 8;
+    size_t i = 0;
+
+    while (i < size)
+    {
+        if (bit == 8)
+        {
+            if (out >= capacity)
+                break;
+
+            flags = out++;
+            output[flags] = 0;
+            bit = 0;
+        }
+
+        uint8_t bestLength = 0;
+        uint16_t bestDistance = 0;
+
+        if (i + LZSS_MIN_MATCH <= size)
+        {
+            uint8_t maxLength = size - i < LZSS_MAX_MATCH ? size - i : LZSS_MAX_MATCH;
+            uint16_t candidate = head[_lzssHash(input + i)];
+
+            for (uint8_t chain = LZSS_MAX_CHAIN; chain && candidate != LZSS_NONE && i - candidate <= LZSS_WINDOW; chain--)
+            {
+                uint8_t length = 0;
+                while (length < maxLength && input[candidate + length] == input[i + length])
+                    length++;
+
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    bestDistance = i - candidate;
+                    if (length == maxLength)
+                        break;
+                }
+
+                candidate = prev[candidate & (LZSS_WINDOW - 1)];
+            }
+        }
+
+        uint8_t advance = 1;
+
+        if (bestLength >= LZSS_MIN_MATCH)
+        {
+            if (out + 2 > capacity)
+                break;
+
+            uint16_t token = ((bestDistance - 1) << LZSS_LENGTH_BITS) | (bestLength - LZSS_MIN_MATCH);
+            output[out++] = token >> 8;
+            output[out++] = token & 0xFF;
+            advance = bestLength;
+        }
+        else
+        {
+            if (out + 1 > capacity)
+                break;
+
+            output[flags] |= 1 << bit;
+            output[out++] = input[i];
+        }
+
+        bit++;
+
+        for (; advance; advance--, i++)
+        {
+            if (i + LZSS_MIN_MATCH > size)
+                continue;
+
+            uint8_t hash = _lzssHash(input + i);
+            prev[i & (LZSS_WINDOW - 1)] = head[hash];
+            head[hash] = i;
+        }
+    }
+
+    free(head);
+
+    return i < size ? 0 : out;
+}
+
+/**
+ * @param length compressed size if known (Content-Length), reader ends there without waiting for a timeout
+ */
+LzssReader::LzssReader(Stream *stream, int length) : _stream(stream), _left(length)
+{
+}
+
+/**
+ * @returns next decoded byte, -1 at the end of the stream (or on timeout)
+ */
+int LzssReader::read()
+{
+    if (!_matchLeft)
+    {
+        // flag byte is shifted out bit by bit, high byte marks how many are left
+        _flags >>= 1;
+        if (!(_flags & 0x100))
+        {
+            int flags = _next();
+            if (flags < 0)
+                return -1;
+
+            _flags = flags | 0xFF00;
+        }
+
+        if (_flags & 1)
+        {
+            int literal = _next();
+            if (literal < 0)
+                return -1;
+
+            _window[_position++ & (LZSS_WINDOW - 1)] = literal;
+            return literal;
+        }
+
+        int high = _next();
+        int low = _next();
+        if (high < 0 || low < 0)
+            return -1;
+
+        uint16_t token = (high << 8) | low;
+        _distance = (token >> LZSS_LENGTH_BITS) + 1;
+        _matchLeft = (token & ((1 << LZSS_LENGTH_BITS) - 1)) + LZSS_MIN_MATCH;
+    }
+
+    // matches may overlap the bytes they produce, so copy one by one
+    uint8_t value = _window[(_position - _distance) & (LZSS_WINDOW - 1)];
+    _window[_position++ & (LZSS_WINDOW - 1)] = value;
+    _matchLeft--;
+
+    return value;
+}
+
+size_t LzssReader::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    for (; count < length; count++)
+    {
+        int value = read();
+        if (value < 0)
+            break;
+
+        buffer[count] = value;
+    }
+
+    return count;
+}
+
+/**
+ * Next compressed byte, waits up to the stream timeout like Stream::readBytes()
+ */
+int LzssReader::_next()
+{
+    if (!_left)
+        return -1;
+
+    uint8_t value;
+    if (_stream->readBytes((char *)&value, 1) != 1)
+        return -1;
+
+    if (_left > 0)
+        _left--;
+    return value;
+}
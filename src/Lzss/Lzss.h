@@ -0,0 +1,56 @@
+#ifndef lzss_h
+#define lzss_h
+
+#include <Arduino.h>
+
+#include "../NodeConnectorConfig.h"
+
+/*
+ * Small LZSS codec for hub payloads ("x-lzss" content encoding).
+ *
+ * Stream is a sequence of groups: one flag byte (LSB first, 1 = literal, 0 = match)
+ * followed by up to 8 items. Literal is one byte, match is two bytes big-endian:
+ * (distance - 1) in the high LZSS_OFFSET_BITS bits, (length - LZSS_MIN_MATCH) in the low ones.
+ *
+ * Window size is part of the format, hub must use the same parameters.
+ * Decoder needs LZSS_WINDOW bytes of RAM, encoder LZSS_WINDOW + LZSS_HASH_SIZE words.
+ */
+
+#define LZSS_OFFSET_BITS 10
+#define LZSS_LENGTH_BITS 6
+#define LZSS_WINDOW (1 << LZSS_OFFSET_BITS)
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + (1 << LZSS_LENGTH_BITS) - 1)
+
+#define LZSS_HASH_SIZE 256
+#define LZSS_MAX_CHAIN 16 // match candidates tried per position
+
+const char CONTENT_ENCODING_LZSS[] = "x-lzss";
+
+size_t lzssCompress(const uint8_t *, size_t, uint8_t *, size_t);
+
+/**
+ * Decoding reader over a compressed stream,
+ * can be passed to deserializeMsgPack() in place of the stream itself
+ */
+class LzssReader
+{
+public:
+    LzssReader(Stream *, int length = -1);
+
+    int read();
+    size_t readBytes(char *, size_t);
+
+private:
+    Stream *_stream;
+    int _left; // compressed bytes not read yet, -1 if unknown
+    uint8_t _window[LZSS_WINDOW];
+    uint16_t _position = 0;
+    uint16_t _flags = 0;
+    uint16_t _distance = 0;
+    uint8_t _matchLeft = 0;
+
+    int _next();
+};
+
+#endif
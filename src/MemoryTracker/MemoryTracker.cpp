@@ -0,0 +1,161 @@
+#include <stdlib.h>
+
+#include "../PrintWrapper/PrintWrapper.h"
+#include "../Log/Log.h"
+#include "MemoryTracker.h"
+
+MemoryTracker __nc_mem;
+
+static const char *const _tagNames[MEM_TAG_COUNT] = {"connector", "sync out", "sync in", "storage", "definition"};
+
+void *MemoryTracker::alloc(MemoryTag tag, size_t size)
+{
+    void *memory = ::malloc(size);
+
+#if NC_FEATURE_MEMORY_STATS
+    if (!memory)
+    {
+        NC_LOG_ERROR(F("Out of memory"), _tagNames[tag], (unsigned long)size);
+        return nullptr;
+    }
+
+    _live[tag] += size;
+
+    size_t total = live();
+    if (total > _peak)
+        _peak = total;
+#endif
+
+    return memory;
+}
+
+void MemoryTracker::free(MemoryTag tag, void *memory, size_t size)
+{
+    if (!memory)
+        return;
+
+    ::free(memory);
+
+#if NC_FEATURE_MEMORY_STATS
+    _live[tag] = _live[tag] > size ? _live[tag] - size : 0;
+#endif
+}
+
+/**
+ * Make tracked copy of a string, eg. a key which must outlive JSON document
+ */
+char *MemoryTracker::copy(MemoryTag tag, const char *str)
+{
+    char *result = (char *)alloc(tag, strlen(str) + 1);
+    if (result)
+        strcpy(result, str);
+    return result;
+}
+
+/**
+ * Count short living allocation (eg. per cycle JSON document)
+ */
+void MemoryTracker::transient(size_t size)
+{
+#if NC_FEATURE_MEMORY_STATS
+    _transient += size;
+#endif
+}
+
+/**
+ * Mark the moment definition derived structures are built.
+ * Connector memory should not grow from one definition load to another.
+ */
+void MemoryTracker::definitionLoaded()
+{
+#if NC_FEATURE_MEMORY_STATS
+    size_t total = live();
+
+    if (_definitionLoaded)
+    {
+        growth = (long)total - (long)_liveAtDefinitionLoad;
+        if (growth > 0)
+            NC_LOG_WARN(F("Connector memory grew after definition reload"), nullptr, growth);
+    }
+
+    _definitionLoaded = true;
+    _liveAtDefinitionLoad = total;
+#endif
+}
+
+size_t MemoryTracker::live()
+{
+    size_t total = 0;
+    for (uint8_t i = 0; i < MEM_TAG_COUNT; i++)
+        total += _live[i];
+    return total;
+}
+
+size_t MemoryTracker::live(MemoryTag tag)
+{
+    return _live[tag];
+}
+
+size_t MemoryTracker::peak()
+{
+    return _peak;
+}
+
+size_t MemoryTracker::heapFree()
+{
+    return ESP.getFreeHeap();
+}
+
+size_t MemoryTracker::heapMaxBlock()
+{
+#ifdef ESP32
+    return ESP.getMaxAllocHeap();
+#else
+    return ESP.getMaxFreeBlockSize();
+#endif
+}
+
+uint8_t MemoryTracker::heapFragmentation()
+{
+#ifdef ESP32
+    size_t free = heapFree();
+    return free ? (uint8_t)(100 - heapMaxBlock() * 100 / free) : 0;
+#else
+    return ESP.getHeapFragmentation();
+#endif
+}
+
+/**
+ * Write memory state to the state machine as `@nc.mem.*` and `@nc.heap.*` variables
+ */
+void MemoryTracker::publish(StateMachineController *sm)
+{
+#if NC_FEATURE_MEMORY_STATS
+    size_t free = heapFree();
+    if (!_heapMin || free < _heapMin)
+        _heapMin = free;
+
+    // `true` - notify hooks, so values can be synced out like any other variable
+    sm->setVar("@nc.mem.live", (long int)live(), true);
+    sm->setVar("@nc.mem.peak", (long int)_peak, true);
+    sm->setVar("@nc.mem.growth", growth, true);
+    sm->setVar("@nc.mem.temp", (long int)_transient, true);
+    sm->setVar("@nc.heap.free", (long int)free, true);
+    sm->setVar("@nc.heap.min", (long int)_heapMin, true);
+    sm->setVar("@nc.heap.block", (long int)heapMaxBlock(), true);
+    sm->setVar("@nc.heap.frag", (long int)heapFragmentation(), true);
+
+    _transient = 0;
+#endif
+}
+
+void MemoryTracker::report(Print &out)
+{
+    out << F("Connector memory: ") << live() << F(" (peak ") << _peak << F(")\n");
+    for (uint8_t i = 0; i < MEM_TAG_COUNT; i++)
+        out << "  " << _tagNames[i] << ": " << _live[i] << "\n";
+
+    out << F("Heap free: ") << heapFree()
+        << F(", max block: ") << heapMaxBlock()
+        << F(", fragmentation: ") << heapFragmentation() << "%\n";
+}
@@ -0,0 +1,85 @@
+#ifndef memorytracker_h
+#define memorytracker_h
+
+#include <new>
+#include <Arduino.h>
+#include <StateMachine.h>
+
+#include "../NodeConnectorConfig.h"
+
+/*
+ * Accounting of connector owned heap allocations.
+ *
+ * Every long living connector allocation is tagged by subsystem,
+ * so live and peak bytes can be reported per subsystem.
+ * Definition lifetime data is carved from DefinitionArena blocks (MEM_DEFINITION),
+ * arena keeps its own per subsystem usage.
+ *
+ * Together with heap state (free bytes, largest free block, fragmentation)
+ * it is published as:
+ *
+ *   @nc.mem.live     - bytes currently held by connector
+ *   @nc.mem.peak     - max bytes ever held by connector
+ *   @nc.mem.growth   - connector bytes gained since previous definition load
+ *   @nc.mem.temp     - transient (per cycle) bytes allocated in the window
+ *   @nc.heap.free    - free heap bytes
+ *   @nc.heap.min     - lowest free heap since boot
+ *   @nc.heap.block   - largest free heap block
+ *   @nc.heap.frag    - heap fragmentation, %
+ *
+ * Falling `@nc.heap.free` with steady `@nc.mem.live` points to the user sketch,
+ * growing `@nc.mem.growth` after definition reloads points to the connector.
+ */
+
+enum MemoryTag
+{
+    MEM_CONNECTOR,
+    MEM_SYNC_OUT,
+    MEM_SYNC_IN,
+    MEM_STORAGE,
+    MEM_DEFINITION,
+    MEM_TAG_COUNT
+};
+
+class MemoryTracker
+{
+public:
+    void *alloc(MemoryTag, size_t);
+    void free(MemoryTag, void *, size_t);
+    char *copy(MemoryTag, const char *);
+
+    template <typename T, typename... Args>
+    T *create(MemoryTag tag, Args... args)
+    {
+        void *memory = alloc(tag, sizeof(T));
+        return memory ? new (memory) T(args...) : nullptr;
+    }
+
+    void transient(size_t);
+    void definitionLoaded();
+
+    size_t live();
+    size_t live(MemoryTag);
+    size_t peak();
+    long growth = 0;
+
+    size_t heapFree();
+    size_t heapMaxBlock();
+    uint8_t heapFragmentation();
+
+    void publish(StateMachineController *);
+    void report(Print &);
+
+private:
+    size_t _live[MEM_TAG_COUNT] = {0};
+    size_t _peak = 0;
+    size_t _transient = 0;
+    size_t _heapMin = 0;
+
+    bool _definitionLoaded = false;
+    size_t _liveAtDefinitionLoad = 0;
+};
+
+extern MemoryTracker __nc_mem;
+
+#endif
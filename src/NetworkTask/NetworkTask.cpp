@@ -0,0 +1,228 @@
+#include "../PrintWrapper/PrintWrapper.h"
+#include "../Log/Log.h"
+#include "../Utils/Utils.h"
+#include "../PerfCounters/PerfCounters.h"
+#include "NetworkTask.h"
+
+#if NC_FEATURE_THREADED
+
+/**
+ * @param hub client used only by the task while it runs
+ * @param handler owner's periodic hub work, called in the task on each round
+ * @param context passed to the handler
+ */
+void NetworkTask::init(HubClient *hub, NetworkTaskHandler handler, void *context)
+{
+    _hub = hub;
+    _handler = handler;
+    _context = context;
+}
+
+bool NetworkTask::start()
+{
+    if (_running.load())
+        return true;
+
+    _stopping.store(false);
+    _running.store(true);
+
+    if (xTaskCreatePinnedToCore(_entry, "nc-network", NC_NETWORK_STACK, this,
+                                NC_NETWORK_PRIORITY, &_handle, NC_NETWORK_CORE) != pdPASS)
+    {
+        _running.store(false);
+        NC_LOG_ERROR(F("Network task not started"));
+        return false;
+    }
+
+    NC_LOG_INFO(F("Network task started"));
+    return true;
+}
+
+/**
+ * Finish queued posts and writes, then end the task.
+ * Blocks until the task is gone, after that loop owns hub client and flash again.
+ */
+void NetworkTask::stop()
+{
+    if (!_running.load())
+        return;
+
+    _stopping.store(true);
+
+    while (_running.load())
+        delay(1);
+    _handle = nullptr;
+
+    NC_LOG_INFO(F("Network task stopped"));
+}
+
+bool NetworkTask::isRunning()
+{
+    return _running.load(std::memory_order_acquire);
+}
+
+/**
+ * Queue encoded batch for posting to the hub
+ * @returns false if queue is full (hub is not keeping up) or out of memory
+ */
+bool NetworkTask::post(const char *path, const uint8_t *payload, size_t size, uint8_t attempts)
+{
+    OutboundBatch batch = {path, _copy(payload, size), size, attempts};
+    if (!batch.payload)
+        return false;
+
+    if (_outbound.push(batch))
+        return true;
+
+    free(batch.payload);
+    return false;
+}
+
+/**
+ * Queue file image, file is replaced as a whole
+ * @returns false if queue is full or out of memory
+ */
+bool NetworkTask::write(const char *path, const uint8_t *data, size_t size)
+{
+    FileWrite file = {path, _copy(data, size), size};
+    if (!file.data && size)
+        return false;
+
+    if (_writes.push(file))
+        return true;
+
+    free(file.data);
+    return false;
+}
+
+bool NetworkTask::popParam(InboundParam *param)
+{
+    return _inbound.pop(param);
+}
+
+/**
+ * Last post failed or was slower than NC_CONGESTION_LATENCY
+ */
+bool NetworkTask::congested()
+{
+    return _congested.load(std::memory_order_relaxed);
+}
+
+bool NetworkTask::pushParam(const char *name, long value)
+{
+    InboundParam param;
+    param.isFloat = false;
+    param.vInt = value;
+    return _pushParam(&param, name);
+}
+
+bool NetworkTask::pushParam(const char *name, float value)
+{
+    InboundParam param;
+    param.isFloat = true;
+    param.vFloat = value;
+    return _pushParam(&param, name);
+}
+
+/**
+ * Batches, file writes and params lost on full queues
+ */
+unsigned long NetworkTask::dropped()
+{
+    return _outbound.overflows() + _writes.overflows() + _inbound.overflows();
+}
+
+bool NetworkTask::_pushParam(InboundParam *param, const char *name)
+{
+    // longer names would match a different variable
+    if (strlen(name) >= NC_PARAM_NAME_SIZE)
+    {
+        NC_LOG_WARN(F("Param name too long"), nullptr, (int)strlen(name));
+        return false;
+    }
+
+    strcpy(param->name, name);
+    return _inbound.push(*param);
+}
+
+void NetworkTask::_entry(void *task)
+{
+    ((NetworkTask *)task)->_run();
+    vTaskDelete(nullptr);
+}
+
+void NetworkTask::_run()
+{
+    while (!_stopping.load(std::memory_order_acquire))
+    {
+        _postBatches();
+        _writeFiles();
+
+        if (_handler)
+            _handler(_context);
+
+        vTaskDelay(pdMS_TO_TICKS(NC_NETWORK_IDLE));
+    }
+
+    // nothing queued before `stop` is lost
+    _postBatches();
+    _writeFiles();
+
+    _running.store(false, std::memory_order_release);
+}
+
+void NetworkTask::_postBatches()
+{
+    OutboundBatch batch;
+    while (_outbound.pop(&batch))
+    {
+        for (uint8_t i = 0; i < batch.attempts; i++)
+        {
+            unsigned long start = millis();
+            int httpCode = _hub->postMsgPack(batch.path, batch.payload, batch.size);
+
+            bool success = httpCode >= 200 && httpCode < 300;
+            _congested.store(!success || diff(start, millis()) > NC_CONGESTION_LATENCY, std::memory_order_relaxed);
+            if (success)
+                break;
+        }
+
+        free(batch.payload);
+    }
+}
+
+void NetworkTask::_writeFiles()
+{
+    FileWrite file;
+    while (_writes.pop(&file))
+    {
+        if (_fs.begin())
+        {
+            NC_PERF_START(writeStart);
+
+            File target = _fs.open(file.path, "w");
+            target.write(file.data, file.size);
+            target.close();
+            _fs.end();
+
+            NC_PERF_ADD(flashWriteBytes, file.size);
+            NC_PERF_END(flashWrite, writeStart);
+        }
+
+        free(file.data);
+    }
+}
+
+uint8_t *NetworkTask::_copy(const uint8_t *data, size_t size)
+{
+    if (!size)
+        return nullptr;
+
+    uint8_t *copy = (uint8_t *)malloc(size);
+    if (copy)
+        memcpy(copy, data, size);
+
+    return copy;
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef networktask_h
+#define networktask_h
+
+#include <atomic>
+#include <Arduino.h>
+
+#include "../NodeConnectorConfig.h"
+#include "../SpscQueue/SpscQueue.h"
+#include "../HubClient/HubClient.h"
+#include "../FileSystem/FileSystem.h"
+
+#if NC_FEATURE_THREADED
+
+/*
+ * Network task (NC_FEATURE_THREADED).
+ *
+ * Runs everything that waits on I/O - hub requests and flash writes - next to
+ * the state machine, so slow hub or flash never stretches a cycle.
+ * State machine side and the task talk only through single producer / single consumer queues:
+ *
+ *   outbound  state machine -> task   encoded sync out batches (SMHooks)
+ *   writes    state machine -> task   file images (PersistentStorage)
+ *   inbound   task -> state machine   params read from the hub (sync in)
+ *
+ * Queued data is copied, so producer buffers can be reused right away.
+ * Periodic hub work of the owner (definition check, sync in fetch) runs in the task
+ * through `NetworkTaskHandler`.
+ *
+ * IMPORTANT: while the task runs, `HubClient` and flash must not be used from the loop.
+ * Call `stop` first, it finishes queued work and waits for the task to end.
+ */
+
+typedef void (*NetworkTaskHandler)(void *);
+
+typedef struct OutboundBatch
+{
+    const char *path;
+    uint8_t *payload;
+    size_t size;
+    uint8_t attempts;
+} OutboundBatch;
+
+typedef struct FileWrite
+{
+    const char *path;
+    uint8_t *data;
+    size_t size;
+} FileWrite;
+
+typedef struct InboundParam
+{
+    char name[NC_PARAM_NAME_SIZE];
+    bool isFloat;
+    union
+    {
+        long vInt;
+        float vFloat;
+    };
+} InboundParam;
+
+class NetworkTask
+{
+public:
+    void init(HubClient *, NetworkTaskHandler, void *);
+    bool start();
+    void stop();
+    bool isRunning();
+
+    // state machine side
+    bool post(const char *, const uint8_t *, size_t, uint8_t attempts = 1);
+    bool write(const char *, const uint8_t *, size_t);
+    bool popParam(InboundParam *);
+    bool congested();
+
+    // task side
+    bool pushParam(const char *, long);
+    bool pushParam(const char *, float);
+
+    unsigned long dropped();
+
+private:
+    HubClient *_hub = nullptr;
+    NetworkTaskHandler _handler = nullptr;
+    void *_context = nullptr;
+    FileSystem _fs;
+
+    SpscQueue<OutboundBatch, NC_NETWORK_QUEUE_SIZE> _outbound;
+    SpscQueue<FileWrite, NC_NETWORK_QUEUE_SIZE> _writes;
+    SpscQueue<InboundParam, NC_PARAM_QUEUE_SIZE> _inbound;
+
+    std::atomic<bool> _running{false};
+    std::atomic<bool> _stopping{false};
+    std::atomic<bool> _congested{false};
+
+    TaskHandle_t _handle = nullptr;
+
+    static void _entry(void *);
+    void _run();
+    void _postBatches();
+    void _writeFiles();
+    uint8_t *_copy(const uint8_t *, size_t);
+    bool _pushParam(InboundParam *, const char *);
+};
+
+#endif
+#endif
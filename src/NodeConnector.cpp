@@ -5,7 +5,11 @@
 */
 
 #include "./PrintWrapper/PrintWrapper.h"
+#include "./Log/Log.h"
 #include "NodeConnector.h"
+#if NC_FEATURE_NODE_HOST
+#include "NodeHost.h"
+#endif
 
 #ifdef SM_DEBUGGER
 __debugPrinter = _nc_debugPrinter;
@@ -32,18 +36,80 @@ NodeConnector::NodeConnector(
     const char *configPassword,
     uint16_t stateMachineJsonSize,
     uint16_t paramStoreJsonSize) : _configurator(),
-                                   _hooks(),
+                                   _arena(),
+#if NC_FEATURE_HOOKS
+                                   _hooks(&_arena),
+#endif
+#if NC_FEATURE_SYNC_IN
                                    _syncInConfig(),
-                                   _persistentStorage(),
+#endif
+#if NC_FEATURE_PERSISTENCE
+                                   _persistentStorage(&_arena),
+#endif
                                    hubClient(),
                                    nodeDefinition(stateMachineJsonSize),
+#if NC_FEATURE_SYNC_IN
                                    paramStore(paramStoreJsonSize),
+#endif
                                    fs(),
                                    sm(nodeId, _nc_sleepFunction, _nc_getTime)
 {
   _nodeId = nodeId;
   _configPassword = configPassword;
+  _hub = &hubClient;
+}
+
+#if NC_FEATURE_NODE_HOST
+/**
+ * Virtual node, one of several nodes of a device (see NodeHost.h).
+ * It has its own state machine, definition and files, WiFi and hub client are the host's.
+ * @param nodeId node id on the hub
+ * @param storageNamespace prefix of node's files, eg. "/pump" (flash paths are limited to FILE_PATH_SIZE)
+ */
+NodeConnector::NodeConnector(
+    NodeHost *host,
+    const char *nodeId,
+    const char *storageNamespace,
+    uint16_t stateMachineJsonSize) : _configurator(),
+                                     _arena(),
+#if NC_FEATURE_HOOKS
+                                     _hooks(&_arena),
+#endif
+#if NC_FEATURE_SYNC_IN
+                                     _syncInConfig(),
+#endif
+#if NC_FEATURE_PERSISTENCE
+                                     _persistentStorage(&_arena),
+#endif
+                                     nodeDefinition(stateMachineJsonSize),
+#if NC_FEATURE_SYNC_IN
+                                     // params are read by the host for all of its nodes
+                                     paramStore(0),
+#endif
+                                     fs(),
+                                     sm(nodeId, _nc_sleepFunction, _nc_getTime)
+{
+  this->nodeId = nodeId;
+  _nodeId = nodeId;
+  _configPassword = nullptr;
+  _host = host;
+  _hub = &host->hubClient;
+  _namespace = storageNamespace;
+
+  _cache.setNamespace(storageNamespace);
+#if NC_FEATURE_PERSISTENCE
+  _persistentStorage.setNamespace(storageNamespace);
+#endif
+
+  host->add(this);
+}
+
+NodeConnector::~NodeConnector()
+{
+  if (!_host)
+    hubClient.~HubClient();
 }
+#endif
 
 /**
  * Initialize Node, by loading configurations
@@ -51,17 +117,26 @@ NodeConnector::NodeConnector(
  * @param waitForPin input pin number to watch for signal if configuration needed
  * @param activateOnHigh if true - low to high pin signal change should activate configuration
  * @param waitTimeout how long to wait for signal
+ * @param boot BOOT_FLASH_FIRST to run the stored definition without waiting for WiFi and the hub
  */
-bool NodeConnector::setup(uint16_t waitForPin, bool activateOnHigh, uint16_t waitTimeout)
+bool NodeConnector::setup(uint16_t waitForPin, bool activateOnHigh, uint16_t waitTimeout, BootMode boot)
 {
 
 #ifdef SM_DEBUGGER
   sm.setDebugPrinter(_nc_debugPrinter);
 #endif
 
+  NC_BOOT_BEGIN(configPhase, "config");
   _configurator.init();
+  NC_BOOT_END(configPhase, 0);
+
+#if NC_FEATURE_CONFIG_PAGE
+  // pin has to be held while booting
+  if (boot == BOOT_FLASH_FIRST)
+    waitTimeout = 1;
 
   Serial << F("Waiting for signal to start web config...\n");
+  NC_BOOT_BEGIN(pinPhase, "pin");
   pinMode(waitForPin, INPUT);
   while (waitTimeout-- > 0)
   {
@@ -75,7 +150,12 @@ bool NodeConnector::setup(uint16_t waitForPin, bool activateOnHigh, uint16_t wai
     }
   }
 
+  NC_BOOT_END(pinPhase, 0);
   Serial << F("No signal, continue normal load\n");
+#endif
+
+  if (boot == BOOT_FLASH_FIRST && _bootFromFlash())
+    return _initSM();
 
   loadDefinition();
   return _initSM();
@@ -88,7 +168,9 @@ bool NodeConnector::setup(uint16_t waitForPin, bool activateOnHigh, uint16_t wai
  */
 void NodeConnector::start()
 {
+  NC_BOOT_BEGIN(startPhase, "start");
   sm.init();
+  NC_BOOT_END(startPhase, 0);
 }
 
 /**
@@ -98,12 +180,79 @@ void NodeConnector::start()
  */
 void NodeConnector::loop(unsigned long timeOut)
 {
-  sm.cycle();
+#if NC_FEATURE_THREADED
+  // params read by the network task enter the state machine between cycles
+  _applyNetworkParams();
+#endif
+
+  NC_PERF_START(cycleStart);
+  NC_PERF_CALL(cycleStarted(cycleStart));
+  NC_BOOT_BEGIN(cyclePhase, "cycle");
+
+  _cycle();
+
+  NC_PERF_END(cycle, cycleStart);
+  NC_BOOT_END(cyclePhase, 0);
+
+#if NC_FEATURE_BOOT_TIMELINE
+  if (!__nc_boot.isFinished())
+  {
+    // boot ends with the first cycle
+    __nc_boot.finish();
+    __nc_boot.report(Serial);
+#if NC_BOOT_POST
+    _bootTimelinePending = true;
+#endif
+  }
+#endif
+
+#if NC_FEATURE_PERF_COUNTERS || NC_FEATURE_MEMORY_STATS
+  if (getTimeout(_lastTimeStatsPublished) >= NC_PERF_PERIOD)
+  {
+    _lastTimeStatsPublished = millis();
+#if NC_FEATURE_PERF_COUNTERS
+    __nc_perf.publish(&sm);
+#endif
+#if NC_FEATURE_MEMORY_STATS
+    __nc_mem.publish(&sm);
+#endif
+  }
+#endif
+
+  if (_hubCheckPending)
+  {
+    // flash first boot: nothing waits for WiFi, hub checks are due once it is up
+    if (!_hub->isConnected())
+    {
+      __nc_log.drain(Serial, NC_LOG_DRAIN);
+      return;
+    }
+
+    NC_LOG_INFO(F("WiFi up, checking hub"), _hub->ip);
+    _hubCheckPending = false;
+    _lastTimeDefinitionChecked = millis() - timeOut;
+#if NC_FEATURE_SYNC_IN
+    _lastTimeSyncInAttempted = millis() - _syncInConfig.delay;
+#endif
+  }
+
+#if NC_FEATURE_BOOT_TIMELINE && NC_BOOT_POST
+  _retryBootTimeline();
+#endif
+
+#if NC_FEATURE_THREADED
+  if (_loopNetwork(timeOut))
+  {
+    __nc_log.drain(Serial, NC_LOG_DRAIN);
+    return;
+  }
+#endif
 
   if (getTimeout(_lastTimeDefinitionChecked) >= timeOut)
   {
-    Serial << F("Checking definition for updates\n");
-    if (fetchDefinitionFromHub())
+    NC_LOG_INFO(F("Checking definition for updates"));
+    // running definition stays as it is, a new one is parsed from flash after restart
+    if (fetchDefinitionFromHub(false))
     {
       // TODO: do something if storeSmd fails
       if (storeSmd())
@@ -111,8 +260,11 @@ void NodeConnector::loop(unsigned long timeOut)
         // to avoid memory leaks and unpredictable state machine status
         // we are going to reset device
 
+#if NC_FEATURE_PERSISTENCE
         _persistentStorage.saveOnReboot();
+#endif
 
+        __nc_log.dump(Serial);
         Serial << F("Restarting...\n");
         delay(100);
         ESP.restart();
@@ -121,8 +273,34 @@ void NodeConnector::loop(unsigned long timeOut)
     }
   }
 
+#if NC_FEATURE_SYNC_IN
   if (getTimeout(_lastTimeSyncInAttempted) >= _syncInConfig.delay)
     fetchParamsFromHub();
+#endif
+
+  // standby hubs are probed by the network task, or by sync out posts that are not urgent
+  // (see HubClient::postMsgPack), a probe of its own here would stall the cycle
+
+  // lowest priority: print deferred log records
+  __nc_log.drain(Serial, NC_LOG_DRAIN);
+}
+
+/**
+ * State machine cycle, fed with samples pushed since the previous one
+ */
+void NodeConnector::_cycle()
+{
+#if NC_FEATURE_SAMPLES
+  // samples pushed by ISRs / tasks since the last cycle
+  samples.drain(&sm);
+#endif
+
+#if NC_FEATURE_TIME_FUNCTIONS
+  // date/time functions read one snapshot per cycle
+  __nc_time.invalidateCalendar();
+#endif
+
+  sm.cycle();
 }
 
 /**
@@ -131,11 +309,7 @@ void NodeConnector::loop(unsigned long timeOut)
  */
 void NodeConnector::loadDefinition()
 {
-  // Use Wifi configurator service to read node and hub connectivity params
-  // Configurator provides web UI for setting IOT Node params like
-  // hotspot name and password, Node identifier, Hub url
-  nodeId = _configurator.getParam(PARAM_NODE_ID);
-  _hubAddress = _configurator.getParam(PARAM_FUSOR_HUB_ADDRESS);
+  _loadConfig();
 
   if (fetchDefinitionFromHub())
     storeSmd();
@@ -144,12 +318,60 @@ void NodeConnector::loadDefinition()
     Serial << F("Loading from flash\n");
     loadDefinitionFromFlash();
   }
+}
+
+/**
+ * Use Wifi configurator service to read node and hub connectivity params
+ * Configurator provides web UI for setting IOT Node params like
+ * hotspot name and password, Node identifier, Hub url
+ */
+void NodeConnector::_loadConfig()
+{
+  // virtual node id is given, hub addresses are set by the host
+  if (_isVirtual())
+    return;
 
-  _initGetUrl();
+  nodeId = _configurator.getParam(PARAM_NODE_ID);
+  _hubAddress = _configurator.getParam(PARAM_FUSOR_HUB_ADDRESS);
+  _hub->setHubs(_hubAddress);
+}
+
+/**
+ * Load stored definition and start joining WiFi in the background
+ * @returns false if there is no usable definition on flash
+ */
+bool NodeConnector::_bootFromFlash()
+{
+  _loadConfig();
+
+  if (!loadDefinitionFromFlash())
+  {
+    Serial << F("No definition on flash, waiting for the hub\n");
+    return false;
+  }
+
+  if (nodeId && isAccessPointConfigured())
+  {
+    _hub->init(
+        _configurator.getParam(PARAM_ACCESS_POINT),
+        _configurator.getParam(PARAM_PASSWORD),
+        _configurator.getParam(PARAM_STATIC_IP),
+        _configurator.getParam(PARAM_GATEWAY),
+        _configurator.getParam(PARAM_SUBNET));
+    _hub->onAsync();
+    _hubCheckPending = true;
+  }
+
+  return true;
 }
 
 bool NodeConnector::isAccessPointConfigured()
 {
+#if NC_FEATURE_NODE_HOST
+  if (_host)
+    return _host->isAccessPointConfigured();
+#endif
+
   const char *accessPoint = _configurator.getParam(PARAM_ACCESS_POINT);
 
   Serial << F("Access point to use: '") << accessPoint << "'\n";
@@ -158,10 +380,19 @@ bool NodeConnector::isAccessPointConfigured()
 
 void NodeConnector::startWiFi()
 {
-  if (hubClient.isConnected())
+#if NC_FEATURE_NODE_HOST
+  if (_host)
+  {
+    _host->startWiFi();
+    return;
+  }
+#endif
+
+  // flash first boot joins in the background
+  if (_hub->isAsync() || _hub->isConnected())
     return;
 
-  hubClient.init(
+  _hub->init(
       _configurator.getParam(PARAM_ACCESS_POINT),
       _configurator.getParam(PARAM_PASSWORD),
       _configurator.getParam(PARAM_STATIC_IP),
@@ -169,12 +400,16 @@ void NodeConnector::startWiFi()
       _configurator.getParam(PARAM_SUBNET));
 
   Serial << F("Turning Wifi client On\n");
-  hubClient.on();
+  _hub->on();
 
   Serial << F("Connecting\n");
-  if (hubClient.connect())
+  NC_BOOT_BEGIN(wifiPhase, "wifi");
+  bool connected = _hub->connect();
+  NC_BOOT_END(wifiPhase, 0);
+
+  if (connected)
   {
-    Serial << F("Node IP: ") << hubClient.ip << "\n";
+    Serial << F("Node IP: ") << _hub->ip << "\n";
   }
   else
   {
@@ -182,8 +417,14 @@ void NodeConnector::startWiFi()
   }
 }
 
+#if NC_FEATURE_CONFIG_PAGE
 bool NodeConnector::serveConfigPage()
 {
+#if NC_FEATURE_NODE_HOST
+  if (_host)
+    return _host->serveConfigPage();
+#endif
+
   // create params and assign default values, in case params was not in flash yet
   _configurator.addParam(PARAM_ACCESS_POINT, "");
   _configurator.addParam(PARAM_PASSWORD, "");
@@ -197,11 +438,14 @@ bool NodeConnector::serveConfigPage()
 
   return true;
 }
+#endif
 
 /**
  * Read definition using Wifi from the Fusor Hub
+ * @param parse false to only download and check an update of a running definition,
+ *   its strings may point into the definition buffer, so the document is left as it is
  */
-bool NodeConnector::fetchDefinitionFromHub()
+bool NodeConnector::fetchDefinitionFromHub(bool parse)
 {
 
   if (!_openWiFiConnection())
@@ -214,18 +458,190 @@ bool NodeConnector::fetchDefinitionFromHub()
   // on each loop in case we lost connectivity
   _lastTimeDefinitionChecked = millis();
 
-  char url[MAX_URL_SIZE];
-  strncpy(url, _hubAddress, MAX_URL_SIZE);
-  strncat(url, ENDPOINT_DEFINITIONS, MAX_URL_SIZE - strlen(url));
-  strncat(url, nodeId, MAX_URL_SIZE - strlen(url));
+  char path[MAX_URL_SIZE];
+  _definitionPath(path);
 
   Serial << F("Loading node definition\n");
 
-  isSmdLoaded = _fetchMsgPack(url, &nodeDefinition, _definitionLastUpdatedAt);
+  bool loaded = _fetchDefinition(path, _definitionLastUpdatedAt, true, parse);
+  if (parse)
+    isSmdLoaded = loaded;
+
+  Serial << (loaded ? F("Done. Saving node definition to flash\n") : F("Definition not loaded\n"));
 
-  Serial << (isSmdLoaded ? F("Done. Saving node definition to flash\n") : F("Definition not loaded\n"));
+  return loaded;
+}
 
-  return isSmdLoaded;
+void NodeConnector::_definitionPath(char *path)
+{
+  strncpy(path, ENDPOINT_DEFINITIONS, MAX_URL_SIZE);
+  strncat(path, nodeId, MAX_URL_SIZE - strlen(path));
+}
+
+/**
+ * Entity tag of the stored definition (hash of the file), empty if there is none
+ */
+void NodeConnector::_definitionEtag(char *etag)
+{
+  etag[0] = '\0';
+
+  if (!_definitionHash)
+  {
+    if (!fs.begin())
+      return;
+
+    char smdPath[FILE_PATH_SIZE];
+    _file(smdPath, SMD_FILE_PATH);
+
+    if (fs.exists(smdPath))
+    {
+      File file = fs.open(smdPath, "r");
+      _definitionHash = hashFile(&file);
+      file.close();
+    }
+
+    fs.end();
+  }
+
+  if (_definitionHash)
+    formatEtag(_definitionHash, etag);
+}
+
+/**
+ * Download new definition into SMD_TEMP_FILE_PATH and parse it from there.
+ * Hub bytes are kept as they are, so hub and node hash the same version.
+ * @param delta offer the stored definition as a base for a patch, full download if patch fails
+ * @param parse parse into `nodeDefinition`, otherwise the file is only checked to be valid MsgPack
+ */
+bool NodeConnector::_fetchDefinition(const char *path, const char *ifModifiedSince, bool delta, bool parse)
+{
+  char etag[DEFINITION_ETAG_LENGTH];
+  etag[0] = '\0';
+  if (delta)
+    _definitionEtag(etag);
+
+  Serial << F("Reading from: ") << path << "\n";
+
+  NC_BOOT_BEGIN(fetchPhase, "fetch");
+
+  WiFiClient *stream = _hub->openMsgPackStream(path, ifModifiedSince, etag, DELTA_PATCH);
+  if (!stream)
+  {
+    NC_BOOT_END(fetchPhase, 0);
+    return false;
+  }
+
+  if (_hub->timeStamp[0])
+    strcpy(_timeStampBuff, _hub->timeStamp);
+  else
+    _timeStampBuff[0] = '\0';
+
+  if (!fs.begin(true))
+  {
+    _hub->closeMsgPackStream();
+    NC_BOOT_END(fetchPhase, 0);
+    return false;
+  }
+
+  bool patch = _hub->isDelta();
+  Serial << (patch ? F("Applying definition patch\n") : F("Downloading definition\n"));
+
+  char smdPath[FILE_PATH_SIZE];
+  char tempPath[FILE_PATH_SIZE];
+  _file(smdPath, SMD_FILE_PATH);
+  _file(tempPath, SMD_TEMP_FILE_PATH);
+
+  NC_PERF_START(writeStart);
+
+  File base = patch ? fs.open(smdPath, "r") : File();
+  File output = fs.open(tempPath, "w");
+  DefinitionWriter writer(&output);
+  bool received;
+
+#if NC_FEATURE_COMPRESSION
+  if (_hub->isCompressed())
+  {
+    LzssReader reader(stream, _hub->contentLength());
+    received = writer.receive(reader, patch ? &base : nullptr);
+  }
+  else
+#endif
+    received = writer.receive(*stream, patch ? &base : nullptr, _hub->contentLength());
+
+  output.close();
+  if (patch)
+    base.close();
+  _hub->closeMsgPackStream();
+
+  NC_PERF_END(flashWrite, writeStart);
+  NC_PERF_ADD(flashWriteBytes, writer.size);
+
+  // a patch must produce exactly the version hub named, full downloads are checked if hub names one
+  uint32_t expected;
+  bool named = parseEtag(_hub->etag, &expected);
+  bool valid = received && (named ? writer.hash == expected : !patch);
+
+  if (valid && !parse)
+  {
+    // skip everything, only the structure is checked
+    StaticJsonDocument<16> filter;
+    filter.set(false);
+    StaticJsonDocument<16> skipped;
+
+    File file = fs.open(tempPath, "r");
+    DeserializationError checked = deserializeMsgPack(
+        skipped,
+        file,
+        DeserializationOption::Filter(filter),
+        DeserializationOption::NestingLimit(JSON_NESTING_LIMIT));
+    file.close();
+
+    Serial << F("Definition check: ") << checked.c_str() << "\n";
+    valid = checked == DeserializationError::Ok;
+  }
+  else if (valid)
+  {
+    NC_PERF_START(decodeStart);
+    NC_BOOT_BEGIN(parsePhase, "parse");
+
+    // document is rebuilt, strings of the previous one may point into the buffer
+    _releaseDefinitionBuffer();
+
+    File file = fs.open(tempPath, "r");
+    error = deserializeMsgPack(
+        nodeDefinition,
+        file,
+        DeserializationOption::NestingLimit(JSON_NESTING_LIMIT));
+    file.close();
+
+    NC_PERF_END(decode, decodeStart);
+    NC_BOOT_END(parsePhase, writer.size);
+
+    Serial << F("Deserialize status: ") << error.c_str() << "\n";
+    valid = error == DeserializationError::Ok;
+  }
+
+  if (!valid)
+    fs.remove(tempPath);
+
+  fs.end();
+
+  NC_BOOT_END(fetchPhase, writer.size);
+
+  if (!valid && patch)
+  {
+    NC_LOG_WARN(F("Definition patch failed, downloading full"), nullptr, (unsigned long)writer.size);
+    return _fetchDefinition(path, nullptr, false, parse);
+  }
+
+  _receivedHash = writer.hash;
+
+#if NC_FEATURE_SYNC_OUT
+  if (valid)
+    strcpy(_definitionModified, _hub->lastModified);
+#endif
+
+  return valid;
 }
 
 /**
@@ -235,6 +651,9 @@ bool NodeConnector::storeSmd()
 {
   bool savedSmd = saveSmdToFlash();
   bool savedTime = saveLastModifiedTime(_timeStampBuff);
+#if NC_FEATURE_SYNC_OUT
+  savedTime = _saveDefinitionModified() && savedTime;
+#endif
   return savedSmd && savedTime;
 }
 
@@ -251,25 +670,76 @@ bool NodeConnector::loadDefinitionFromFlash()
 
   Serial << F("Total flash space: ") << fs.totalBytes() << "\n";
 
-  if (!fs.exists(SMD_FILE_PATH))
+  char smdPath[FILE_PATH_SIZE];
+  _file(smdPath, SMD_FILE_PATH);
+
+  if (!fs.exists(smdPath))
     return false;
 
-  File file = fs.open(SMD_FILE_PATH, "r");
+  NC_PERF_START(readStart);
+  NC_BOOT_BEGIN(flashPhase, "flash");
+
+  File file = fs.open(smdPath, "r");
 
   int size = file.size();
   Serial << F("File size: ") << size << "\n";
+  NC_PERF_ADD(flashReadBytes, size);
 
-  error = deserializeMsgPack(
-      nodeDefinition,
-      file,
-      DeserializationOption::NestingLimit(JSON_NESTING_LIMIT));
+  // one read, then parsed in place: strings stay in the buffer instead of being copied
+  _releaseDefinitionBuffer();
+  _definitionBuffer = (char *)__nc_mem.alloc(MEM_DEFINITION, size);
+  _definitionBufferSize = size;
+
+  if (_definitionBuffer && file.read((uint8_t *)_definitionBuffer, size) == (size_t)size)
+  {
+    // hash before parsing, zero-copy parsing rewrites strings
+    _definitionHash = hashBytes(HASH_SEED, (const uint8_t *)_definitionBuffer, size);
+    if (_cache.load(&fs, DefinitionCache::key(_definitionHash, nodeId)))
+      Serial << F("Definition cache hit\n");
+
+    NC_PERF_START(decodeStart);
+    NC_BOOT_BEGIN(parsePhase, "parse");
+
+    error = deserializeMsgPack(
+        nodeDefinition,
+        _definitionBuffer,
+        size,
+        DeserializationOption::NestingLimit(JSON_NESTING_LIMIT));
+
+    NC_PERF_END(decode, decodeStart);
+    NC_BOOT_END(parsePhase, size);
+  }
+  else
+  {
+    // not enough memory for the buffer, stream from the file
+    _releaseDefinitionBuffer();
+    file.seek(0);
+
+    NC_PERF_START(decodeStart);
+    NC_BOOT_BEGIN(parsePhase, "parse");
+
+    error = deserializeMsgPack(
+        nodeDefinition,
+        file,
+        DeserializationOption::NestingLimit(JSON_NESTING_LIMIT));
+
+    NC_PERF_END(decode, decodeStart);
+    NC_BOOT_END(parsePhase, size);
+  }
 
   file.close();
 
   fs.end();
 
+  NC_PERF_END(flashRead, readStart);
+  NC_BOOT_END(flashPhase, size);
+
   Serial << F("Deserialize status: ") << error.c_str() << "\n";
 
+#if NC_FEATURE_SYNC_OUT
+  _loadDefinitionModified();
+#endif
+
   return isSmdLoaded = error == DeserializationError::Ok;
 }
 
@@ -285,14 +755,37 @@ bool NodeConnector::saveSmdToFlash()
     return false;
   }
 
-  File file = fs.open(SMD_FILE_PATH, "w");
+  char smdPath[FILE_PATH_SIZE];
+  char tempPath[FILE_PATH_SIZE];
+  _file(smdPath, SMD_FILE_PATH);
+  _file(tempPath, SMD_TEMP_FILE_PATH);
+
+  // definition fetched from the hub is already on flash as received
+  if (fs.exists(tempPath))
+  {
+    bool renamed = fs.rename(tempPath, smdPath);
+    fs.end();
+
+    _definitionHash = renamed ? _receivedHash : 0;
+    Serial << (renamed ? F("Saved definition\n") : F("Failed saving\n"));
+
+    return renamed;
+  }
+
+  NC_PERF_START(writeStart);
+
+  File file = fs.open(smdPath, "w");
 
   size_t bitesWritten = serializeMsgPack(nodeDefinition, file);
 
   file.close();
+  _definitionHash = 0;
 
   fs.end();
 
+  NC_PERF_END(flashWrite, writeStart);
+  NC_PERF_ADD(flashWriteBytes, bitesWritten);
+
   Serial << F("Saved bytes: ") << bitesWritten << "\n";
 
   return bitesWritten > 0;
@@ -309,10 +802,13 @@ bool NodeConnector::saveLastModifiedTime(const char *timeStamp)
   if (!success)
     return false;
 
+  char modifiedPath[FILE_PATH_SIZE];
+  _file(modifiedPath, LAST_MODIFIED_FILE_PATH);
+
   if (timeStamp && timeStamp[0])
   {
 
-    File file = fs.open(LAST_MODIFIED_FILE_PATH, "w");
+    File file = fs.open(modifiedPath, "w");
     file.write((uint8_t *)timeStamp, strlen(timeStamp));
     file.close();
 
@@ -320,7 +816,7 @@ bool NodeConnector::saveLastModifiedTime(const char *timeStamp)
   }
   else
   {
-    fs.remove(LAST_MODIFIED_FILE_PATH);
+    fs.remove(modifiedPath);
   }
 
   fs.end();
@@ -338,10 +834,13 @@ const char *NodeConnector::loadLastModifiedtime()
   if (!success)
     return nullptr;
 
-  if (!fs.exists(LAST_MODIFIED_FILE_PATH))
+  char modifiedPath[FILE_PATH_SIZE];
+  _file(modifiedPath, LAST_MODIFIED_FILE_PATH);
+
+  if (!fs.exists(modifiedPath))
     return nullptr;
 
-  File file = fs.open(LAST_MODIFIED_FILE_PATH, "r");
+  File file = fs.open(modifiedPath, "r");
   file.read((uint8_t *)_timeStampBuff, sizeof(_timeStampBuff));
   file.close();
 
@@ -352,12 +851,63 @@ const char *NodeConnector::loadLastModifiedtime()
   return _timeStampBuff;
 }
 
+#if NC_FEATURE_SYNC_OUT
+/**
+ * Save Last-Modified of the definition next to it, compact payloads are versioned by it
+ */
+bool NodeConnector::_saveDefinitionModified()
+{
+  if (!fs.begin())
+    return false;
+
+  char modifiedPath[FILE_PATH_SIZE];
+  _file(modifiedPath, DEFINITION_MODIFIED_FILE_PATH);
+
+  if (_definitionModified[0])
+  {
+    File file = fs.open(modifiedPath, "w");
+    file.write((uint8_t *)_definitionModified, strlen(_definitionModified));
+    file.close();
+  }
+  else
+    fs.remove(modifiedPath);
+
+  fs.end();
+  return true;
+}
+
+/**
+ * Load Last-Modified of the stored definition, empty if it is not known
+ */
+void NodeConnector::_loadDefinitionModified()
+{
+  _definitionModified[0] = '\0';
+
+  if (!fs.begin())
+    return;
+
+  char modifiedPath[FILE_PATH_SIZE];
+  _file(modifiedPath, DEFINITION_MODIFIED_FILE_PATH);
+
+  if (fs.exists(modifiedPath))
+  {
+    File file = fs.open(modifiedPath, "r");
+    size_t length = file.read((uint8_t *)_definitionModified, HTTP_TIME_STAMP_LENGTH - 1);
+    _definitionModified[length] = '\0';
+    file.close();
+  }
+
+  fs.end();
+}
+#endif
+
+#if NC_FEATURE_SYNC_IN
 /**
  * Read global params from the Fusor Hub
  */
 bool NodeConnector::fetchParamsFromHub()
 {
-  if (!_getUrl)
+  if (!_getPath)
     return false;
 
   if (!_openWiFiConnection())
@@ -368,34 +918,172 @@ bool NodeConnector::fetchParamsFromHub()
   // on each loop in case we lost connectivity
   _lastTimeSyncInAttempted = millis();
 
-  if (_fetchMsgPack(_getUrl, &paramStore, nullptr, 1))
+  if (_fetchMsgPack(_getPath, &paramStore, nullptr, 1))
   {
+    // compact response: [id, value, id, value, ...]
+    if (_syncInConfig.compact && paramStore.is<JsonArray>())
+    {
+      unsigned int id = 0;
+      bool isId = true;
+      for (JsonVariant item : paramStore.as<JsonArray>())
+      {
+        if (isId)
+          id = item.is<unsigned int>() ? item.as<unsigned int>() : 0;
+        else if (const char *name = _syncInConfig.fieldName(id))
+          _applyParam(name, item);
+
+        isId = !isId;
+      }
+
+      return true;
+    }
+
     if (!paramStore.is<JsonObject>())
       return false;
 
     JsonObject params = paramStore.as<JsonObject>();
 
     for (JsonObject::iterator it = params.begin(); it != params.end(); ++it)
-    {
-      JsonVariant value = it->value();
-
-      if (value.is<long int>())
-        _hooks.setVar(it->key().c_str(), value.as<long int>());
-      else if (value.is<float>())
-        _hooks.setVar(it->key().c_str(), value.as<float>());
-    }
+      _applyParam(it->key().c_str(), it->value());
 
     return true;
   }
-
   return false;
 }
 
+/**
+ * Set State Machine variable from the hub param value (int or float)
+ */
+void NodeConnector::_applyParam(const char *varName, JsonVariant value)
+{
+#if NC_FEATURE_THREADED
+  // called by the network task, values are applied by the loop
+  if (_network.isRunning())
+  {
+    if (value.is<long int>())
+      _network.pushParam(varName, value.as<long int>());
+    else if (value.is<float>())
+      _network.pushParam(varName, value.as<float>());
+    return;
+  }
+#endif
+
+  if (value.is<long int>())
+    _setParam(varName, value.as<long int>());
+  else if (value.is<float>())
+    _setParam(varName, value.as<float>());
+}
+
+/**
+ * Set State Machine variable from the hub param, only if its value has changed
+ */
+void NodeConnector::_setParam(const char *varName, float value)
+{
+  if (sm.getVarFloat(varName) != value)
+    sm.setVar(varName, value, false);
+}
+
+void NodeConnector::_setParam(const char *varName, long int value)
+{
+  if (sm.getVarInt(varName) != value)
+    sm.setVar(varName, value, false);
+}
+#endif
+
+#if NC_FEATURE_THREADED
+/**
+ * Threaded mode: keep network task running, stop it when the definition has to be reloaded
+ * @returns false if loop has to do hub work itself
+ */
+bool NodeConnector::_loopNetwork(unsigned long timeOut)
+{
+  _definitionCheckPeriod.store(timeOut);
+
+  if (_definitionChanged.load())
+  {
+    // definition is downloaded (and device restarted) by the loop,
+    // task has to give hub client and flash back first
+    _network.stop();
+    _definitionChanged.store(false);
+    _lastTimeDefinitionChecked = millis() - timeOut;
+    return false;
+  }
+
+  return _network.start();
+}
+
+void NodeConnector::_applyNetworkParams()
+{
+#if NC_FEATURE_SYNC_IN
+  InboundParam param;
+  while (_network.popParam(&param))
+  {
+    if (param.isFloat)
+      _setParam(param.name, param.vFloat);
+    else
+      _setParam(param.name, param.vInt);
+  }
+#endif
+}
+
+/**
+ * Hub work of the network task, see NetworkTask.h
+ * IMPORTANT: runs in the network task, must not touch the state machine
+ */
+void NodeConnector::networkStep()
+{
+  if (!_definitionChanged.load() && getTimeout(_lastTimeDefinitionChecked) >= _definitionCheckPeriod.load())
+    _definitionChanged.store(_checkDefinition());
+
+#if NC_FEATURE_SYNC_IN
+  if (getTimeout(_lastTimeSyncInAttempted) >= _syncInConfig.delay)
+    fetchParamsFromHub();
+#endif
+
+  _hub->probe();
+}
+
+/**
+ * Ask the hub whether definition has changed, without downloading it
+ */
+bool NodeConnector::_checkDefinition()
+{
+  _lastTimeDefinitionChecked = millis();
+
+  if (!_openWiFiConnection())
+    return false;
+
+  char path[MAX_URL_SIZE];
+  _definitionPath(path);
+
+  WiFiClient *stream = _hub->openMsgPackStream(path, loadLastModifiedtime());
+  _hub->closeMsgPackStream();
+
+  if (stream)
+    NC_LOG_INFO(F("Definition changed"));
+
+  return stream != nullptr;
+}
+
+void _nc_networkStep(void *connector)
+{
+  ((NodeConnector *)connector)->networkStep();
+}
+#endif
+
 void NodeConnector::disbaleSerialPrint()
 {
   __nc_serial_enabled = false;
 }
 
+/**
+ * Print all deferred log records now (eg. before going to deep sleep)
+ */
+void NodeConnector::flushLog()
+{
+  __nc_log.dump(Serial);
+}
+
 /**
  * Loads definition to a provided State Machine and hooks to its life cycle
  */
@@ -404,6 +1092,16 @@ bool NodeConnector::_initSM()
   if (!isSmdLoaded)
     return false;
 
+  NC_BOOT_BEGIN(initPhase, "init");
+
+  // Everything derived from the previous definition goes away in one shot
+  _releaseDefinition();
+  _arena.begin(_arenaSize());
+
+#if NC_FEATURE_SYNC_IN
+  _initGetPath();
+#endif
+
   // SYNC OUT options defines how data should flow from the state machine to the hub
   // SYNC IN options defines how params should flow from the hub to the state machine
 
@@ -412,107 +1110,330 @@ bool NodeConnector::_initSM()
     JsonVariant smDefinition = nodeDefinition[NODE_STATE_MACHINE];
     sm.setDefinition(smDefinition);
 
+#if NC_FEATURE_SYNC_OUT
     // Bind to State Machine for outward data flow
     if (nodeDefinition.containsKey(NODE_SYNC_OUT_OPTIONS))
     {
       JsonVariant syncOutOptions = nodeDefinition[NODE_SYNC_OUT_OPTIONS];
-      _initPostUrl();
+      _initPostPath();
 
       // Hook into State Machine data update cycle
       // Var updates in State Machine will fire posts to the hub,
       // according to sync options
-      _hooks.init(&hubClient, &_persistentStorage, _postUrl, &sm, syncOutOptions);
+      // compact payloads are versioned by definition's Last-Modified stamp
+      time_t schemaVersion = 0;
+      parseHttpDate(_definitionModified, &schemaVersion);
+
+      _hooks.init(&sm);
+      if (!_hooks.initSyncOut(_hub, _postPath, syncOutOptions, (unsigned long)schemaVersion))
+      {
+        Serial << F("Definition arena out of memory\n");
+        _releaseDefinition();
+        NC_BOOT_END(initPhase, 0);
+        return false;
+      }
     }
+#endif
 
+#if NC_FEATURE_PERSISTENCE
     // Bind to Persistent Storage to the State Machine and read variable values
     if (nodeDefinition.containsKey(NODE_PERSISTENT_STORAGE))
     {
       _persistentStorage.init(nodeDefinition[NODE_PERSISTENT_STORAGE], &(sm.compute.store));
 
+      // Var updates in State Machine will be saved to flash,
+      // according to storage options
+      _hooks.init(&sm);
+      _hooks.initPersistence(&_persistentStorage);
+
       // Load initial variable values from the store (or set to defaults by config)
+      NC_BOOT_BEGIN(storagePhase, "storage");
       _persistentStorage.load();
+      NC_BOOT_END(storagePhase, 0);
     }
+#endif
 
+#if NC_FEATURE_SYNC_IN
     // Bind to State Machine for inward data flow
     if (nodeDefinition.containsKey(NODE_SYNC_IN_OPTIONS))
     {
-      JsonVariant syncInOptions = nodeDefinition[NODE_SYNC_IN_OPTIONS];
-
       // Try to overwrite initial variable values from the hub
       // If that fails, we can still have values from the Persistent Storage (see prev step above)
-      if (fetchParamsFromHub())
+      // Flash first boot reads them from `loop` once WiFi is up
+      NC_BOOT_BEGIN(paramsPhase, "params");
+      // Virtual nodes get them from the host, which reads params of all its nodes at once
+      if (!_hubCheckPending && !_isVirtual() && fetchParamsFromHub())
         Serial << F("Node params loaded\n");
+      NC_BOOT_END(paramsPhase, 0);
     }
+#endif
 
+#if NC_FEATURE_TIME_FUNCTIONS
     _addFunctions();
+#endif
+
+#if NC_FEATURE_THREADED
+    // hub I/O and flash writes move to the network task on the first `loop`,
+    // virtual nodes leave them to the host loop
+    if (!_isVirtual())
+    {
+      _network.init(_hub, _nc_networkStep, this);
+#if NC_FEATURE_SYNC_OUT
+      _hooks.initNetwork(&_network);
+#endif
+#if NC_FEATURE_PERSISTENCE
+      _persistentStorage.initNetwork(&_network);
+#endif
+    }
+#endif
 
+    // arena size for the next boot with the same definition
+    if (_definitionHash && fs.begin())
+    {
+      size_t size = _arena.used();
+#if NC_FEATURE_PERSISTENCE
+      // storage tracker records are allocated later, on the first update of each variable
+      if (nodeDefinition.containsKey(NODE_PERSISTENT_STORAGE))
+      {
+        size_t tracker = PersistentStorage::arenaSize(nodeDefinition[NODE_PERSISTENT_STORAGE]);
+        size_t used = _arena.used(MEM_STORAGE);
+        if (tracker > used)
+          size += (tracker - used) + (tracker - used) / 8;
+      }
+#endif
+      _cache.store(&fs, DefinitionCache::key(_definitionHash, nodeId), size);
+      fs.end();
+    }
+
+    __nc_mem.definitionLoaded();
+
+    Serial << F("Definition arena: ") << _arena.used() << "/" << _arena.capacity() << "\n";
+
+    NC_BOOT_END(initPhase, _arena.used());
     return true;
   }
   else
   {
+    NC_BOOT_END(initPhase, 0);
     return false;
   }
 }
 
 /**
- * Given url and target JsonDocument read data from Fusor Hub using MsgPack as a content type
+ * Drop all structures derived from the current definition and release their memory
+ */
+void NodeConnector::_releaseDefinition()
+{
+#if NC_FEATURE_HOOKS
+  _hooks.reset();
+#endif
+#if NC_FEATURE_PERSISTENCE
+  _persistentStorage.reset();
+#endif
+#if NC_FEATURE_SYNC_IN
+  _syncInConfig.reset();
+  _getPath = nullptr;
+#endif
+#if NC_FEATURE_SYNC_OUT
+  _postPath = nullptr;
+#endif
+
+  _arena.release();
+}
+
+#if NC_FEATURE_BOOT_TIMELINE && NC_BOOT_POST
+/**
+ * Post boot timeline once WiFi is up. Failed posts are retried after NC_BOOT_POST_RETRY,
+ * doubled with every attempt, at most NC_BOOT_POST_ATTEMPTS times.
  */
-bool NodeConnector::_fetchMsgPack(const char *url, DynamicJsonDocument *target, const char *ifModifiedSince, uint8_t nestingLimit)
+void NodeConnector::_retryBootTimeline()
 {
-  Serial << F("Reading from: ") << url << "\n";
+  if (!_bootTimelinePending)
+    return;
+
+  // nothing waits for WiFi here, attempts start once it is up
+  if (WiFi.status() != WL_CONNECTED)
+    return;
 
-  WiFiClient *stream = hubClient.openMsgPackStream(url, ifModifiedSince);
+  if (_bootPostAttempts && getTimeout(_lastBootPostAttempt) < ((unsigned long)NC_BOOT_POST_RETRY << (_bootPostAttempts - 1)))
+    return;
+
+  _lastBootPostAttempt = millis();
+  if (_postBootTimeline())
+    _bootTimelinePending = false;
+  else if (++_bootPostAttempts >= NC_BOOT_POST_ATTEMPTS)
+  {
+    NC_LOG_WARN(F("Boot timeline not posted"), nullptr, (unsigned long)_bootPostAttempts);
+    _bootTimelinePending = false;
+  }
+}
+
+/**
+ * Post boot timeline to the hub
+ * @returns true if hub has answered (any status, a hub without the endpoint won't take it later either)
+ *   or network task has queued it
+ */
+bool NodeConnector::_postBootTimeline()
+{
+  if (!nodeId)
+    return true;
+
+  snprintf(_bootPath, MAX_URL_SIZE, "%s%s%s", ENDPOINT_NODE, nodeId, ENDPOINT_BOOT);
+
+  DynamicJsonDocument output(__nc_boot.jsonSize());
+  __nc_boot.toJson(&output, _definitionHash);
+
+  size_t size = measureMsgPack(output);
+  uint8_t buffer[size + 1];
+  // size + 1 because serializeMsgPack sometimes eats last byte
+  serializeMsgPack(output, (char *)buffer, size + 1);
+
+#if NC_FEATURE_THREADED
+  // network task owns the client while it runs, it posts queued batches with retries
+  if (_network.isRunning())
+    return _network.post(_bootPath, buffer, size, 1 + NC_HIGH_PRIORITY_RETRY);
+#endif
+
+  int httpCode = _hub->postMsgPack(_bootPath, buffer, size);
+  NC_LOG_INFO(F("Boot timeline posted"), nullptr, httpCode);
+  return httpCode > 0;
+}
+#endif
+
+/**
+ * Free the buffer flash definition was parsed from
+ * IMPORTANT: nodeDefinition must be cleared or rebuilt right after
+ */
+void NodeConnector::_releaseDefinitionBuffer()
+{
+  if (!_definitionBuffer)
+    return;
+
+  __nc_mem.free(MEM_DEFINITION, _definitionBuffer, _definitionBufferSize);
+  _definitionBuffer = nullptr;
+  _definitionBufferSize = 0;
+}
+
+/**
+ * Estimate memory needed for all definition derived structures
+ */
+size_t NodeConnector::_arenaSize()
+{
+  // known from a previous boot with the same definition
+  size_t cached = _definitionHash ? _cache.arenaSize(DefinitionCache::key(_definitionHash, nodeId)) : 0;
+  if (cached)
+    return cached;
+
+  size_t size = 0;
+
+#if NC_FEATURE_SYNC_OUT
+  if (nodeDefinition.containsKey(NODE_SYNC_OUT_OPTIONS))
+  {
+    size += strlen(ENDPOINT_NODE) + strlen(nodeId) + strlen(ENDPOINT_PARAM_BATCH) + 1;
+    size += SMHooks::arenaSize(nodeDefinition[NODE_SYNC_OUT_OPTIONS]);
+  }
+#endif
+
+#if NC_FEATURE_SYNC_IN
+  if (nodeDefinition.containsKey(NODE_SYNC_IN_OPTIONS))
+    size += SyncInOptions::arenaSize(nodeDefinition[NODE_SYNC_IN_OPTIONS]);
+#endif
+
+#if NC_FEATURE_PERSISTENCE
+  if (nodeDefinition.containsKey(NODE_PERSISTENT_STORAGE))
+    size += PersistentStorage::arenaSize(nodeDefinition[NODE_PERSISTENT_STORAGE]);
+#endif
+
+  // each allocation may lose a few bytes to alignment
+  return size + size / 8;
+}
+
+/**
+ * Given hub path and target JsonDocument read data from Fusor Hub using MsgPack as a content type
+ */
+bool NodeConnector::_fetchMsgPack(const char *path, DynamicJsonDocument *target, const char *ifModifiedSince, uint8_t nestingLimit)
+{
+  Serial << F("Reading from: ") << path << "\n";
+
+  WiFiClient *stream = _hub->openMsgPackStream(path, ifModifiedSince);
   if (!stream)
     return false;
 
-  if (hubClient.timeStamp[0])
-    strcpy(_timeStampBuff, hubClient.timeStamp);
+  if (_hub->timeStamp[0])
+    strcpy(_timeStampBuff, _hub->timeStamp);
   else
     _timeStampBuff[0] = '\0';
 
   Serial << F("Deserializing...\n");
 
-  error = deserializeMsgPack(
-      *target,
-      *stream,
-      DeserializationOption::NestingLimit(nestingLimit));
+  NC_PERF_START(decodeStart);
+
+#if NC_FEATURE_COMPRESSION
+  if (_hub->isCompressed())
+  {
+    // decompressed on the fly, only the window is buffered
+    LzssReader reader(stream);
+    error = deserializeMsgPack(
+        *target,
+        reader,
+        DeserializationOption::NestingLimit(nestingLimit));
+  }
+  else
+#endif
+    error = deserializeMsgPack(
+        *target,
+        *stream,
+        DeserializationOption::NestingLimit(nestingLimit));
+
+  NC_PERF_END(decode, decodeStart);
 
   Serial << F("Deserialize status: ") << error.c_str() << "\n";
 
   return error == DeserializationError::Ok;
 }
 
+#if NC_FEATURE_SYNC_OUT
 /**
- * Build url for posting Node result values (eg. senor readings)
+ * Build hub path for posting Node result values (eg. senor readings)
  */
-void NodeConnector::_initPostUrl()
+void NodeConnector::_initPostPath()
 {
-  size_t urlSize = strlen(_hubAddress) + strlen(ENDPOINT_NODE) + strlen(nodeId) + strlen(ENDPOINT_PARAM_BATCH) + 1;
-  _postUrl = (const char *)new char[urlSize];
-  strcpy((char *)_postUrl, _hubAddress);
-  strcat((char *)_postUrl, ENDPOINT_NODE);
-  strcat((char *)_postUrl, nodeId);
-  strcat((char *)_postUrl, ENDPOINT_PARAM_BATCH);
+  size_t pathSize = strlen(ENDPOINT_NODE) + strlen(nodeId) + strlen(ENDPOINT_PARAM_BATCH) + 1;
+  _postPath = (const char *)_arena.alloc(MEM_CONNECTOR, pathSize);
+  if (!_postPath)
+    return;
+  strcpy((char *)_postPath, ENDPOINT_NODE);
+  strcat((char *)_postPath, nodeId);
+  strcat((char *)_postPath, ENDPOINT_PARAM_BATCH);
 }
+#endif
 
+#if NC_FEATURE_SYNC_IN
 /**
- * Build url for geting global params or values from other Nodes
+ * Build hub path for geting global params or values from other Nodes
  */
-void NodeConnector::_initGetUrl()
+void NodeConnector::_initGetPath()
 {
   if (nodeDefinition.containsKey(NODE_SYNC_IN_OPTIONS))
   {
     JsonVariant syncInOptions = nodeDefinition[NODE_SYNC_IN_OPTIONS];
-    _syncInConfig.init(syncInOptions, _hubAddress);
-    _getUrl = _syncInConfig.requestUrl;
+    _syncInConfig.init(syncInOptions, &_arena);
+    _getPath = _syncInConfig.requestPath;
   }
 }
+#endif
 
 /**
  * Check if Access Point configuration is available and start WiFi
  */
 bool NodeConnector::_openWiFiConnection()
 {
+#if NC_FEATURE_NODE_HOST
+  // virtual node has no configuration of its own, WiFi is the host's
+  if (_host)
+    return _host->startWiFi();
+#endif
+
   if (!nodeId || !isAccessPointConfigured())
   {
     Serial << F("Missing WiFi configuration\n");
@@ -526,6 +1447,31 @@ bool NodeConnector::_openWiFiConnection()
   return true;
 }
 
+/**
+ * Node of a host (see NodeHost.h), sharing its WiFi and hub requests
+ */
+bool NodeConnector::_isVirtual()
+{
+#if NC_FEATURE_NODE_HOST
+  return _host != nullptr;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Path of a node file, in the namespace of a virtual node
+ */
+void NodeConnector::_file(char *path, const char *name)
+{
+#if NC_FEATURE_NODE_HOST
+  filePath(path, _namespace, name);
+#else
+  filePath(path, nullptr, name);
+#endif
+}
+
+#if NC_FEATURE_TIME_FUNCTIONS
 /**
  * Attach date/time functions to a State Machine
  */
@@ -537,7 +1483,11 @@ void NodeConnector::_addFunctions()
   sm.registerFunction("day", _nc_day);
   sm.registerFunction("hour", _nc_hour);
   sm.registerFunction("now", _nc_now);
+  sm.registerFunction("minute", _nc_minute);
+  sm.registerFunction("dayOfYear", _nc_dayOfYear);
+  sm.registerFunction("secondsSinceMidnight", _nc_secondsSinceMidnight);
 }
+#endif
 
 /**
  * Helper functions for binding State Machine to Arduino environment
@@ -558,6 +1508,7 @@ void _nc_debugPrinter(const char *message)
   Serial << message;
 }
 
+#if NC_FEATURE_TIME_FUNCTIONS
 /**
  * State Machine extension MathFunctions.
  * All should return float and accept params as ActionContext.
@@ -567,27 +1518,42 @@ void _nc_debugPrinter(const char *message)
 
 VarStruct _nc_month(ActionContext *ctx)
 {
-  return month(_nc_localTime(ctx));
+  return (long)_nc_calendar(ctx)->month;
 }
 
 VarStruct _nc_day(ActionContext *ctx)
 {
-  return day(_nc_localTime(ctx));
+  return (long)_nc_calendar(ctx)->day;
 }
 
 VarStruct _nc_weekDay(ActionContext *ctx)
 {
-  return weekday(_nc_localTime(ctx));
+  return (long)_nc_calendar(ctx)->weekDay;
 }
 
 VarStruct _nc_hour(ActionContext *ctx)
 {
-  return hour(_nc_localTime(ctx));
+  return (long)_nc_calendar(ctx)->hour;
 }
 
 VarStruct _nc_now(ActionContext *ctx)
 {
-  return (long)_nc_localTime(ctx);
+  return (long)_nc_calendar(ctx)->time;
+}
+
+VarStruct _nc_minute(ActionContext *ctx)
+{
+  return (long)_nc_calendar(ctx)->minute;
+}
+
+VarStruct _nc_dayOfYear(ActionContext *ctx)
+{
+  return (long)_nc_calendar(ctx)->dayOfYear;
+}
+
+VarStruct _nc_secondsSinceMidnight(ActionContext *ctx)
+{
+  return _nc_calendar(ctx)->secondsSinceMidnight;
 }
 
 /**
@@ -598,6 +1564,20 @@ VarStruct _nc_now(ActionContext *ctx)
  */
 time_t _nc_localTime(ActionContext *ctx)
 {
-  float tz = ctx->compute->getVarFloat("@hub.tz");
-  return now() + (time_t)(round((tz * 3600.0f)));
-}
\ No newline at end of file
+  return _nc_calendar(ctx)->time;
+}
+
+/**
+ * Local calendar fields, computed on the first date/time call of a cycle.
+ * Time zone is looked up only then, snapshot is dropped before the next cycle,
+ * on clock update and when `@hub.tz` changes.
+ */
+const LocalCalendar *_nc_calendar(ActionContext *ctx)
+{
+  const LocalCalendar *calendar = __nc_time.calendar();
+  if (calendar)
+    return calendar;
+
+  return __nc_time.calendar(ctx->compute->getVarFloat("@hub.tz"));
+}
+#endif
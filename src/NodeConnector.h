@@ -23,12 +23,22 @@
 #include <WifiConfigurator.h>
 #include <StateMachine.h>
 
+#include "NodeConnectorConfig.h"
 #include "HubClient/HubClient.h"
 #include "SMHooks/SMHooks.h"
 #include "SyncInOptions/SyncInOptions.h"
 #include "PersistentStorage/PersistentStorage.h"
 #include "Utils/Utils.h"
 #include "FileSystem/FileSystem.h"
+#include "Log/Log.h"
+#include "PerfCounters/PerfCounters.h"
+#include "MemoryTracker/MemoryTracker.h"
+#include "DefinitionArena/DefinitionArena.h"
+#include "DefinitionPatch/DefinitionPatch.h"
+#include "DefinitionCache/DefinitionCache.h"
+#include "NetworkTask/NetworkTask.h"
+#include "SampleRing/SampleRing.h"
+#include "BootTimeline/BootTimeline.h"
 
 #define DEFAULT_STATEM_MACHINE_JSON_SIZE 4096
 #define DEFAULT_PARAM_STORE_JSON_SIZE 512
@@ -49,12 +59,15 @@ const char PARAM_NODE_ID[] = "node_ID";
 
 // EEPROM filne names
 const char SMD_FILE_PATH[] = "/smd.mpk";
+const char SMD_TEMP_FILE_PATH[] = "/smd.tmp"; // downloaded or patched definition until it is stored
 const char LAST_MODIFIED_FILE_PATH[] = "/mod.txt";
+const char DEFINITION_MODIFIED_FILE_PATH[] = "/smdmod.txt"; // Last-Modified of the stored definition
 
 // Fusor Hub url paths
 const char ENDPOINT_DEFINITIONS[] = "/definitions/sm/";
 const char ENDPOINT_NODE[] = "/node/";
 const char ENDPOINT_PARAM_BATCH[] = "/batch";
+const char ENDPOINT_BOOT[] = "/boot";
 
 #define NODE_SYNC_OUT_OPTIONS "o"
 #define NODE_SYNC_IN_OPTIONS "i"
@@ -64,13 +77,22 @@ const char ENDPOINT_PARAM_BATCH[] = "/batch";
 void _nc_sleepFunction(unsigned long);
 unsigned long _nc_getTime();
 void _nc_debugPrinter(const char *);
+#if NC_FEATURE_THREADED
+void _nc_networkStep(void *);
+#endif
 
+#if NC_FEATURE_TIME_FUNCTIONS
 VarStruct _nc_month(ActionContext *);
 VarStruct _nc_day(ActionContext *);
 VarStruct _nc_weekDay(ActionContext *);
 VarStruct _nc_hour(ActionContext *);
 VarStruct _nc_now(ActionContext *);
+VarStruct _nc_minute(ActionContext *);
+VarStruct _nc_dayOfYear(ActionContext *);
+VarStruct _nc_secondsSinceMidnight(ActionContext *);
 time_t _nc_localTime(ActionContext *);
+const LocalCalendar *_nc_calendar(ActionContext *);
+#endif
 
 /*
  * Structure of Node Definition JSON
@@ -82,10 +104,29 @@ time_t _nc_localTime(ActionContext *);
  *   "s": <state machine definition> 
  * }
  * 
+ * Sections can be compiled out, see NodeConnectorConfig.h
  */
 
+/*
+ * Boot modes (see NodeConnector::setup)
+ *
+ *  BOOT_HUB_FIRST   - wait for WiFi and the hub, fall back to the definition on flash
+ *  BOOT_FLASH_FIRST - start with the definition on flash right away, WiFi joins in the background
+ *                     and hub checks run from `loop` once it is up, newer definitions come
+ *                     through the usual update (store and restart). Without a stored definition
+ *                     it boots as BOOT_HUB_FIRST. Config page pin is read once instead of waited for.
+ */
+enum BootMode
+{
+  BOOT_HUB_FIRST,
+  BOOT_FLASH_FIRST
+};
+
+class NodeHost;
+
 class NodeConnector
 {
+  friend class NodeHost;
 
 public:
   NodeConnector(
@@ -93,14 +134,24 @@ public:
       const char *configPassword = DEFAULT_NODE_PASSWORD,
       uint16_t stateMachineJsonSize = DEFAULT_STATEM_MACHINE_JSON_SIZE,
       uint16_t paramStoreJsonSize = DEFAULT_PARAM_STORE_JSON_SIZE);
+#if NC_FEATURE_NODE_HOST
+  NodeConnector(
+      NodeHost *host,
+      const char *nodeId,
+      const char *storageNamespace,
+      uint16_t stateMachineJsonSize = DEFAULT_STATEM_MACHINE_JSON_SIZE);
+  ~NodeConnector();
+#endif
 
+#if NC_FEATURE_CONFIG_PAGE
   bool serveConfigPage();
-  bool setup(uint16_t, bool activateOnHigh = false, uint16_t waitTimeout = 3000);
+#endif
+  bool setup(uint16_t, bool activateOnHigh = false, uint16_t waitTimeout = 3000, BootMode boot = BOOT_HUB_FIRST);
   void start();
   void loop(unsigned long timeOut = 60000);
   void loadDefinition();
 
-  bool fetchDefinitionFromHub();
+  bool fetchDefinitionFromHub(bool parse = true);
   bool loadDefinitionFromFlash();
   bool saveSmdToFlash();
   bool storeSmd();
@@ -108,7 +159,9 @@ public:
   bool saveLastModifiedTime(const char *);
   const char *loadLastModifiedtime();
 
+#if NC_FEATURE_SYNC_IN
   bool fetchParamsFromHub();
+#endif
 
   bool isAccessPointConfigured();
 
@@ -116,48 +169,150 @@ public:
 
   // wifi client related
   void startWiFi();
+#if NC_FEATURE_NODE_HOST
+  // constructed by standalone nodes only, virtual nodes use the host's one
+  union
+  {
+    HubClient hubClient;
+  };
+#else
   HubClient hubClient;
+#endif
 
   const char *nodeId;
 
   StateMachineController sm;
   DynamicJsonDocument nodeDefinition;
+#if NC_FEATURE_SYNC_IN
   DynamicJsonDocument paramStore;
+#endif
   JsonVariant stateMachine;
   JsonVariant syncOptions;
   DeserializationError error;
 
   FileSystem fs;
 
+#if NC_FEATURE_SAMPLES
+  // samples pushed by ISRs / tasks, applied before each cycle
+  SampleRing samples;
+#endif
+
   void disbaleSerialPrint();
+  void flushLog();
+
+#if NC_FEATURE_THREADED
+  void networkStep();
+#endif
 
 private:
   WifiConfigurator _configurator;
+  HubClient *_hub; // `hubClient`, or the host's one for virtual nodes
+
+  // memory for all definition derived structures
+  DefinitionArena _arena;
+
+#if NC_FEATURE_HOOKS
   SMHooks _hooks;
+#endif
+#if NC_FEATURE_SYNC_IN
   SyncInOptions _syncInConfig;
+#endif
+#if NC_FEATURE_PERSISTENCE
   PersistentStorage _persistentStorage;
+#endif
+#if NC_FEATURE_THREADED
+  NetworkTask _network;
+  std::atomic<bool> _definitionChanged{false};
+  std::atomic<unsigned long> _definitionCheckPeriod{0};
+#endif
 
   const char *_nodeId;
   const char *_configPassword;
   const char *_hubAddress;
-  const char *_postUrl; // url to post Node results (eg. sensor data)
-  const char *_getUrl;  // url to get Node inputs (eg. configurations or results of other Nodes)
 
+#if NC_FEATURE_NODE_HOST
+  NodeHost *_host = nullptr;        // virtual node of a host
+  const char *_namespace = nullptr; // prefix of virtual node files
+#endif
+
+  bool _hubCheckPending = false; // flash first boot, hub not contacted yet
+#if NC_FEATURE_BOOT_TIMELINE && NC_BOOT_POST
+  bool _bootTimelinePending = false;
+  unsigned long _lastBootPostAttempt = 0;
+  uint8_t _bootPostAttempts = 0; // failed ones
+  char _bootPath[MAX_URL_SIZE]; // queued posts keep only the path pointer
+  void _retryBootTimeline();
+  bool _postBootTimeline();
+#endif
+#if NC_FEATURE_SYNC_OUT
+  const char *_postPath = nullptr; // hub path to post Node results (eg. sensor data)
+#endif
+#if NC_FEATURE_SYNC_IN
+  const char *_getPath = nullptr; // hub path to get Node inputs (eg. configurations or results of other Nodes)
+#endif
+
+  void _loadConfig();
+  bool _bootFromFlash();
+  void _cycle();
+  bool _isVirtual();
+  void _file(char *, const char *);
   bool _initSM();
+  void _releaseDefinition();
+  void _releaseDefinitionBuffer();
+  size_t _arenaSize();
+#if NC_FEATURE_TIME_FUNCTIONS
   void _addFunctions();
-  void _initPostUrl();
-  void _initGetUrl();
+#endif
+#if NC_FEATURE_SYNC_OUT
+  void _initPostPath();
+#endif
+#if NC_FEATURE_SYNC_IN
+  void _initGetPath();
+  void _applyParam(const char *, JsonVariant);
+  void _setParam(const char *, float);
+  void _setParam(const char *, long int);
+#endif
 
   bool _fetchMsgPack(const char *,
                      DynamicJsonDocument *,
                      const char *ifModifiedSince = nullptr,
                      uint8_t nestingLimit = JSON_NESTING_LIMIT);
+  bool _fetchDefinition(const char *, const char *, bool, bool);
   bool _openWiFiConnection();
+  void _definitionPath(char *);
+  void _definitionEtag(char *);
+#if NC_FEATURE_SYNC_OUT
+  bool _saveDefinitionModified();
+  void _loadDefinitionModified();
+#endif
+
+#if NC_FEATURE_THREADED
+  bool _loopNetwork(unsigned long);
+  void _applyNetworkParams();
+  bool _checkDefinition();
+#endif
 
   unsigned long _lastTimeDefinitionChecked = 0;
+#if NC_FEATURE_PERF_COUNTERS || NC_FEATURE_MEMORY_STATS
+  unsigned long _lastTimeStatsPublished = 0;
+#endif
+#if NC_FEATURE_SYNC_IN
   unsigned long _lastTimeSyncInAttempted = 0;
+#endif
 
   char _timeStampBuff[HTTP_TIME_STAMP_LENGTH] = {'\0'};
+#if NC_FEATURE_SYNC_OUT
+  // Last-Modified of the definition in use, versions compact payloads
+  char _definitionModified[HTTP_TIME_STAMP_LENGTH] = {'\0'};
+#endif
+
+  uint32_t _definitionHash = 0; // of SMD_FILE_PATH, 0 until computed
+  uint32_t _receivedHash = 0;   // of SMD_TEMP_FILE_PATH
+
+  // definition read from flash, parsed in place so nodeDefinition strings point into it
+  char *_definitionBuffer = nullptr;
+  size_t _definitionBufferSize = 0;
+  DefinitionCache _cache;
 };
 
 #endif
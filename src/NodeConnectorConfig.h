@@ -0,0 +1,271 @@
+/*
+  Fusor Node Connector - compile time feature selection
+  Copyright Giedrius Lukosevicius 2020
+  MIT License
+*/
+
+#ifndef nodeconnectorconfig_h
+#define nodeconnectorconfig_h
+
+/*
+ * Each connector subsystem can be compiled out by setting its flag to 0,
+ * e.g. in platformio.ini:
+ *
+ *   build_flags = -D NC_FEATURE_SYNC_IN=0 -D NC_FEATURE_CONFIG_PAGE=0
+ *
+ * Disabled subsystem leaves no members, no code and no vtable behind.
+ * Flags must be set globally (build flags), not in a sketch before `#include`,
+ * because library sources are compiled separately.
+ *
+ *  NC_FEATURE_SYNC_OUT       - post state machine variables to the hub ("o" options)
+ *  NC_FEATURE_SYNC_IN        - read params from the hub ("i" options)
+ *  NC_FEATURE_PERSISTENCE    - keep variables in flash between restarts ("p" options)
+ *  NC_FEATURE_CONFIG_PAGE    - web UI for WiFi / hub configuration
+ *  NC_FEATURE_TIME_FUNCTIONS - hub synced clock and date/time state machine functions
+ *  NC_FEATURE_PERF_COUNTERS  - timings and counters published as `@nc.*` variables
+ *  NC_FEATURE_MEMORY_STATS   - connector allocation and heap telemetry published as `@nc.mem.*` variables
+ *  NC_FEATURE_SAMPLES        - lock-free sample ingestion from ISRs and other tasks (`samples`)
+ *  NC_FEATURE_COMPRESSION    - LZSS compressed definition downloads and large batch posts
+ *  NC_FEATURE_BOOT_TIMELINE  - timeline of boot phases (see BootTimeline/BootTimeline.h)
+ *  NC_FEATURE_NODE_HOST      - several virtual nodes on one device sharing hub requests (see NodeHost.h)
+ */
+
+#ifndef NC_FEATURE_SYNC_OUT
+#define NC_FEATURE_SYNC_OUT 1
+#endif
+
+#ifndef NC_FEATURE_SYNC_IN
+#define NC_FEATURE_SYNC_IN 1
+#endif
+
+#ifndef NC_FEATURE_PERSISTENCE
+#define NC_FEATURE_PERSISTENCE 1
+#endif
+
+#ifndef NC_FEATURE_CONFIG_PAGE
+#define NC_FEATURE_CONFIG_PAGE 1
+#endif
+
+#ifndef NC_FEATURE_TIME_FUNCTIONS
+#define NC_FEATURE_TIME_FUNCTIONS 1
+#endif
+
+#ifndef NC_FEATURE_PERF_COUNTERS
+#define NC_FEATURE_PERF_COUNTERS 1
+#endif
+
+#ifndef NC_FEATURE_MEMORY_STATS
+#define NC_FEATURE_MEMORY_STATS 1
+#endif
+
+// off by default, rings of all handles take about 1 KB
+#ifndef NC_FEATURE_SAMPLES
+#define NC_FEATURE_SAMPLES 0
+#endif
+
+#ifndef NC_FEATURE_COMPRESSION
+#define NC_FEATURE_COMPRESSION 1
+#endif
+
+#ifndef NC_FEATURE_BOOT_TIMELINE
+#define NC_FEATURE_BOOT_TIMELINE 1
+#endif
+
+// off by default, single node builds don't carry virtual node paths
+#ifndef NC_FEATURE_NODE_HOST
+#define NC_FEATURE_NODE_HOST 0
+#endif
+
+// how often (ms) performance and memory counters are published to the state machine
+#ifndef NC_PERF_PERIOD
+#define NC_PERF_PERIOD 60000
+#endif
+
+/*
+ * Sync out priority lanes (see SyncOutElementConfig/SyncOutElementConfig.h)
+ *
+ *  NC_LOW_PRIORITY_PERIOD    - ms, low priority variables are batched and posted at most this often
+ *  NC_LOW_PRIORITY_MAX_DEFER - ms, low priority values held back by congestion longer than this are dropped
+ *  NC_CONGESTION_LATENCY     - ms, failed or slower post marks hub link as congested
+ *  NC_HIGH_PRIORITY_RETRY    - immediate retries of a failed high priority post, none on a congested link
+ *  NC_HIGH_PRIORITY_MAX_AGE  - ms, high priority batch the hub did not take is resent once per cycle
+ *                              for this long, then dropped
+ */
+
+#ifndef NC_LOW_PRIORITY_PERIOD
+#define NC_LOW_PRIORITY_PERIOD 10000
+#endif
+
+#ifndef NC_LOW_PRIORITY_MAX_DEFER
+#define NC_LOW_PRIORITY_MAX_DEFER 60000
+#endif
+
+#ifndef NC_CONGESTION_LATENCY
+#define NC_CONGESTION_LATENCY 2000
+#endif
+
+#ifndef NC_HIGH_PRIORITY_RETRY
+#define NC_HIGH_PRIORITY_RETRY 2
+#endif
+
+#ifndef NC_HIGH_PRIORITY_MAX_AGE
+#define NC_HIGH_PRIORITY_MAX_AGE 60000
+#endif
+
+// bytes, smaller posts are sent uncompressed (see Lzss/Lzss.h)
+#ifndef NC_COMPRESS_MIN_SIZE
+#define NC_COMPRESS_MIN_SIZE 256
+#endif
+
+/*
+ * Boot timeline (see BootTimeline/BootTimeline.h)
+ *
+ *  NC_BOOT_PHASES      - max recorded phases
+ *  NC_BOOT_POST        - 1 to post the timeline to the hub once after boot (on first connect)
+ *  NC_BOOT_POST_RETRY  - ms until the first retry of a failed post, doubled with every retry
+ *  NC_BOOT_POST_ATTEMPTS - max posts of the timeline, a hub that answers at all ends them
+ *  NC_FIRMWARE_VERSION - firmware version posted with the timeline
+ */
+
+#ifndef NC_BOOT_PHASES
+#define NC_BOOT_PHASES 16
+#endif
+
+#ifndef NC_BOOT_POST
+#define NC_BOOT_POST 0
+#endif
+
+#ifndef NC_BOOT_POST_RETRY
+#define NC_BOOT_POST_RETRY 10000
+#endif
+
+#ifndef NC_BOOT_POST_ATTEMPTS
+#define NC_BOOT_POST_ATTEMPTS 5
+#endif
+
+#ifndef NC_FIRMWARE_VERSION
+#define NC_FIRMWARE_VERSION __DATE__ " " __TIME__
+#endif
+
+/*
+ * Sample ingestion (see SampleRing/SampleRing.h)
+ *
+ *  NC_SAMPLE_HANDLES   - max variables fed by ISRs / tasks
+ *  NC_SAMPLE_RING_SIZE - samples buffered per variable between cycles, power of 2
+ */
+
+#ifndef NC_SAMPLE_HANDLES
+#define NC_SAMPLE_HANDLES 8
+#endif
+
+#ifndef NC_SAMPLE_RING_SIZE
+#define NC_SAMPLE_RING_SIZE 16
+#endif
+
+/*
+ * Threaded mode, opt-in (see NetworkTask/NetworkTask.h)
+ *
+ * Hub requests and flash writes run in a separate task, the state machine keeps
+ * the Arduino loop task. ESP32 only, the task is pinned to NC_NETWORK_CORE (loop runs on core 1).
+ *
+ *  NC_FEATURE_THREADED   - 1 to enable
+ *  NC_NETWORK_CORE       - core of the network task
+ *  NC_NETWORK_STACK      - network task stack size, bytes
+ *  NC_NETWORK_PRIORITY   - network task priority
+ *  NC_NETWORK_QUEUE_SIZE - outbound batches and file writes in flight, power of 2
+ *  NC_PARAM_QUEUE_SIZE   - inbound params in flight, power of 2
+ *  NC_PARAM_NAME_SIZE    - max inbound param name length + 1
+ *  NC_NETWORK_IDLE       - ms the network task sleeps between rounds
+ */
+
+#ifndef NC_FEATURE_THREADED
+#define NC_FEATURE_THREADED 0
+#endif
+
+#if NC_FEATURE_THREADED && !defined(ESP32)
+#error "NC_FEATURE_THREADED needs ESP32"
+#endif
+
+#ifndef NC_NETWORK_CORE
+#define NC_NETWORK_CORE 0
+#endif
+
+#ifndef NC_NETWORK_STACK
+#define NC_NETWORK_STACK 8192
+#endif
+
+#ifndef NC_NETWORK_PRIORITY
+#define NC_NETWORK_PRIORITY 1
+#endif
+
+#ifndef NC_NETWORK_QUEUE_SIZE
+#define NC_NETWORK_QUEUE_SIZE 8
+#endif
+
+#ifndef NC_PARAM_QUEUE_SIZE
+#define NC_PARAM_QUEUE_SIZE 32
+#endif
+
+#ifndef NC_PARAM_NAME_SIZE
+#define NC_PARAM_NAME_SIZE 32
+#endif
+
+#ifndef NC_NETWORK_IDLE
+#define NC_NETWORK_IDLE 10
+#endif
+
+/*
+ * Virtual nodes (see NodeHost.h)
+ *
+ *  NC_HOST_MAX_NODES    - max virtual nodes of a host
+ *  NC_HOST_BATCH_SIZE   - bytes of merged sync out batches, larger batches are posted alone
+ *  NC_HOST_BATCH_PERIOD - ms, merged batches are posted at most this often, urgent ones right away
+ */
+
+#ifndef NC_HOST_MAX_NODES
+#define NC_HOST_MAX_NODES 4
+#endif
+
+#ifndef NC_HOST_BATCH_SIZE
+#define NC_HOST_BATCH_SIZE 2048
+#endif
+
+#ifndef NC_HOST_BATCH_PERIOD
+#define NC_HOST_BATCH_PERIOD 1000
+#endif
+
+/*
+ * Logging (see Log/Log.h)
+ *
+ *  NC_LOG_LEVEL        - log calls above this level are compiled out
+ *  NC_LOG_RING_SIZE    - number of deferred log records kept until drained, power of 2
+ *  NC_LOG_SUBJECT_SIZE - subject characters copied into a record (longer ones are cut), + 1
+ *  NC_LOG_DRAIN        - max records printed on each `loop` call
+ */
+
+#define NC_LOG_LEVEL_NONE 0
+#define NC_LOG_LEVEL_ERROR 1
+#define NC_LOG_LEVEL_WARN 2
+#define NC_LOG_LEVEL_INFO 3
+#define NC_LOG_LEVEL_DEBUG 4
+
+#ifndef NC_LOG_LEVEL
+#define NC_LOG_LEVEL NC_LOG_LEVEL_INFO
+#endif
+
+#ifndef NC_LOG_RING_SIZE
+#define NC_LOG_RING_SIZE 32
+#endif
+
+#ifndef NC_LOG_SUBJECT_SIZE
+#define NC_LOG_SUBJECT_SIZE 24
+#endif
+
+#ifndef NC_LOG_DRAIN
+#define NC_LOG_DRAIN 8
+#endif
+
+// State machine hooks are needed only if something listens to variable updates
+#define NC_FEATURE_HOOKS (NC_FEATURE_SYNC_OUT || NC_FEATURE_PERSISTENCE)
+
+#endif
@@ -0,0 +1,374 @@
+/*
+  Fusor Node Connector - several nodes on one device
+  Copyright Giedrius Lukosevicius 2020
+  MIT License
+*/
+
+#include "./PrintWrapper/PrintWrapper.h"
+#include "./Log/Log.h"
+#include "NodeConnectorConfig.h"
+
+#if NC_FEATURE_NODE_HOST
+#include "NodeHost.h"
+
+NodeHost::NodeHost(
+    const char *deviceId,
+    const char *configPassword,
+    uint16_t paramStoreJsonSize) : hubClient(),
+#if NC_FEATURE_SYNC_IN
+                                   paramStore(paramStoreJsonSize),
+#endif
+                                   _configurator(),
+                                   _mux()
+{
+  _deviceId = deviceId;
+  _configPassword = configPassword;
+}
+
+/**
+ * Register virtual node, called by its constructor
+ * @returns false if host has NC_HOST_MAX_NODES nodes already
+ */
+bool NodeHost::add(NodeConnector *node)
+{
+  if (_count >= NC_HOST_MAX_NODES)
+  {
+    Serial << F("Too many nodes: ") << node->nodeId << "\n";
+    return false;
+  }
+
+  _nodes[_count++] = node;
+  return true;
+}
+
+/**
+ * Load configuration, then definitions of all nodes (from the hub, or from flash if hub is not reachable)
+ * IMPORTANT: should be called from Arduino program `setup` function
+ * @param waitForPin input pin number to watch for signal if configuration needed
+ * @param activateOnHigh if true - low to high pin signal change should activate configuration
+ * @param waitTimeout how long to wait for signal
+ * @returns false if any of the nodes has no usable definition
+ */
+bool NodeHost::setup(uint16_t waitForPin, bool activateOnHigh, uint16_t waitTimeout)
+{
+  NC_BOOT_BEGIN(configPhase, "config");
+  _configurator.init();
+  NC_BOOT_END(configPhase, 0);
+
+#if NC_FEATURE_CONFIG_PAGE
+  Serial << F("Waiting for signal to start web config...\n");
+  NC_BOOT_BEGIN(pinPhase, "pin");
+  pinMode(waitForPin, INPUT);
+  while (waitTimeout-- > 0)
+  {
+    delay(1);
+    if ((bool)digitalRead(waitForPin) == activateOnHigh)
+    {
+      Serial << F("Serving at http://192.168.1.1\n");
+      serveConfigPage();
+      break;
+    }
+  }
+  NC_BOOT_END(pinPhase, 0);
+#endif
+
+  hubClient.setHubs(_configurator.getParam(PARAM_FUSOR_HUB_ADDRESS));
+  _mux.init(&hubClient);
+
+  bool ready = true;
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    NodeConnector *node = _nodes[i];
+    Serial << F("Node: ") << node->nodeId << "\n";
+
+    node->loadDefinition();
+    bool initialized = node->_initSM();
+#if NC_FEATURE_SYNC_OUT
+    if (initialized)
+      node->_hooks.initMux(&_mux, node->nodeId);
+#endif
+
+    ready = ready && initialized;
+  }
+
+#if NC_FEATURE_SYNC_IN
+  // one request for initial params of all nodes
+  _initGetPath();
+  if (_fetchParams())
+    Serial << F("Node params loaded\n");
+#endif
+
+  return ready;
+}
+
+/**
+ * Starts State Machines of all nodes
+ * IMPORTANT: should be called from Arduino program `setup` function,
+ * after registering actions and plugins
+ */
+void NodeHost::start()
+{
+  for (uint8_t i = 0; i < _count; i++)
+    _nodes[i]->start();
+}
+
+/**
+ * Cycles all nodes, then does their hub work in merged requests
+ * IMPORTANT: should be called from Arduino program `loop` function (each time)
+ * @param timeOut minimal wait time between definition checks of a node
+ */
+void NodeHost::loop(unsigned long timeOut)
+{
+  NC_PERF_START(cycleStart);
+  NC_PERF_CALL(cycleStarted(cycleStart));
+  NC_BOOT_BEGIN(cyclePhase, "cycle");
+
+  for (uint8_t i = 0; i < _count; i++)
+    _nodes[i]->_cycle();
+
+  NC_PERF_END(cycle, cycleStart);
+  NC_BOOT_END(cyclePhase, 0);
+
+#if NC_FEATURE_BOOT_TIMELINE
+  if (!__nc_boot.isFinished())
+  {
+    // boot ends with the first cycle of all nodes
+    __nc_boot.finish();
+    __nc_boot.report(Serial);
+#if NC_BOOT_POST
+    if (_count)
+      _nodes[0]->_bootTimelinePending = true;
+#endif
+  }
+
+#if NC_BOOT_POST
+  if (_count)
+    _nodes[0]->_retryBootTimeline();
+#endif
+#endif
+
+#if NC_FEATURE_PERF_COUNTERS || NC_FEATURE_MEMORY_STATS
+  if (_count && getTimeout(_lastTimeStatsPublished) >= NC_PERF_PERIOD)
+  {
+    _lastTimeStatsPublished = millis();
+#if NC_FEATURE_PERF_COUNTERS
+    __nc_perf.publish(&_nodes[0]->sm);
+#endif
+#if NC_FEATURE_MEMORY_STATS
+    __nc_mem.publish(&_nodes[0]->sm);
+#endif
+  }
+#endif
+
+  // sync out batches of all nodes
+  if (_mux.isDue())
+    _mux.flush();
+
+  _checkDefinition(timeOut);
+
+#if NC_FEATURE_SYNC_IN
+  if (_getPath && getTimeout(_lastTimeSyncInAttempted) >= _syncInDelay)
+    _fetchParams();
+#endif
+
+  // lowest priority: print deferred log records
+  __nc_log.drain(Serial, NC_LOG_DRAIN);
+}
+
+#if NC_FEATURE_CONFIG_PAGE
+bool NodeHost::serveConfigPage()
+{
+  // create params and assign default values, in case params was not in flash yet
+  _configurator.addParam(PARAM_ACCESS_POINT, "");
+  _configurator.addParam(PARAM_PASSWORD, "");
+  _configurator.addParam(PARAM_STATIC_IP, "");
+  _configurator.addParam(PARAM_GATEWAY, "");
+  _configurator.addParam(PARAM_SUBNET, "");
+  _configurator.addParam(PARAM_FUSOR_HUB_ADDRESS, "http://192.168.1.123:3000");
+  _configurator.addParam(PARAM_NODE_ID, _deviceId);
+
+  _configurator.runServer(_configurator.getParam(PARAM_NODE_ID), _configPassword);
+
+  return true;
+}
+#endif
+
+bool NodeHost::isAccessPointConfigured()
+{
+  const char *accessPoint = _configurator.getParam(PARAM_ACCESS_POINT);
+
+  Serial << F("Access point to use: '") << accessPoint << "'\n";
+  return accessPoint && *accessPoint;
+}
+
+/**
+ * Connect to WiFi for all nodes, if it is not connected yet
+ * @returns false if WiFi is not configured
+ */
+bool NodeHost::startWiFi()
+{
+  if (!isAccessPointConfigured())
+  {
+    Serial << F("Missing WiFi configuration\n");
+    return false;
+  }
+
+  if (hubClient.isConnected())
+    return true;
+
+  hubClient.init(
+      _configurator.getParam(PARAM_ACCESS_POINT),
+      _configurator.getParam(PARAM_PASSWORD),
+      _configurator.getParam(PARAM_STATIC_IP),
+      _configurator.getParam(PARAM_GATEWAY),
+      _configurator.getParam(PARAM_SUBNET));
+
+  Serial << F("Turning Wifi client On\n");
+  hubClient.on();
+
+  Serial << F("Connecting\n");
+  NC_BOOT_BEGIN(wifiPhase, "wifi");
+  bool connected = hubClient.connect();
+  NC_BOOT_END(wifiPhase, 0);
+
+  if (connected)
+  {
+    Serial << F("Node IP: ") << hubClient.ip << "\n";
+  }
+  else
+  {
+    Serial << F("Connection failed\n");
+  }
+
+  return true;
+}
+
+/**
+ * Check definition of the next due node, store a newer one and restart
+ */
+void NodeHost::_checkDefinition(unsigned long timeOut)
+{
+  if (!_count)
+    return;
+
+  NodeConnector *node = _nodes[_nextCheck];
+  if (getTimeout(node->_lastTimeDefinitionChecked) < timeOut)
+    return;
+
+  _nextCheck = (_nextCheck + 1) % _count;
+
+  NC_LOG_INFO(F("Checking definition for updates"), node->nodeId);
+  // running definitions stay as they are, a new one is parsed from flash after restart
+  if (node->fetchDefinitionFromHub(false) && node->storeSmd())
+    _restart();
+}
+
+/**
+ * Restart device to start with a new definition, see NodeConnector::loop
+ */
+void NodeHost::_restart()
+{
+#if NC_FEATURE_PERSISTENCE
+  for (uint8_t i = 0; i < _count; i++)
+    _nodes[i]->_persistentStorage.saveOnReboot();
+#endif
+
+  __nc_log.dump(Serial);
+  Serial << F("Restarting...\n");
+  delay(100);
+  ESP.restart();
+  delay(100);
+}
+
+#if NC_FEATURE_SYNC_IN
+/**
+ * Build request path for fields of all nodes, each field once:
+ * /aggregate/batch/flat?node1.param1&node2.param3
+ * Compact ids are per node, so merged request always asks for names.
+ */
+void NodeHost::_initGetPath()
+{
+  size_t size = strlen(HUB_REQUEST_PATH) + 1;
+  uint16_t fieldCount = 0;
+  _syncInDelay = 0;
+
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    SyncInOptions *options = &_nodes[i]->_syncInConfig;
+    if (!options->fields.size())
+      continue;
+
+    if (!_syncInDelay || options->delay < _syncInDelay)
+      _syncInDelay = options->delay;
+
+    for (JsonVariant field : options->fields)
+      if (field.is<char *>() && *field.as<const char *>() && !_isRequested(i, field.as<const char *>()))
+      {
+        size += strlen(field.as<const char *>()) + 1;
+        fieldCount++;
+      }
+  }
+
+  if (!fieldCount)
+    return;
+
+  // lives as long as definitions, which are replaced by a restart
+  char *url = (char *)__nc_mem.alloc(MEM_SYNC_IN, size);
+  if (!url)
+    return;
+
+  strcpy(url, HUB_REQUEST_PATH);
+
+  uint16_t count = 0;
+  for (uint8_t i = 0; i < _count; i++)
+    for (JsonVariant field : _nodes[i]->_syncInConfig.fields)
+      if (field.is<char *>() && *field.as<const char *>() && !_isRequested(i, field.as<const char *>()))
+      {
+        strcat(url, count++ ? "&" : "?");
+        strcat(url, field.as<const char *>());
+      }
+
+  _getPath = url;
+}
+
+/**
+ * Whether field is in the request already, read by one of the preceding nodes
+ * @param node index of the node the field belongs to
+ */
+bool NodeHost::_isRequested(uint8_t node, const char *name)
+{
+  for (uint8_t i = 0; i < node; i++)
+    if (_nodes[i]->_syncInConfig.hasField(name))
+      return true;
+
+  return false;
+}
+
+/**
+ * Read params of all nodes from the Fusor Hub, each node gets the fields it reads
+ */
+bool NodeHost::_fetchParams()
+{
+  if (!_getPath || !startWiFi())
+    return false;
+
+  // We save last attempt time (not success time), see NodeConnector::fetchParamsFromHub
+  _lastTimeSyncInAttempted = millis();
+
+  // read through the first node, response is not node specific
+  if (!_nodes[0]->_fetchMsgPack(_getPath, &paramStore, nullptr, 1) || !paramStore.is<JsonObject>())
+    return false;
+
+  for (JsonPair param : paramStore.as<JsonObject>())
+  {
+    const char *name = param.key().c_str();
+    for (uint8_t i = 0; i < _count; i++)
+      if (_nodes[i]->_syncInConfig.hasField(name))
+        _nodes[i]->_applyParam(name, param.value());
+  }
+
+  return true;
+}
+#endif
+
+#endif
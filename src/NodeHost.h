@@ -0,0 +1,95 @@
+/*
+  Fusor Node Connector - several nodes on one device
+  Copyright Giedrius Lukosevicius 2020
+  MIT License
+*/
+
+#ifndef nodehost_h
+#define nodehost_h
+
+#include "NodeConnector.h"
+#include "BatchMux/BatchMux.h"
+
+#if !NC_FEATURE_NODE_HOST
+#error "NodeHost needs -D NC_FEATURE_NODE_HOST=1"
+#endif
+
+/*
+ * Host of virtual nodes (NC_FEATURE_NODE_HOST), for a device driving several logical devices.
+ *
+ * Each virtual node is a NodeConnector with its own hub node id, definition, state machine and files
+ * (in its storage namespace, eg. "/pump/smd.mpk", "/pump/variables.bin"). Host owns what a device
+ * has once - config page, WiFi and the hub client - and merges hub requests of its nodes:
+ *
+ *  - sync out batches are posted together, see BatchMux/BatchMux.h
+ *  - sync in fields of all nodes are read with one `/aggregate/batch/flat` request
+ *    every min("d") of the nodes, each node gets the fields it asked for
+ *  - definitions are checked per node, one node per `loop`, a newer one restarts the device
+ *
+ * Device wide counters (`@nc.*`) are published to the first node.
+ * Threaded mode is not used by virtual nodes, the host loop does their hub requests and flash writes.
+ *
+ * Usage:
+ *
+ *   NodeHost host("Greenhouse");                 // IMPORTANT: define host before its nodes
+ *   NodeConnector pump(&host, "pump", "/pump");  // node id on the hub, storage namespace
+ *   NodeConnector vent(&host, "vent", "/vent");
+ *
+ *   setup: host.setup(CONFIG_PIN); register actions of pump.sm and vent.sm; host.start();
+ *   loop:  host.loop();
+ */
+
+class NodeHost
+{
+public:
+  NodeHost(
+      const char *deviceId = DEFAULT_NODE_ID,
+      const char *configPassword = DEFAULT_NODE_PASSWORD,
+      uint16_t paramStoreJsonSize = DEFAULT_PARAM_STORE_JSON_SIZE);
+
+  bool add(NodeConnector *);
+
+#if NC_FEATURE_CONFIG_PAGE
+  bool serveConfigPage();
+#endif
+  bool setup(uint16_t, bool activateOnHigh = false, uint16_t waitTimeout = 3000);
+  void start();
+  void loop(unsigned long timeOut = 60000);
+
+  bool isAccessPointConfigured();
+  bool startWiFi();
+
+  HubClient hubClient;
+#if NC_FEATURE_SYNC_IN
+  DynamicJsonDocument paramStore; // params of all nodes
+#endif
+
+private:
+  WifiConfigurator _configurator;
+  BatchMux _mux;
+
+  const char *_deviceId;
+  const char *_configPassword;
+
+  NodeConnector *_nodes[NC_HOST_MAX_NODES];
+  uint8_t _count = 0;
+  uint8_t _nextCheck = 0; // node whose definition is checked next
+
+#if NC_FEATURE_SYNC_IN
+  const char *_getPath = nullptr; // fields of all nodes
+  unsigned long _syncInDelay = DEFAULT_SYNC_DELAY;
+  unsigned long _lastTimeSyncInAttempted = 0;
+
+  void _initGetPath();
+  bool _isRequested(uint8_t, const char *);
+  bool _fetchParams();
+#endif
+#if NC_FEATURE_PERF_COUNTERS || NC_FEATURE_MEMORY_STATS
+  unsigned long _lastTimeStatsPublished = 0;
+#endif
+
+  void _checkDefinition(unsigned long);
+  void _restart();
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include "PerfCounters.h"
+
+#if NC_FEATURE_PERF_COUNTERS
+
+PerfCounters __nc_perf;
+
+void PerfStat::add(unsigned long value)
+{
+    if (!count || value < min)
+        min = value;
+    if (!count || value > max)
+        max = value;
+    sum += value;
+    count++;
+}
+
+void PerfStat::reset()
+{
+    count = 0;
+    min = 0;
+    max = 0;
+    sum = 0;
+}
+
+unsigned long PerfStat::avg()
+{
+    return count ? (unsigned long)(sum / count) : 0;
+}
+
+/**
+ * Track cycle period and its deviation from the previous period
+ * @param start cycle start time in microseconds
+ */
+void PerfCounters::cycleStarted(unsigned long start)
+{
+    if (_lastCycleStart)
+    {
+        unsigned long period = diff(_lastCycleStart, start);
+        if (_lastCyclePeriod)
+            jitter.add(period > _lastCyclePeriod ? period - _lastCyclePeriod : _lastCyclePeriod - period);
+        _lastCyclePeriod = period;
+    }
+    _lastCycleStart = start;
+}
+
+void PerfCounters::postDone(unsigned long start, int httpCode)
+{
+    post.add(diff(start, micros()));
+    postStatus = httpCode;
+    if (httpCode < 200 || httpCode >= 300)
+        postErrors++;
+}
+
+void PerfCounters::fetchDone(unsigned long start, int httpCode)
+{
+    fetch.add(diff(start, micros()));
+    fetchStatus = httpCode;
+    // 304 (NOT MODIFIED) is a valid response for definition checks
+    if ((httpCode < 200 || httpCode >= 300) && httpCode != 304)
+        fetchErrors++;
+}
+
+/**
+ * Write counters of the current window to the state machine as `@nc.*` variables
+ * and start a new window
+ */
+void PerfCounters::publish(StateMachineController *sm)
+{
+    _publish(sm, &cycle, "@nc.cycle.min", "@nc.cycle.avg", "@nc.cycle.max");
+    _publish(sm, &jitter, "@nc.jitter.min", "@nc.jitter.avg", "@nc.jitter.max");
+    _publish(sm, &encode, "@nc.encode.min", "@nc.encode.avg", "@nc.encode.max");
+    _publish(sm, &post, "@nc.post.min", "@nc.post.avg", "@nc.post.max");
+    _publish(sm, &fetch, "@nc.fetch.min", "@nc.fetch.avg", "@nc.fetch.max");
+    _publish(sm, &decode, "@nc.decode.min", "@nc.decode.avg", "@nc.decode.max");
+    _publish(sm, &flashRead, "@nc.fread.min", "@nc.fread.avg", "@nc.fread.max");
+    _publish(sm, &flashWrite, "@nc.fwrite.min", "@nc.fwrite.avg", "@nc.fwrite.max");
+
+    // `true` - notify hooks, so counters can be synced out like any other variable
+    sm->setVar("@nc.post.code", (long int)postStatus, true);
+    sm->setVar("@nc.post.err", (long int)postErrors, true);
+    sm->setVar("@nc.fetch.code", (long int)fetchStatus, true);
+    sm->setVar("@nc.fetch.err", (long int)fetchErrors, true);
+    sm->setVar("@nc.fread.bytes", (long int)flashReadBytes, true);
+    sm->setVar("@nc.fwrite.bytes", (long int)flashWriteBytes, true);
+    sm->setVar("@nc.reconnects", (long int)reconnects, true);
+    sm->setVar("@nc.sync.dropped", (long int)syncDropped, true);
+    sm->setVar("@nc.samples.dropped", (long int)samplesDropped, true);
+
+    reset();
+}
+
+void PerfCounters::reset()
+{
+    cycle.reset();
+    jitter.reset();
+    encode.reset();
+    post.reset();
+    fetch.reset();
+    decode.reset();
+    flashRead.reset();
+    flashWrite.reset();
+
+    postErrors = 0;
+    fetchErrors = 0;
+    flashReadBytes = 0;
+    flashWriteBytes = 0;
+    reconnects = 0;
+    syncDropped = 0;
+    samplesDropped = 0;
+}
+
+void PerfCounters::_publish(StateMachineController *sm, PerfStat *stat, const char *minName, const char *avgName, const char *maxName)
+{
+    // keep previous values if nothing was measured in this window
+    if (!stat->count)
+        return;
+
+    sm->setVar(minName, (long int)stat->min, true);
+    sm->setVar(avgName, (long int)stat->avg(), true);
+    sm->setVar(maxName, (long int)stat->max, true);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef perfcounters_h
+#define perfcounters_h
+
+#include <Arduino.h>
+#include <StateMachine.h>
+
+#include "../NodeConnectorConfig.h"
+#include "../Utils/Utils.h"
+
+/*
+ * Connector performance counters.
+ *
+ * Timings are collected in microseconds as min / avg / max over the publishing window
+ * (NC_PERF_PERIOD) and then published to the state machine as `@nc.*` variables:
+ *
+ *   @nc.cycle.{min,avg,max}   - sm.cycle() duration
+ *   @nc.jitter.{min,avg,max}  - deviation of cycle period from the previous one
+ *   @nc.encode.{min,avg,max}  - afterCycle batch encoding time
+ *   @nc.post.{min,avg,max}    - HTTP post latency
+ *   @nc.fetch.{min,avg,max}   - HTTP get latency (until response headers)
+ *   @nc.decode.{min,avg,max}  - deserializeMsgPack time
+ *   @nc.fread.{min,avg,max}   - flash read time
+ *   @nc.fwrite.{min,avg,max}  - flash write time
+ *   @nc.post.code, @nc.post.err   - last post HTTP status, failed posts in window
+ *   @nc.fetch.code, @nc.fetch.err - last get HTTP status, failed gets in window
+ *   @nc.fread.bytes, @nc.fwrite.bytes - flash bytes read / written in window
+ *   @nc.reconnects            - WiFi reconnects in window
+ *   @nc.sync.dropped          - low priority values dropped under congestion in window
+ *   @nc.samples.dropped       - ISR / task samples dropped on full rings in window
+ *
+ * Listing any of these variables in the "o" (sync out) options posts them
+ * to the hub together with regular node data.
+ */
+
+class PerfStat
+{
+public:
+    void add(unsigned long);
+    void reset();
+    unsigned long avg();
+
+    unsigned long count = 0;
+    unsigned long min = 0;
+    unsigned long max = 0;
+    unsigned long long sum = 0;
+};
+
+class PerfCounters
+{
+public:
+    PerfStat cycle;
+    PerfStat jitter;
+    PerfStat encode;
+    PerfStat post;
+    PerfStat fetch;
+    PerfStat decode;
+    PerfStat flashRead;
+    PerfStat flashWrite;
+
+    int postStatus = 0;
+    int fetchStatus = 0;
+    unsigned long postErrors = 0;
+    unsigned long fetchErrors = 0;
+    unsigned long flashReadBytes = 0;
+    unsigned long flashWriteBytes = 0;
+    unsigned long reconnects = 0;
+    unsigned long syncDropped = 0;
+    unsigned long samplesDropped = 0;
+
+    void cycleStarted(unsigned long);
+    void postDone(unsigned long, int);
+    void fetchDone(unsigned long, int);
+
+    void publish(StateMachineController *);
+    void reset();
+
+private:
+    unsigned long _lastCycleStart = 0;
+    unsigned long _lastCyclePeriod = 0;
+
+    void _publish(StateMachineController *, PerfStat *, const char *, const char *, const char *);
+};
+
+extern PerfCounters __nc_perf;
+
+#if NC_FEATURE_PERF_COUNTERS
+#define NC_PERF_START(var) unsigned long var = micros()
+#define NC_PERF_END(stat, var) __nc_perf.stat.add(diff(var, micros()))
+#define NC_PERF_ADD(counter, value) __nc_perf.counter += (value)
+#define NC_PERF_CALL(call) __nc_perf.call
+#else
+#define NC_PERF_START(var) ((void)0)
+#define NC_PERF_END(stat, var) ((void)0)
+#define NC_PERF_ADD(counter, value) ((void)0)
+#define NC_PERF_CALL(call) ((void)0)
+#endif
+
+#endif
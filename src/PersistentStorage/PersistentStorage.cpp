@@ -1,10 +1,26 @@
 #include "../PrintWrapper/PrintWrapper.h"
+#include "../Log/Log.h"
 #include "../Utils/Utils.h"
 
 #include "PersistentStorage.h"
 
-PersistentStorage::PersistentStorage() : _tracker(), _fs()
+#if NC_FEATURE_PERSISTENCE
+
+PersistentStorage::PersistentStorage(DefinitionArena *arena)
+    : _fs(),
+      _arena(arena),
+      _tracker(KeyCompare(), ArenaAllocator<StorageTracker::value_type>(arena, MEM_STORAGE))
+{
+    setNamespace(nullptr);
+}
+
+/**
+ * Keep variables of a virtual node apart from other nodes on the device
+ * @param ns path prefix, eg. "/pump", nullptr for the device itself
+ */
+void PersistentStorage::setNamespace(const char *ns)
 {
+    filePath(_path, ns, STORAGE_FILE);
 }
 
 void PersistentStorage::init(JsonVariant options, Store *store)
@@ -19,13 +35,49 @@ void PersistentStorage::init(JsonVariant options, Store *store)
     Serial << F("Persistent storage initialized\n");
 }
 
+#if NC_FEATURE_THREADED
+/**
+ * Hand flash writes over to the network task while it runs
+ */
+void PersistentStorage::initNetwork(NetworkTask *network)
+{
+    _network = network;
+}
+#endif
+
+/**
+ * Drop all definition derived state
+ * IMPORTANT: should be called before definition arena is released
+ */
+void PersistentStorage::reset()
+{
+    _tracker.clear();
+    _options = JsonObject();
+    _initialized = false;
+}
+
+/**
+ * Estimate arena space needed for tracking variables listed in storage options
+ */
+size_t PersistentStorage::arenaSize(JsonVariant options)
+{
+    if (!options.is<JsonObject>())
+        return 0;
+
+    size_t size = 0;
+    for (JsonPair option : (JsonObject)options)
+        size += strlen(option.key().c_str()) + 1 + sizeof(RecordStruct) + ARENA_MAP_NODE_SIZE(StorageTracker::value_type);
+
+    return size;
+}
+
 void PersistentStorage::saveOnUpdate(const char *varName)
 {
     // check if timeout reached and var is updated
     if (!_canSave(varName, onUpdate))
         return;
 
-    Serial << F("Storing variable: ") << varName << "\n";
+    NC_LOG_INFO(F("Storing variable"), varName);
     _save();
 }
 
@@ -35,7 +87,7 @@ void PersistentStorage::saveOnReboot()
     if (!_canSaveAnyOnEvent(onReboot))
         return;
 
-    Serial << F("Storing storage on reboot\n");
+    NC_LOG_INFO(F("Storing storage on reboot"));
     _save();
 }
 
@@ -45,7 +97,7 @@ void PersistentStorage::saveOnFirstCycle()
     if (!_canSaveAnyOnEvent(onFirstCycle))
         return;
 
-    Serial << F("Storing storage on first cycle\n");
+    NC_LOG_INFO(F("Storing storage on first cycle"));
     _save();
 }
 
@@ -54,19 +106,21 @@ void PersistentStorage::load()
     if (!_initialized)
         return;
 
-    Serial << F("Loading variables from flash\n");
+    NC_LOG_INFO(F("Loading variables from flash"));
 
     bool success = _fs.begin();
     if (!success)
         return;
 
-    if (!_fs.exists(STORAGE_FILE))
+    if (!_fs.exists(_path))
         return;
 
-    File file = _fs.open(STORAGE_FILE, "r");
+    NC_PERF_START(readStart);
+
+    File file = _fs.open(_path, "r");
+    NC_PERF_ADD(flashReadBytes, file.size());
 
-    int size = file.size();
-    Serial << F("File size: ") << size << "\n";
+    NC_LOG_DEBUG(F("File size"), _path, (unsigned long)file.size());
 
     size_t nameLen;
     VarStruct var;
@@ -81,23 +135,23 @@ void PersistentStorage::load()
 
         if (successBytes == sizeof(var))
         {
-            Serial << varName << "=";
             if (var.type == VAR_TYPE_FLOAT)
             {
                 _store->setVar(varName, var.vFloat, false);
-                Serial << var.vFloat;
+                NC_LOG_DEBUG(F("Loaded float"), varName, var.vFloat);
             }
             else
             {
                 _store->setVar(varName, var.vInt, false);
-                Serial << var.vInt;
+                NC_LOG_DEBUG(F("Loaded int"), varName, var.vInt);
             }
-            Serial << "\n";
         }
     }
     file.close();
 
     _fs.end();
+
+    NC_PERF_END(flashRead, readStart);
 }
 
 bool PersistentStorage::_canSave(const char *varName, StorageEvent event)
@@ -117,7 +171,17 @@ bool PersistentStorage::_canSave(const char *varName, StorageEvent event)
     // check if this is the very first update
     // if yes, init value in our tracker
     if (!_tracker.count((char *)varName))
-        _tracker[(char *)(_keyCreator.createKey(varName))] = new RecordStruct(newValue);
+    {
+        // room for key, record and map node in one block, so nothing is carved if any of them does not fit
+        size_t size = ARENA_SIZE(strlen(varName) + 1) + ARENA_SIZE(sizeof(RecordStruct)) +
+                      ARENA_SIZE(ARENA_MAP_NODE_SIZE(StorageTracker::value_type));
+        if (!_arena->reserve(size))
+            return false;
+
+        char *key = _arena->copy(MEM_STORAGE, varName);
+        RecordStruct *record = _arena->create<RecordStruct>(MEM_STORAGE, newValue);
+        _tracker[key] = record;
+    }
 
     // get old value from our tracker
     RecordStruct *trackedValue = _tracker[(char *)varName];
@@ -163,19 +227,64 @@ bool PersistentStorage::_canSaveAnyOnEvent(StorageEvent event)
 
 void PersistentStorage::_save()
 {
-    Serial << F("Writing storage to flash\n");
-
     if (!_initialized)
         return;
 
+    // as long as we save all variables in one file, file image covers whole config
+    size_t size = _recordsSize();
+    NC_LOG_DEBUG(F("Writing storage to flash"), _path, (unsigned long)size);
+    uint8_t image[size + 1];
+    _writeRecords(image);
+
+#if NC_FEATURE_THREADED
+    if (_network && _network->isRunning())
+    {
+        // flash is written by the network task
+        if (!_network->write(_path, image, size))
+            NC_LOG_WARN(F("Network queue full, storage not saved"));
+        return;
+    }
+#endif
+
     // prepare for saving to EEPROM
     bool success = _fs.begin();
     if (!success)
         return;
 
-    File file = _fs.open(STORAGE_FILE, "w");
+    NC_PERF_START(writeStart);
+
+    File file = _fs.open(_path, "w");
+    file.write(image, size);
+    file.close();
+
+    _fs.end();
+
+    NC_PERF_ADD(flashWriteBytes, size);
+    NC_PERF_END(flashWrite, writeStart);
+    NC_LOG_INFO(F("Storage saved"), _path, (unsigned long)size);
+}
+
+/**
+ * Size of all records: name length, name and value of each variable having a value
+ */
+size_t PersistentStorage::_recordsSize()
+{
+    size_t size = 0;
+    for (JsonPair option : _options)
+    {
+        const char *name = option.key().c_str();
+        if (_store->getVar(name))
+            size += sizeof(size_t) + strlen(name) + sizeof(VarStruct);
+    }
+
+    return size;
+}
 
-    // as long as we save all variables in one file, lets iterate over whole config
+/**
+ * Serialize records into `target` (see `_recordsSize`), mark them saved
+ */
+void PersistentStorage::_writeRecords(uint8_t *target)
+{
     unsigned long now = millis();
     for (JsonPair option : _options)
     {
@@ -185,18 +294,18 @@ void PersistentStorage::_save()
         VarStruct *var = _store->getVar(name);
         if (var)
         {
-            file.write((uint8_t *)(&nameLen), sizeof(nameLen));
-            file.write((uint8_t *)name, nameLen);
-            file.write((uint8_t *)var, sizeof(VarStruct));
+            memcpy(target, &nameLen, sizeof(nameLen));
+            target += sizeof(nameLen);
+            memcpy(target, name, nameLen);
+            target += nameLen;
+            memcpy(target, var, sizeof(VarStruct));
+            target += sizeof(VarStruct);
         }
 
-        _tracker[name]->updatedAt = now;
+        // variable without value was never tracked
+        if (_tracker.count(name))
+            _tracker[name]->updatedAt = now;
     }
-
-    file.close();
-
-    _fs.end();
-    Serial << "Done\n";
 }
 
 bool PersistentStorage::_isFlagOn(const char *varName, const char *flagName)
@@ -213,4 +322,6 @@ unsigned long PersistentStorage::_minTimeout(const char *varName)
     if (!settings.is<unsigned long>())
         return DEFAULT_MIN_TIMEOUT;
     return settings.as<unsigned long>();
-}
\ No newline at end of file
+}
+
+#endif
@@ -6,7 +6,12 @@
 #include <StateMachine.h>
 #include <Arduino.h>
 
+#include "../NodeConnectorConfig.h"
 #include "../FileSystem/FileSystem.h"
+#include "../PerfCounters/PerfCounters.h"
+#include "../MemoryTracker/MemoryTracker.h"
+#include "../DefinitionArena/DefinitionArena.h"
+#include "../NetworkTask/NetworkTask.h"
 #include "RecordStruct.h"
 
 /*
@@ -39,11 +44,22 @@ enum StorageEvent {onFirstCycle, onUpdate, onReboot};
 
 const char STORAGE_FILE[] = "/variables.bin";
 
+typedef std::map<char *, RecordStruct *, KeyCompare,
+                 ArenaAllocator<std::pair<char *const, RecordStruct *>>>
+    StorageTracker;
+
 class PersistentStorage
 {
 public:
-    PersistentStorage();
+    PersistentStorage(DefinitionArena *);
     void init(JsonVariant, Store *);
+    void reset();
+    void setNamespace(const char *);
+#if NC_FEATURE_THREADED
+    void initNetwork(NetworkTask *);
+#endif
+
+    static size_t arenaSize(JsonVariant);
 
     void saveOnUpdate(const char *);
     void saveOnReboot();
@@ -55,15 +71,22 @@ private:
     JsonObject _options;
     Store *_store;
     FileSystem _fs;
+    char _path[FILE_PATH_SIZE]; // STORAGE_FILE in node namespace
+    DefinitionArena *_arena;
 
-    std::map<char *, RecordStruct *, KeyCompare> _tracker;
-    KeyCreate _keyCreator;
+    StorageTracker _tracker;
+
+#if NC_FEATURE_THREADED
+    NetworkTask *_network = nullptr;
+#endif
 
     bool _canSave(const char *, StorageEvent);
     bool _canSaveAnyOnEvent(StorageEvent);
     bool _isFlagOn(const char *, const char *);
     unsigned long _minTimeout(const char *);
     void _save();
+    size_t _recordsSize();
+    void _writeRecords(uint8_t *);
 };
 
 #endif
@@ -0,0 +1,124 @@
+#include "QuantileEstimator.h"
+
+/**
+ * Start new estimate
+ * @param p quantile to estimate, 0..1 (eg. 0.5 - median, 0.95 - p95)
+ */
+void QuantileEstimator::reset(float p)
+{
+    _p = p;
+    count = 0;
+}
+
+void QuantileEstimator::add(float x)
+{
+    // collect first samples as they are
+    if (count < P2_MARKERS)
+    {
+        _heights[count++] = x;
+        if (count < P2_MARKERS)
+            return;
+
+        // insertion sort of initial markers
+        for (uint8_t i = 1; i < P2_MARKERS; i++)
+            for (uint8_t j = i; j > 0 && _heights[j - 1] > _heights[j]; j--)
+            {
+                float tmp = _heights[j];
+                _heights[j] = _heights[j - 1];
+                _heights[j - 1] = tmp;
+            }
+
+        for (uint8_t i = 0; i < P2_MARKERS; i++)
+            _positions[i] = i;
+
+        _desired[0] = 0.0f;
+        _desired[1] = 2.0f * _p;
+        _desired[2] = 4.0f * _p;
+        _desired[3] = 2.0f + 2.0f * _p;
+        _desired[4] = 4.0f;
+
+        _increments[0] = 0.0f;
+        _increments[1] = _p / 2.0f;
+        _increments[2] = _p;
+        _increments[3] = (1.0f + _p) / 2.0f;
+        _increments[4] = 1.0f;
+        return;
+    }
+
+    // find cell of the new sample, adjust extreme markers
+    uint8_t k;
+    if (x < _heights[0])
+    {
+        _heights[0] = x;
+        k = 0;
+    }
+    else if (x >= _heights[P2_MARKERS - 1])
+    {
+        _heights[P2_MARKERS - 1] = x;
+        k = P2_MARKERS - 2;
+    }
+    else
+    {
+        k = 0;
+        while (k < P2_MARKERS - 2 && x >= _heights[k + 1])
+            k++;
+    }
+
+    for (uint8_t i = k + 1; i < P2_MARKERS; i++)
+        _positions[i] += 1.0f;
+
+    for (uint8_t i = 0; i < P2_MARKERS; i++)
+        _desired[i] += _increments[i];
+
+    count++;
+
+    // move middle markers towards their desired positions
+    for (uint8_t i = 1; i < P2_MARKERS - 1; i++)
+    {
+        float d = _desired[i] - _positions[i];
+        if ((d >= 1.0f && _positions[i + 1] - _positions[i] > 1.0f) ||
+            (d <= -1.0f && _positions[i - 1] - _positions[i] < -1.0f))
+        {
+            int8_t step = d >= 0.0f ? 1 : -1;
+            float height = _parabolic(i, step);
+            if (_heights[i - 1] < height && height < _heights[i + 1])
+                _heights[i] = height;
+            else
+                _heights[i] = _linear(i, step);
+            _positions[i] += step;
+        }
+    }
+}
+
+float QuantileEstimator::value()
+{
+    if (!count)
+        return 0.0f;
+
+    if (count >= P2_MARKERS)
+        return _heights[2];
+
+    // too few samples for markers - pick the closest sample rank
+    float sorted[P2_MARKERS];
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint8_t j = i;
+        for (; j > 0 && sorted[j - 1] > _heights[i]; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = _heights[i];
+    }
+    return sorted[(uint8_t)round(_p * (count - 1))];
+}
+
+float QuantileEstimator::_parabolic(uint8_t i, float d)
+{
+    float n0 = _positions[i - 1], n1 = _positions[i], n2 = _positions[i + 1];
+    float q0 = _heights[i - 1], q1 = _heights[i], q2 = _heights[i + 1];
+
+    return q1 + d / (n2 - n0) * ((n1 - n0 + d) * (q2 - q1) / (n2 - n1) + (n2 - n1 - d) * (q1 - q0) / (n1 - n0));
+}
+
+float QuantileEstimator::_linear(uint8_t i, int8_t d)
+{
+    return _heights[i] + d * (_heights[i + d] - _heights[i]) / (_positions[i + d] - _positions[i]);
+}
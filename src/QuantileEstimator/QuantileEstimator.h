@@ -0,0 +1,34 @@
+#ifndef quantileestimator_h
+#define quantileestimator_h
+
+#include <Arduino.h>
+
+/*
+ * Streaming quantile estimate in constant memory (P-square algorithm).
+ * Keeps 5 markers instead of samples.
+ * @see https://www.cse.wustl.edu/~jain/papers/ftp/psqr.pdf
+ */
+
+#define P2_MARKERS 5
+
+class QuantileEstimator
+{
+public:
+    void reset(float);
+    void add(float);
+    float value();
+
+    unsigned long count = 0;
+
+private:
+    float _p = 0.5f;
+    float _heights[P2_MARKERS];
+    float _positions[P2_MARKERS];
+    float _desired[P2_MARKERS];
+    float _increments[P2_MARKERS];
+
+    float _parabolic(uint8_t, float);
+    float _linear(uint8_t, int8_t);
+};
+
+#endif
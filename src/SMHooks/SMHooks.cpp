@@ -1,265 +1,932 @@
 #include <math.h>
+#include <limits.h>
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include <TimeLib.h>
 
-#include "../PrintWrapper/PrintWrapper.h"
+#include "../Log/Log.h"
+#include "../LocalTimeHandler/LocalTimeHandler.h"
 #include "SMHooks.h"
 
-void SMHooks::init(HubClient *hub,
-                   PersistentStorage *persistentStorage,
-                   const char *postUrl,
-                   StateMachineController *sm,
-                   JsonVariant options)
+#if NC_FEATURE_HOOKS
+
+SMHooks::SMHooks(DefinitionArena *arena)
+    : _arena(arena)
+#if NC_FEATURE_SYNC_OUT
+      ,
+      _registry(KeyCompare(), ArenaAllocator<SyncOutRegistry::value_type>(arena, MEM_SYNC_OUT))
+#endif
 {
-    _hub = hub;
-    _persistentStorage = persistentStorage;
-    _postUrl = postUrl;
+}
+
+void SMHooks::init(StateMachineController *sm)
+{
+    if (_sm)
+        return;
+
     _sm = sm;
-    _options = options;
     _sm->setHooks(this);
+}
+
+/**
+ * Drop all definition derived state
+ * IMPORTANT: should be called before definition arena is released
+ */
+void SMHooks::reset()
+{
+#if NC_FEATURE_PERSISTENCE
+    _persistentStorage = nullptr;
+#endif
+
+#if NC_FEATURE_SYNC_OUT
+    _registry.clear();
+    _configs = nullptr;
+    _state.reset();
+    _hub = nullptr;
+    _postPath = nullptr;
+    _compact = false;
+    _schemaVersion = 0;
+    _freePending();
+#endif
+}
+
+#if NC_FEATURE_PERSISTENCE
+void SMHooks::initPersistence(PersistentStorage *persistentStorage)
+{
+    _persistentStorage = persistentStorage;
+}
+#endif
+
+#if NC_FEATURE_THREADED && NC_FEATURE_SYNC_OUT
+/**
+ * Hand encoded batches over to the network task while it runs
+ */
+void SMHooks::initNetwork(NetworkTask *network)
+{
+    _network = network;
+}
+#endif
+
+#if NC_FEATURE_NODE_HOST && NC_FEATURE_SYNC_OUT
+/**
+ * Virtual node: hand encoded batches over to the host, which merges them with other nodes' ones
+ * @param nodeId identifies batches of this node in the merged request
+ */
+void SMHooks::initMux(BatchMux *mux, const char *nodeId)
+{
+    _mux = mux;
+    _nodeId = nodeId;
+}
+#endif
+
+#if NC_FEATURE_SYNC_OUT
+/**
+ * @returns false if definition arena is out of memory
+ */
+bool SMHooks::initSyncOut(HubClient *hub,
+                          const char *postPath,
+                          JsonVariant options,
+                          unsigned long schemaVersion)
+{
+    _hub = hub;
+    _postPath = postPath;
+    _options = options;
+    _schemaVersion = schemaVersion;
 
     if (!options.is<JsonObject>())
-        return;
+        return true;
+
+    uint16_t count = 0;
+    for (JsonPair option : (JsonObject)options)
+        if (option.value().is<JsonObject>())
+            count++;
+
+    if (!count)
+        return true;
+
+    // configs and state are contiguous arrays sharing variable index
+    _configs = (SyncOutElementConfig *)_arena->alloc(MEM_SYNC_OUT, sizeof(SyncOutElementConfig) * count);
+    if (!_configs)
+        return false;
 
+    uint16_t index = 0;
+    uint16_t aggregates = 0;
+    uint16_t quantileCount = 0;
     for (JsonPair option : (JsonObject)options)
     {
         JsonVariant optionConfig = option.value();
         if (!optionConfig.is<JsonObject>())
             continue;
 
-        const char *varName = option.key().c_str();
+        SyncOutElementConfig *config = new (&_configs[index++]) SyncOutElementConfig(option.key().c_str(), optionConfig);
+        if (config->syncType == T_PREPROCESS)
+            aggregates |= config->preprocessing;
+        quantileCount += config->quantileCount();
+    }
+
+    if (!_state.init(_arena, count, aggregates, quantileCount))
+    {
+        _configs = nullptr;
+        return false;
+    }
+
+    // compact payload only if hub can map every value back to its variable
+    _compact = true;
+    uint16_t slot = 0;
+    for (index = 0; index < count; index++)
+    {
+        SyncOutElementConfig *config = &_configs[index];
+        if (!_arena->reserve(ARENA_MAP_NODE_SIZE(SyncOutRegistry::value_type)))
+        {
+            _registry.clear();
+            _configs = nullptr;
+            return false;
+        }
+        _registry[config->name] = index;
+        _compact = _compact && config->id;
+
+        if (config->quantileCount())
+        {
+            _state.quantileSlot[index] = slot;
+            slot += config->quantileCount();
+            _resetQuantiles(index);
+        }
+    }
+
+    return true;
+}
 
-        SyncOutElementConfig *elementConfig = new SyncOutElementConfig(varName, optionConfig);
-        _registry[varName] = elementConfig;
+/**
+ * Estimate arena space needed for sync out options
+ */
+size_t SMHooks::arenaSize(JsonVariant options)
+{
+    if (!options.is<JsonObject>())
+        return 0;
+
+    size_t count = options.size();
+    uint16_t aggregates = 0;
+    size_t quantileCount = 0;
+    for (JsonPair option : (JsonObject)options)
+    {
+        JsonVariant prep = option.value()[SYNC_PREPROCESS];
+        if (!prep.is<char *>())
+            continue;
+
+        uint16_t preprocessing = SyncOutElementConfig::parsePreprocessing(prep);
+        aggregates |= preprocessing;
+        quantileCount += __builtin_popcount(preprocessing & P_NEEDS_QUANTILE);
     }
+
+    return count * (sizeof(SyncOutElementConfig) + ARENA_MAP_NODE_SIZE(SyncOutRegistry::value_type)) +
+           SyncOutState::arenaSize(count, aggregates, quantileCount);
 }
+#endif
 
 void SMHooks::onVarUpdate(const char *name, VarStruct *value)
 {
+#if NC_FEATURE_TIME_FUNCTIONS
+    // time zone changed within a cycle, recompute calendar
+    if (name[0] == '@' && !strcmp(name, "@hub.tz"))
+        __nc_time.invalidateCalendar();
+#endif
+
+#if NC_FEATURE_PERSISTENCE
     // handle persistent value saving
-    _persistentStorage->saveOnUpdate(name);
+    if (_persistentStorage)
+        _persistentStorage->saveOnUpdate(name);
+#endif
 
+#if NC_FEATURE_SYNC_OUT
     // check if variable is tracked
-    if (!_registry.count(name))
+    SyncOutRegistry::iterator item = _registry.find(name);
+    if (item == _registry.end())
         return;
 
-    SyncOutElementConfig *options = _registry[name];
+    uint16_t index = item->second;
 
-    switch (options->syncType)
+    switch (_configs[index].syncType)
     {
 
     case T_INSTANT:
-        _collect(options, value);
+        _collect(index, value);
         break;
 
     case T_ON_CHANGE:
-        _onChange(options, value);
+        _onChange(index, value);
         break;
 
     case T_PREPROCESS:
-        _preprocess(options, value);
+        _preprocess(index, value);
         break;
     }
+#endif
 }
 
-void SMHooks::setVar(const char *varName, float value)
+void SMHooks::afterCycle(unsigned long cycleNum)
 {
-    if (_sm->getVarFloat(varName) != value)
-        _sm->setVar(varName, value, false);
+#if NC_FEATURE_PERSISTENCE
+    if (cycleNum == 1 && _persistentStorage)
+        _persistentStorage->saveOnFirstCycle();
+#endif
+
+#if NC_FEATURE_SYNC_OUT
+    if (!_postPath)
+        return;
+
+    _sweep(cycleNum);
+
+    // urgent variables go first, in their own small request. A batch the hub did not take
+    // is resent once per cycle and newer urgent values wait behind it
+    bool linkUp = _pending ? _resend() : _post(PR_HIGH, _congested ? 1 : 1 + NC_HIGH_PRIORITY_RETRY);
+
+    uint8_t lanes = PR_NORMAL;
+    unsigned long ms = millis();
+    if (diff(_lowLaneSent, ms) >= NC_LOW_PRIORITY_PERIOD)
+    {
+        if (!_congested)
+        {
+            lanes |= PR_LOW;
+            _lowLaneSent = ms;
+        }
+        else if (diff(_lowLaneSent, ms) >= NC_LOW_PRIORITY_MAX_DEFER)
+        {
+            _drop(PR_LOW);
+            _lowLaneSent = ms;
+            // give the link another chance, next low batch probes it
+            _congested = false;
+        }
+    }
+
+    // a failed urgent post has waited for the hub in this cycle already
+    if (linkUp)
+        _post(lanes, 1);
+#endif
 }
 
-void SMHooks::setVar(const char *varName, long int value)
+#if NC_FEATURE_SYNC_OUT
+/**
+ * Encode and post collected variables of given priority lanes,
+ * urgent batch the hub did not take is kept for _resend
+ * @param attempts number of tries if post fails
+ * @returns false if hub did not take the batch
+ */
+bool SMHooks::_post(uint8_t lanes, uint8_t attempts)
 {
-    if (_sm->getVarInt(varName) != value)
-        _sm->setVar(varName, value, false);
+    size_t jsonSize = _collectedSize(lanes);
+    if (!jsonSize)
+        return true;
+
+    NC_PERF_START(encodeStart);
+
+    DynamicJsonDocument output(jsonSize);
+    __nc_mem.transient(jsonSize);
+    emit(&output, lanes);
+
+    size_t size = measureMsgPack(output);
+    uint8_t buffer[size + 1];
+    // size + 1 because serializeMsgPack sometimes eats last byte
+    serializeMsgPack(output, (char *)buffer, size + 1);
+
+    NC_PERF_END(encode, encodeStart);
+
+    bool sent = _send(buffer, size, attempts, lanes);
+    if (!sent && (lanes & PR_HIGH))
+        _keep(buffer, size);
+
+    return sent;
 }
 
-void SMHooks::afterCycle(unsigned long cycleNum)
+/**
+ * Post encoded batch, or hand it over to the network task or the host
+ * @returns false if hub did not take it, batches handed over are never kept
+ */
+bool SMHooks::_send(const uint8_t *buffer, size_t size, uint8_t attempts, uint8_t lanes)
 {
-    if (cycleNum == 1)
-        _persistentStorage->saveOnFirstCycle();
+#if NC_FEATURE_THREADED
+    if (_network && _network->isRunning())
+    {
+        // posted (and retried) by the network task, its last result steers the low lane
+        bool queued = _network->post(_postPath, buffer, size, attempts);
+        if (!queued)
+            NC_LOG_WARN(F("Network queue full, batch dropped"), nullptr, (unsigned long)size);
+
+        _congested = !queued || _network->congested();
+
+        return true;
+    }
+#endif
 
-    size_t jsonSize = _collectedSize();
+#if NC_FEATURE_NODE_HOST
+    if (_mux)
+    {
+        // posted by the host together with batches of its other nodes
+        bool accepted = _mux->add(_nodeId, _postPath, buffer, size, (lanes & PR_HIGH) != 0);
+        _congested = !accepted || _mux->congested();
+
+        return true;
+    }
+#endif
+
+    bool success = false;
+    for (uint8_t i = 0; i < attempts && !success; i++)
+    {
+        unsigned long start = millis();
+        // batch that is not urgent can wait for a probe of a standby hub
+        int httpCode = _hub->postMsgPack(_postPath, buffer, size, !(lanes & PR_HIGH));
+
+        success = httpCode >= 200 && httpCode < 300;
+        _congested = !success || diff(start, millis()) > NC_CONGESTION_LATENCY;
+    }
+
+    return success;
+}
 
-    if (jsonSize)
+/**
+ * Keep urgent batch the hub did not take, until it does or it gets NC_HIGH_PRIORITY_MAX_AGE old
+ */
+void SMHooks::_keep(const uint8_t *buffer, size_t size)
+{
+    _pending = (uint8_t *)__nc_mem.alloc(MEM_SYNC_OUT, size);
+    if (!_pending)
     {
-        DynamicJsonDocument output(jsonSize);
-        emit(&output);
+        NC_LOG_WARN(F("Urgent batch dropped"), nullptr, (unsigned long)size);
+        return;
+    }
 
-        size_t size = measureMsgPack(output);
-        uint8_t buffer[size + 1];
-        // size + 1 because serializeMsgPack sometimes eats last byte
-        serializeMsgPack(output, (char *)buffer, size + 1);
+    memcpy(_pending, buffer, size);
+    _pendingSize = size;
+    _pendingSince = millis();
+}
 
-        _hub->postMsgPack(_postUrl, buffer, size);
+/**
+ * One more try of the kept urgent batch, stale one is dropped and newer values posted instead
+ * @returns false if hub did not take it
+ */
+bool SMHooks::_resend()
+{
+    if (diff(_pendingSince, millis()) > NC_HIGH_PRIORITY_MAX_AGE)
+    {
+        NC_LOG_WARN(F("Urgent batch too old, dropped"), nullptr, (unsigned long)_pendingSize);
+        _freePending();
+        return _post(PR_HIGH, 1);
     }
+
+    bool sent = _send(_pending, _pendingSize, 1, PR_HIGH);
+    if (sent)
+        _freePending();
+
+    return sent;
 }
 
-void SMHooks::emit(DynamicJsonDocument *output)
+void SMHooks::_freePending()
 {
-    Serial << F("Emitting\n");
+    if (!_pending)
+        return;
 
-    for (auto const &item : _registry)
+    __nc_mem.free(MEM_SYNC_OUT, _pending, _pendingSize);
+    _pending = nullptr;
+    _pendingSize = 0;
+}
+
+/**
+ * Discard collected values of given lanes
+ */
+void SMHooks::_drop(uint8_t lanes)
+{
+    for (uint16_t i = 0; i < _state.count; i++)
     {
-        const char *name = item.first;
-        SyncOutElementConfig *options = item.second;
-        if (options->canEmit)
-        {
-            options->canEmit = false;
-            if (options->accumulator.type == VAR_TYPE_FLOAT)
-                (*output)[name] = options->accumulator.vFloat;
-            else
-                (*output)[name] = options->accumulator.vInt;
+        SyncOutElementConfig *config = &_configs[i];
+        if (!(_state.flags[i] & SYNC_OUT_CAN_EMIT) || !(config->priority & lanes))
+            continue;
 
-            Serial << options->name << " = " << options->accumulator.vInt << "\n";
+        _state.flags[i] &= ~SYNC_OUT_CAN_EMIT;
+        if (config->syncType == T_PREPROCESS)
+        {
+            _state.updateCounter[i] = 0;
+            _resetQuantiles(i);
         }
+
+        NC_PERF_ADD(syncDropped, 1);
+        NC_LOG_DEBUG(F("Dropped"), config->name);
     }
 }
 
-size_t SMHooks::_collectedSize()
+void SMHooks::emit(DynamicJsonDocument *output, uint8_t lanes)
 {
-    uint16_t count = _collectedCount();
-    return count ? JSON_OBJECT_SIZE(count) : 0;
+    NC_LOG_DEBUG(F("Emitting"));
+
+    JsonArray batch = _compact ? output->to<JsonArray>() : JsonArray();
+    if (_compact)
+        batch.add(_schemaVersion);
+
+    for (uint16_t i = 0; i < _state.count; i++)
+    {
+        SyncOutElementConfig *config = &_configs[i];
+        if (!(_state.flags[i] & SYNC_OUT_CAN_EMIT) || !(config->priority & lanes))
+            continue;
+
+        _state.flags[i] &= ~SYNC_OUT_CAN_EMIT;
+
+        JsonVariant target = _compact ? _compactSlot(batch, config->id) : output->getOrAddMember(config->name);
+
+        if (config->syncType != T_PREPROCESS)
+        {
+            _emitValue(target, config->name, &_state.accumulator[i]);
+            continue;
+        }
+
+        // single aggregate is emitted as plain value, several as an array in flag order,
+        // wall clock frames are prefixed by frame start
+        if (!_tupleSize(config))
+        {
+            VarStruct value = _aggregate(i, config->preprocessing);
+            _emitValue(target, config->name, &value);
+        }
+        else
+        {
+            JsonArray values = target.to<JsonArray>();
+            if (config->frameType == F_WALL_CLOCK)
+                values.add((long int)_state.lastEmit[i]);
+
+            for (uint16_t aggregate = P_FIRST; aggregate <= P_LAST_AGGREGATE; aggregate <<= 1)
+            {
+                if (!(config->preprocessing & aggregate))
+                    continue;
+                VarStruct value = _aggregate(i, aggregate);
+                _emitValue(values.add(), config->name, &value);
+            }
+        }
+
+        // frame is over, next value opens a new one
+        _state.updateCounter[i] = 0;
+        _resetQuantiles(i);
+    }
 }
 
-uint16_t SMHooks::_collectedCount()
+size_t SMHooks::_collectedSize(uint8_t lanes)
 {
     uint16_t count = 0;
+    size_t arrays = 0;
 
-    for (auto const &item : _registry)
+    for (uint16_t i = 0; i < _state.count; i++)
     {
-        const char *name = item.first;
+        if (!(_state.flags[i] & SYNC_OUT_CAN_EMIT) || !(_configs[i].priority & lanes))
+            continue;
 
-        SyncOutElementConfig *options = item.second;
-        if (options->canEmit)
-            count++;
+        count++;
+        uint8_t tupleSize = _tupleSize(&_configs[i]);
+        if (tupleSize)
+            arrays += JSON_ARRAY_SIZE(tupleSize);
     }
-    return count;
+
+    if (!count)
+        return 0;
+
+    // compact: [version, id, value, ...]
+    return (_compact ? JSON_ARRAY_SIZE(1 + 2 * count) : JSON_OBJECT_SIZE(count)) + arrays;
 }
 
-void SMHooks::_collect(SyncOutElementConfig *options, VarStruct *value)
+/**
+ * Number of values emitted as array for the variable, 0 for a plain value
+ */
+uint8_t SMHooks::_tupleSize(SyncOutElementConfig *config)
 {
-    options->accumulator = *value;
-    _collect(options);
+    if (config->syncType != T_PREPROCESS)
+        return 0;
+
+    uint8_t size = config->aggregateCount();
+    if (config->frameType == F_WALL_CLOCK)
+        return size + 1;
+
+    return size > 1 ? size : 0;
 }
 
-void SMHooks::_collect(SyncOutElementConfig *options)
+/**
+ * Append id and return slot for the value (compact payload)
+ */
+JsonVariant SMHooks::_compactSlot(JsonArray batch, uint16_t id)
 {
-    options->canEmit = true;
+    batch.add(id);
+    return batch.add();
 }
 
-void SMHooks::_onChange(SyncOutElementConfig *options, VarStruct *value)
+void SMHooks::_emitValue(JsonVariant target, const char *name, VarStruct *value)
 {
-    if (options->updateCounter)
+    if (value->type == VAR_TYPE_FLOAT)
     {
-        if (value->type == VAR_TYPE_FLOAT)
-        {
-            if (abs(value->vFloat - options->accumulator.vFloat) >= options->threshold)
-            {
-                _collect(options, value);
-                options->accumulator = *value;
-            }
-        }
-        else
-        {
-            if ((float)abs(value->vInt - options->accumulator.vInt) >= options->threshold)
-            {
-                _collect(options, value);
-                options->accumulator = *value;
-            }
-        }
+        target.set(value->vFloat);
+        NC_LOG_DEBUG(F("Emit"), name, value->vFloat);
     }
     else
     {
-        _collect(options, value);
-        options->updateCounter++;
+        target.set(value->vInt);
+        NC_LOG_DEBUG(F("Emit"), name, value->vInt);
     }
 }
 
-void SMHooks::_preprocess(SyncOutElementConfig *options, VarStruct *value)
+void SMHooks::_collect(uint16_t index, VarStruct *value)
 {
-    if (options->frameType == F_CYCLE_NUM)
+    _state.accumulator[index] = *value;
+    _collect(index);
+}
+
+void SMHooks::_collect(uint16_t index)
+{
+    _state.flags[index] |= SYNC_OUT_CAN_EMIT;
+}
+
+void SMHooks::_onChange(uint16_t index, VarStruct *value)
+{
+    SyncOutElementConfig *config = &_configs[index];
+    VarStruct *accumulator = &_state.accumulator[index];
+    uint8_t *flags = &_state.flags[index];
+    unsigned long ms = millis();
+
+    if (!_state.updateCounter[index])
+    {
+        _collect(index, value);
+        _state.updateCounter[index]++;
+        _state.lastEmit[index] = ms;
+        return;
+    }
+
+    // already waiting for rate limit, send the latest value then
+    if (*flags & SYNC_OUT_PENDING)
     {
-        _preprocessCycle(options, value, _sm->cycleNum);
+        *accumulator = *value;
+        return;
     }
-    else if (options->frameType == F_DURATION)
+
+    float delta = value->type != VAR_TYPE_FLOAT && accumulator->type != VAR_TYPE_FLOAT
+                      ? (float)(value->vInt - accumulator->vInt)
+                      : _asFloat(value) - _asFloat(accumulator);
+
+    uint8_t direction = delta > 0.0f ? SYNC_OUT_RISING : delta < 0.0f ? SYNC_OUT_FALLING : 0;
+
+    // turning back has to cross hysteresis band as well, so noise around threshold is not sent
+    float threshold = config->threshold;
+    if (direction && (*flags & (SYNC_OUT_RISING | SYNC_OUT_FALLING)) && !(*flags & direction))
+        threshold += config->hysteresis;
+
+    if (abs(delta) < threshold)
+        return;
+
+    if (direction)
+        *flags = (*flags & ~(SYNC_OUT_RISING | SYNC_OUT_FALLING)) | direction;
+
+    if (config->minInterval && diff(_state.lastEmit[index], ms) < config->minInterval)
     {
-        _preprocessCycle(options, value, millis());
+        *accumulator = *value;
+        *flags |= SYNC_OUT_PENDING;
+        return;
     }
+
+    _collect(index, value);
+    _state.lastEmit[index] = ms;
 }
 
-void SMHooks::_preprocessCycle(SyncOutElementConfig *options, VarStruct *value, unsigned long cycle)
+/**
+ * Send rate limited value once min interval elapsed,
+ * or re-send the last one if nothing was sent for max interval (heartbeat)
+ */
+void SMHooks::_onChangeTimers(uint16_t index, unsigned long ms)
 {
-    if (options->frameNum++ == 0)
+    SyncOutElementConfig *config = &_configs[index];
+    uint8_t *flags = &_state.flags[index];
+    unsigned long elapsed = diff(_state.lastEmit[index], ms);
+
+    if (*flags & SYNC_OUT_PENDING)
+    {
+        if (elapsed < config->minInterval)
+            return;
+        *flags &= ~SYNC_OUT_PENDING;
+    }
+    else if (!config->maxInterval || elapsed < config->maxInterval)
     {
-        options->lastEmit = cycle;
-        options->updateCounter == 0;
-        _accumulate(options, value, false);
         return;
     }
-    if (diff(options->lastEmit, cycle) >= options->frameLength)
+
+    _collect(index);
+    _state.lastEmit[index] = ms;
+}
+
+/**
+ * Accumulate value into the current frame.
+ * Frame is opened by its first value and closed by `_sweep`.
+ */
+void SMHooks::_preprocess(uint16_t index, VarStruct *value)
+{
+    SyncOutElementConfig *config = &_configs[index];
+    uint8_t *flags = &_state.flags[index];
+
+    if (config->frameType == F_WALL_CLOCK)
     {
-        _accumulate(options, value, true);
-        _collect(options);
-        options->lastEmit = cycle;
-        options->updateCounter == 0;
+        // without synced clock frames can't be aligned, drop samples
+#if NC_FEATURE_TIME_FUNCTIONS
+        if (!__nc_time.isSet())
+#else
+        if (timeStatus() == timeNotSet)
+#endif
+            return;
+
+        // frame is identified by its start, closed by `_sweep` once time passes the end
+        if (!_state.updateCounter[index])
+        {
+            _state.lastEmit[index] = _wallClockFrame(config->frameLength);
+            *flags |= SYNC_OUT_FRAME_STARTED;
+        }
+
+        _accumulate(index, value);
+        return;
     }
+
+    unsigned long now;
+    if (config->frameType == F_CYCLE_NUM)
+        now = _sm->cycleNum;
+    else if (config->frameType == F_DURATION)
+        now = millis();
     else
+        return;
+
+    // Start a new frame on the very first value, or when previous frame
+    // has ended without any values. Otherwise frames follow each other.
+    if (!(*flags & SYNC_OUT_FRAME_STARTED) ||
+        (!_state.updateCounter[index] && diff(_state.lastEmit[index], now) >= config->frameLength))
     {
-        _accumulate(options, value, false);
+        _state.lastEmit[index] = now;
+        *flags |= SYNC_OUT_FRAME_STARTED;
     }
+
+    _accumulate(index, value);
 }
 
-void SMHooks::_accumulate(SyncOutElementConfig *options, VarStruct *value, bool finalize)
+/**
+ * Single pass over all variables, closing elapsed frames
+ * and running on change rate limit and heartbeat timers
+ */
+void SMHooks::_sweep(unsigned long cycleNum)
 {
-    switch (options->preprocessing)
+    unsigned long ms = millis();
+
+    for (uint16_t i = 0; i < _state.count; i++)
     {
-    case P_FIRST:
-        if (options->updateCounter == 0)
-            options->accumulator = *value;
-        break;
+        if (!_state.updateCounter[i])
+            continue;
 
-    case P_LAST:
-        options->accumulator = *value;
-        break;
+        SyncOutElementConfig *config = &_configs[i];
+        if (config->syncType == T_ON_CHANGE)
+        {
+            _onChangeTimers(i, ms);
+            continue;
+        }
 
-    case P_AVERAGE:
-        if (options->updateCounter == 0)
+        if (config->syncType != T_PREPROCESS)
+            continue;
+
+        if (config->frameType == F_WALL_CLOCK)
         {
-            options->accumulator = *value;
-            break;
+            // start of the frame stays in `lastEmit` until emitted,
+            // also closes the frame when clock is stepped back
+            if (_wallClockFrame(config->frameLength) != _state.lastEmit[i])
+                _collect(i);
+            continue;
         }
-        options->accumulator.vFloat += value->vFloat;
-        if (finalize)
+
+        unsigned long now = config->frameType == F_CYCLE_NUM ? cycleNum : ms;
+        if (diff(_state.lastEmit[i], now) < config->frameLength)
+            continue;
+
+        // aggregates are computed from frame state when emitted
+        _collect(i);
+        _state.lastEmit[i] = now;
+    }
+}
+
+/**
+ * Start (unix time) of the wall clock frame current time belongs to.
+ * Hub synced clock is slewed, so frames never go back in time.
+ */
+unsigned long SMHooks::_wallClockFrame(unsigned long length)
+{
+#if NC_FEATURE_TIME_FUNCTIONS
+    unsigned long time = __nc_time.now();
+#else
+    unsigned long time = now();
+#endif
+    return time - time % length;
+}
+
+/**
+ * Update all aggregates of the variable with one value.
+ * Min, max and sum run in integer arithmetic while the frame holds only integers,
+ * first float value promotes the frame to float.
+ */
+void SMHooks::_accumulate(uint16_t index, VarStruct *value)
+{
+    uint16_t preprocessing = _configs[index].preprocessing;
+    unsigned long counter = _state.updateCounter[index];
+    uint8_t *flags = &_state.flags[index];
+    bool isFloat = value->type == VAR_TYPE_FLOAT;
+
+    if (counter == 0)
+    {
+        if (isFloat)
+            *flags |= SYNC_OUT_FRAME_FLOAT;
+        else
+            *flags &= ~SYNC_OUT_FRAME_FLOAT;
+
+        _startFrame(index, preprocessing, value);
+    }
+    else
+    {
+        if (isFloat && !(*flags & SYNC_OUT_FRAME_FLOAT))
         {
-            options->accumulator.vFloat = options->accumulator.vFloat / (float)options->updateCounter;
-            options->accumulator.vInt = round(options->accumulator.vFloat);
+            _promoteFrame(index, preprocessing);
+            *flags |= SYNC_OUT_FRAME_FLOAT;
         }
-        break;
 
-    case P_MIN:
-        if (options->updateCounter == 0)
+        if (*flags & SYNC_OUT_FRAME_FLOAT)
+            _accumulateFloat(index, preprocessing, _asFloat(value));
+        else
+            _accumulateInt(index, preprocessing, value->vInt);
+    }
+
+    _state.accumulator[index] = *value;
+
+    if (preprocessing & (P_NEEDS_WELFORD | P_NEEDS_QUANTILE))
+    {
+        float x = _asFloat(value);
+
+        if (preprocessing & P_NEEDS_WELFORD)
         {
-            options->accumulator = *value;
-            break;
+            // Welford's online algorithm, numerically stable in a single pass
+            if (counter == 0)
+            {
+                _state.mean[index] = x;
+                _state.m2[index] = 0.0f;
+            }
+            else
+            {
+                float delta = x - _state.mean[index];
+                _state.mean[index] += delta / (float)(counter + 1);
+                _state.m2[index] += delta * (x - _state.mean[index]);
+            }
         }
-        if (options->accumulator.vFloat > value->vFloat)
-            options->accumulator.vFloat = value->vFloat;
-        break;
 
-    case P_MAX:
-        if (options->updateCounter == 0)
+        if (preprocessing & P_NEEDS_QUANTILE)
         {
-            options->accumulator = *value;
-            break;
+            uint16_t slot = _state.quantileSlot[index];
+            _state.quantiles[slot].add(x);
+            if ((preprocessing & P_NEEDS_QUANTILE) == P_NEEDS_QUANTILE)
+                _state.quantiles[slot + 1].add(x);
         }
-        if (options->accumulator.vFloat < value->vFloat)
-            options->accumulator.vFloat = value->vFloat;
-        break;
     }
 
-    if (finalize)
-        options->updateCounter = 0;
-    else
-        options->updateCounter++;
+    _state.updateCounter[index] = counter + 1;
+}
+
+void SMHooks::_startFrame(uint16_t index, uint16_t preprocessing, VarStruct *value)
+{
+    if (preprocessing & P_FIRST)
+        _state.first[index] = *value;
+
+    bool isFloat = value->type == VAR_TYPE_FLOAT;
+
+    if (preprocessing & P_MIN)
+    {
+        if (isFloat)
+            _state.minimum[index].vFloat = value->vFloat;
+        else
+            _state.minimum[index].vInt = value->vInt;
+    }
+
+    if (preprocessing & P_MAX)
+    {
+        if (isFloat)
+            _state.maximum[index].vFloat = value->vFloat;
+        else
+            _state.maximum[index].vInt = value->vInt;
+    }
+
+    if (preprocessing & P_NEEDS_SUM)
+    {
+        if (isFloat)
+            _state.sum[index].vFloat = value->vFloat;
+        else
+            _state.sum[index].vInt = value->vInt;
+    }
+}
+
+void SMHooks::_promoteFrame(uint16_t index, uint16_t preprocessing)
+{
+    if (preprocessing & P_MIN)
+        _state.minimum[index].vFloat = (float)_state.minimum[index].vInt;
+    if (preprocessing & P_MAX)
+        _state.maximum[index].vFloat = (float)_state.maximum[index].vInt;
+    if (preprocessing & P_NEEDS_SUM)
+        _state.sum[index].vFloat = (float)_state.sum[index].vInt;
+}
+
+void SMHooks::_accumulateInt(uint16_t index, uint16_t preprocessing, long x)
+{
+    if ((preprocessing & P_MIN) && x < _state.minimum[index].vInt)
+        _state.minimum[index].vInt = x;
+    if ((preprocessing & P_MAX) && x > _state.maximum[index].vInt)
+        _state.maximum[index].vInt = x;
+    if (preprocessing & P_NEEDS_SUM)
+        _state.sum[index].vInt += x;
+}
+
+void SMHooks::_accumulateFloat(uint16_t index, uint16_t preprocessing, float x)
+{
+    if ((preprocessing & P_MIN) && x < _state.minimum[index].vFloat)
+        _state.minimum[index].vFloat = x;
+    if ((preprocessing & P_MAX) && x > _state.maximum[index].vFloat)
+        _state.maximum[index].vFloat = x;
+    if (preprocessing & P_NEEDS_SUM)
+        _state.sum[index].vFloat += x;
 }
+
+/**
+ * Compute one aggregate of the current frame
+ */
+VarStruct SMHooks::_aggregate(uint16_t index, uint16_t aggregate)
+{
+    unsigned long counter = _state.updateCounter[index];
+    bool isFloat = _state.flags[index] & SYNC_OUT_FRAME_FLOAT;
+
+    switch (aggregate)
+    {
+    case P_FIRST:
+        return VarStruct(&_state.first[index]);
+
+    case P_LAST:
+        return VarStruct(&_state.accumulator[index]);
+
+    case P_AVERAGE:
+        if (isFloat)
+            return VarStruct(_state.sum[index].vFloat / (float)counter);
+        return VarStruct((float)((double)_state.sum[index].vInt / (double)counter));
+
+    case P_MIN:
+        return isFloat ? VarStruct(_state.minimum[index].vFloat) : VarStruct(_state.minimum[index].vInt);
+
+    case P_MAX:
+        return isFloat ? VarStruct(_state.maximum[index].vFloat) : VarStruct(_state.maximum[index].vInt);
+
+    case P_COUNT:
+        return VarStruct((long int)counter);
+
+    case P_SUM:
+    {
+        if (isFloat)
+            return VarStruct(_state.sum[index].vFloat);
+        // integer sum may outgrow long on long frames
+        long long sum = _state.sum[index].vInt;
+        if (sum >= LONG_MIN && sum <= LONG_MAX)
+            return VarStruct((long int)sum);
+        return VarStruct((float)sum);
+    }
+
+    case P_VARIANCE:
+        // sample variance
+        return VarStruct(counter > 1 ? _state.m2[index] / (float)(counter - 1) : 0.0f);
+
+    case P_STDDEV:
+        return VarStruct(counter > 1 ? sqrtf(_state.m2[index] / (float)(counter - 1)) : 0.0f);
+
+    case P_QUANTILE:
+        return VarStruct(_state.quantiles[_state.quantileSlot[index]].value());
+
+    case P_MEDIAN:
+    {
+        // median follows quantile estimator, if both are requested
+        uint16_t slot = _state.quantileSlot[index] + (_configs[index].preprocessing & P_QUANTILE ? 1 : 0);
+        return VarStruct(_state.quantiles[slot].value());
+    }
+    }
+
+    return VarStruct(0.0f);
+}
+
+void SMHooks::_resetQuantiles(uint16_t index)
+{
+    SyncOutElementConfig *config = &_configs[index];
+    if (!config->quantileCount())
+        return;
+
+    QuantileEstimator *estimator = &_state.quantiles[_state.quantileSlot[index]];
+    if (config->preprocessing & P_QUANTILE)
+        (estimator++)->reset(config->quantile);
+    if (config->preprocessing & P_MEDIAN)
+        estimator->reset(0.5f);
+}
+
+float SMHooks::_asFloat(VarStruct *value)
+{
+    return value->type == VAR_TYPE_FLOAT ? value->vFloat : (float)value->vInt;
+}
+#endif
+
+#endif
@@ -6,42 +6,113 @@
 #include <ArduinoJson.h>
 #include <StateMachine.h>
 
+#include "../NodeConnectorConfig.h"
 #include "../SyncOutElementConfig/SyncOutElementConfig.h"
+#include "../SyncOutState/SyncOutState.h"
 #include "../Utils/Utils.h"
 #include "../HubClient/HubClient.h"
 #include "../PersistentStorage/PersistentStorage.h"
+#include "../NetworkTask/NetworkTask.h"
+#include "../BatchMux/BatchMux.h"
+#include "../PerfCounters/PerfCounters.h"
+#include "../MemoryTracker/MemoryTracker.h"
+#include "../DefinitionArena/DefinitionArena.h"
+
+typedef std::map<const char *, uint16_t, KeyCompare,
+                 ArenaAllocator<std::pair<const char *const, uint16_t>>>
+    SyncOutRegistry;
 
 class SMHooks : public Hooks
 {
 public:
-    void init(HubClient *, PersistentStorage *, const char *, StateMachineController *, JsonVariant);
-    void emit(DynamicJsonDocument *output);
+    SMHooks(DefinitionArena *);
+
+    void init(StateMachineController *);
+    void reset();
+#if NC_FEATURE_SYNC_OUT
+    bool initSyncOut(HubClient *, const char *, JsonVariant, unsigned long schemaVersion = 0);
+    void emit(DynamicJsonDocument *output, uint8_t lanes = PR_ALL);
+
+    static size_t arenaSize(JsonVariant);
+#endif
+#if NC_FEATURE_PERSISTENCE
+    void initPersistence(PersistentStorage *);
+#endif
+#if NC_FEATURE_THREADED && NC_FEATURE_SYNC_OUT
+    void initNetwork(NetworkTask *);
+#endif
+#if NC_FEATURE_NODE_HOST && NC_FEATURE_SYNC_OUT
+    void initMux(BatchMux *, const char *);
+#endif
 
     void onVarUpdate(const char *, VarStruct *);
     void afterCycle(unsigned long);
 
-    void setVar(const char *, float);
-    void setVar(const char *, long int);
-
 private:
+    StateMachineController *_sm = nullptr;
+    DefinitionArena *_arena;
+
+#if NC_FEATURE_PERSISTENCE
+    PersistentStorage *_persistentStorage = nullptr;
+#endif
+
+#if NC_FEATURE_SYNC_OUT
     JsonVariant _options;
-    StateMachineController *_sm;
-    HubClient *_hub;
-    PersistentStorage *_persistentStorage;
-    const char *_postUrl;
+    HubClient *_hub = nullptr;
+    const char *_postPath = nullptr;
+    bool _compact = false;
+    unsigned long _schemaVersion = 0;
+#if NC_FEATURE_THREADED
+    NetworkTask *_network = nullptr;
+#endif
+#if NC_FEATURE_NODE_HOST
+    BatchMux *_mux = nullptr;
+    const char *_nodeId = nullptr;
+#endif
+
+    // variable name -> index in _configs and _state
+    SyncOutRegistry _registry;
+    SyncOutElementConfig *_configs = nullptr;
+    SyncOutState _state;
+
+    // priority lanes
+    bool _congested = false;
+    unsigned long _lowLaneSent = 0;
+
+    // urgent batch the hub did not take, resent once per cycle
+    uint8_t *_pending = nullptr;
+    size_t _pendingSize = 0;
+    unsigned long _pendingSince = 0;
 
-    std::map<const char *, SyncOutElementConfig *, KeyCompare> _registry;
+    bool _post(uint8_t, uint8_t);
+    bool _send(const uint8_t *, size_t, uint8_t, uint8_t);
+    void _keep(const uint8_t *, size_t);
+    bool _resend();
+    void _freePending();
+    void _drop(uint8_t);
+    size_t _collectedSize(uint8_t);
+    uint8_t _tupleSize(SyncOutElementConfig *);
+    void _emitValue(JsonVariant, const char *, VarStruct *);
+    JsonVariant _compactSlot(JsonArray, uint16_t);
 
-    uint16_t _collectedCount();
-    size_t _collectedSize();
+    void _onChange(uint16_t, VarStruct *);
+    void _onChangeTimers(uint16_t, unsigned long);
+    void _preprocess(uint16_t, VarStruct *);
+    void _sweep(unsigned long);
+    unsigned long _wallClockFrame(unsigned long);
 
-    void _onChange(SyncOutElementConfig *, VarStruct *);
-    void _preprocess(SyncOutElementConfig *, VarStruct *);
-    void _preprocessCycle(SyncOutElementConfig *, VarStruct *, unsigned long);
-    void _accumulate(SyncOutElementConfig *, VarStruct *, bool);
+    void _accumulate(uint16_t, VarStruct *);
+    void _startFrame(uint16_t, uint16_t, VarStruct *);
+    void _promoteFrame(uint16_t, uint16_t);
+    void _accumulateInt(uint16_t, uint16_t, long);
+    void _accumulateFloat(uint16_t, uint16_t, float);
+    VarStruct _aggregate(uint16_t, uint16_t);
+    void _resetQuantiles(uint16_t);
+    float _asFloat(VarStruct *);
 
-    void _collect(SyncOutElementConfig *);
-    void _collect(SyncOutElementConfig *, VarStruct *);
+    void _collect(uint16_t);
+    void _collect(uint16_t, VarStruct *);
+#endif
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,107 @@
+#include "../Log/Log.h"
+#include "../PerfCounters/PerfCounters.h"
+#include "SampleRing.h"
+
+#if NC_FEATURE_SAMPLES
+
+/**
+ * Register variable for sample ingestion, call before producers start
+ * IMPORTANT: name is not copied, string must outlive the connector
+ * @returns handle, or -1 if all NC_SAMPLE_HANDLES are taken
+ */
+SampleHandle SampleRing::handle(const char *name)
+{
+    for (uint8_t i = 0; i < _count; i++)
+        if (!strcmp(_names[i], name))
+            return i;
+
+    if (_count >= NC_SAMPLE_HANDLES)
+    {
+        NC_LOG_ERROR(F("No free sample handle"), name);
+        return -1;
+    }
+
+    _names[_count] = name;
+    return _count++;
+}
+
+/**
+ * Safe to call from ISR or another task (one producer per handle)
+ * @returns false if handle is not registered or its ring is full
+ */
+bool IRAM_ATTR SampleRing::push(SampleHandle handle, long value)
+{
+    if (handle < 0 || handle >= _count)
+        return false;
+
+    Sample sample;
+    sample.isFloat = false;
+    sample.vInt = value;
+    return _rings[handle].push(sample);
+}
+
+bool IRAM_ATTR SampleRing::push(SampleHandle handle, float value)
+{
+    if (handle < 0 || handle >= _count)
+        return false;
+
+    Sample sample;
+    sample.isFloat = true;
+    sample.vFloat = value;
+    return _rings[handle].push(sample);
+}
+
+/**
+ * Set all pending samples to their variables, in order of arrival per variable.
+ * Samples pushed while draining wait for the next cycle.
+ * @returns number of samples applied
+ */
+uint16_t SampleRing::drain(StateMachineController *sm)
+{
+    uint16_t applied = 0;
+
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        Sample sample;
+        for (uint16_t n = _rings[i].size(); n && _rings[i].pop(&sample); n--)
+        {
+            if (sample.isFloat)
+                sm->setVar(_names[i], sample.vFloat, true);
+            else
+                sm->setVar(_names[i], sample.vInt, true);
+            applied++;
+        }
+    }
+
+    unsigned long total = overflows();
+    if (total != _reported)
+    {
+        NC_LOG_WARN(F("Samples dropped"), nullptr, total - _reported);
+        NC_PERF_ADD(samplesDropped, total - _reported);
+        _reported = total;
+    }
+
+    return applied;
+}
+
+/**
+ * Samples dropped on full rings since start
+ */
+unsigned long SampleRing::overflows()
+{
+    unsigned long total = 0;
+    for (uint8_t i = 0; i < _count; i++)
+        total += _rings[i].overflows();
+
+    return total;
+}
+
+unsigned long SampleRing::overflows(SampleHandle handle)
+{
+    if (handle < 0 || handle >= _count)
+        return 0;
+
+    return _rings[handle].overflows();
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef samplering_h
+#define samplering_h
+
+#include <Arduino.h>
+#include <StateMachine.h>
+
+#include "../NodeConnectorConfig.h"
+#include "../SpscQueue/SpscQueue.h"
+
+#if NC_FEATURE_SAMPLES
+
+/*
+ * Sample ingestion from interrupts and other tasks.
+ *
+ * Variable is registered once in `setup` and gets a small handle. ISRs (flow meters,
+ * counters, ADC DMA completion) or other tasks push samples by handle, lock-free and
+ * without allocations. Loop drains all pending samples right before each `sm.cycle()`,
+ * setting variables as usual, so sync out (incl. aggregation) and persistence see every sample.
+ *
+ * Each handle has its own single producer / single consumer ring:
+ * one variable must be fed by one ISR or one task. Full ring drops the new sample
+ * and counts an overflow (also published as `@nc.samples.dropped`).
+ *
+ * Usage:
+ *   SampleHandle flow = connector.samples.handle("flow");   // setup
+ *   connector.samples.push(flow, 1L);                        // IRAM_ATTR isr
+ */
+
+typedef int8_t SampleHandle;
+
+typedef struct Sample
+{
+    bool isFloat;
+    union
+    {
+        long vInt;
+        float vFloat;
+    };
+} Sample;
+
+class SampleRing
+{
+public:
+    SampleHandle handle(const char *);
+
+    bool push(SampleHandle, long);
+    bool push(SampleHandle, float);
+
+    uint16_t drain(StateMachineController *);
+
+    unsigned long overflows();
+    unsigned long overflows(SampleHandle);
+
+private:
+    const char *_names[NC_SAMPLE_HANDLES];
+    uint8_t _count = 0;
+    unsigned long _reported = 0;
+
+    SpscQueue<Sample, NC_SAMPLE_RING_SIZE> _rings[NC_SAMPLE_HANDLES];
+};
+
+#endif
+#endif
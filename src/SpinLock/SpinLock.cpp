@@ -0,0 +1,15 @@
+#include "SpinLock.h"
+
+#if NC_FEATURE_THREADED
+
+void SpinLock::lock()
+{
+    portENTER_CRITICAL(&_mux);
+}
+
+void SpinLock::unlock()
+{
+    portEXIT_CRITICAL(&_mux);
+}
+
+#endif
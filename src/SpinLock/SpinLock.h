@@ -0,0 +1,26 @@
+#ifndef spinlock_h
+#define spinlock_h
+
+#include <Arduino.h>
+
+#include "../NodeConnectorConfig.h"
+
+/*
+ * Short critical section shared by state machine loop and network task
+ * (see NC_FEATURE_THREADED). Hold it for a few instructions only.
+ *
+ * FreeRTOS spinlock, also masks interrupts on the current core.
+ */
+class SpinLock
+{
+public:
+    void lock();
+    void unlock();
+
+private:
+#if NC_FEATURE_THREADED
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+#endif
+};
+
+#endif
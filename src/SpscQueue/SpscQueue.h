@@ -0,0 +1,83 @@
+#ifndef spscqueue_h
+#define spscqueue_h
+
+#include <atomic>
+#include <stdint.h>
+
+/*
+ * Lock-free bounded queue for exactly one producer and one consumer
+ * (eg. state machine loop and network task, ISR and loop).
+ *
+ * Producer owns `_head`, consumer owns `_tail`. Item is copied in before head is published
+ * (release) and copied out only after head is observed (acquire), so no locks are needed.
+ * Neither side ever waits: push fails when the queue is full and counts an overflow.
+ *
+ * N must be a power of 2, at most 32768 (indexes are free running 16 bit counters).
+ * `push` is forced inline, so it lands in IRAM together with the calling ISR.
+ */
+template <typename T, uint16_t N>
+class SpscQueue
+{
+    static_assert(N && !(N & (N - 1)) && N <= 32768, "SpscQueue size must be a power of 2");
+
+public:
+    /**
+     * Producer side
+     * @returns false if queue is full
+     */
+    __attribute__((always_inline)) inline bool push(const T &item)
+    {
+        uint16_t head = _head.load(std::memory_order_relaxed);
+        if ((uint16_t)(head - _tail.load(std::memory_order_acquire)) >= N)
+        {
+            // single writer, no read-modify-write needed
+            _overflows.store(_overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        _items[head & (N - 1)] = item;
+        _head.store((uint16_t)(head + 1), std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer side
+     * @returns false if queue is empty
+     */
+    bool pop(T *item)
+    {
+        uint16_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+            return false;
+
+        *item = _items[tail & (N - 1)];
+        _tail.store((uint16_t)(tail + 1), std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Approximate when called concurrently with the other side
+     */
+    uint16_t size()
+    {
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+
+    bool empty()
+    {
+        return !size();
+    }
+
+    unsigned long overflows()
+    {
+        return _overflows.load(std::memory_order_relaxed);
+    }
+
+private:
+    T _items[N];
+    std::atomic<uint16_t> _head{0};
+    std::atomic<uint16_t> _tail{0};
+    std::atomic<unsigned long> _overflows{0};
+};
+
+#endif
@@ -1,10 +1,12 @@
 #include "SyncInOptions.h"
 
+#if NC_FEATURE_SYNC_IN
+
 SyncInOptions::SyncInOptions()
 {
 }
 
-void SyncInOptions::init(JsonVariant options, const char *baseUrl)
+void SyncInOptions::init(JsonVariant options, DefinitionArena *arena)
 {
     if (!options.is<JsonObject>())
         return;
@@ -23,22 +25,139 @@ void SyncInOptions::init(JsonVariant options, const char *baseUrl)
     if (!fields.is<JsonArray>())
         return;
 
-    _buildRequestUrl(fields.as<JsonArray>(), baseUrl);
+    this->fields = fields.as<JsonArray>();
+
+    JsonArray ids = _idOptions(options, fields.as<JsonArray>());
+    compact = !ids.isNull() && _initIds(fields.as<JsonArray>(), ids, arena);
+
+    _buildRequestPath(fields.as<JsonArray>(), compact ? ids : JsonArray(), arena);
 }
 
-void SyncInOptions::_buildRequestUrl(JsonArray fields, const char *baseUrl)
+/**
+ * Drop definition derived state
+ * IMPORTANT: should be called before definition arena is released
+ */
+void SyncInOptions::reset()
 {
-    uint16_t urlLen = _calculateUrlQuerySize(fields) + strlen(baseUrl) + strlen(HUB_REQUEST_PATH);
+    delay = DEFAULT_SYNC_DELAY;
+    requestPath = nullptr;
+    compact = false;
+    fields = JsonArray();
+    _ids = nullptr;
+    _names = nullptr;
+    _count = 0;
+}
 
-    // allocate memory (one-time action, no fragmentation risk)
-    char *url = new char[urlLen];
+/**
+ * Estimate arena space needed for the request path and id table
+ */
+size_t SyncInOptions::arenaSize(JsonVariant options)
+{
+    if (!options.is<JsonObject>() || !options.containsKey(SYNC_FIELDS))
+        return 0;
 
-    strcpy(url, (char *)baseUrl);
-    strcat(url, HUB_REQUEST_PATH);
+    JsonVariant fields = options[SYNC_FIELDS];
+    if (!fields.is<JsonArray>())
+        return 0;
 
-    uint8_t count = 0;
+    bool hasIds = !_idOptions(options, fields.as<JsonArray>()).isNull();
+    size_t size = _calculateUrlQuerySize(fields.as<JsonArray>(), hasIds) + strlen(HUB_REQUEST_PATH_COMPACT) + 1;
+
+    if (hasIds)
+        size += fields.size() * (sizeof(uint16_t) + sizeof(char *)) + 2 * ARENA_ALIGNMENT;
+
+    return size;
+}
+
+/**
+ * Field name by its id in compact response
+ * @returns nullptr if id is unknown
+ */
+const char *SyncInOptions::fieldName(uint16_t id)
+{
+    for (uint16_t i = 0; i < _count; i++)
+        if (_ids[i] == id)
+            return _names[i];
+
+    return nullptr;
+}
+
+/**
+ * Whether field is read from the hub, eg. to pick fields of one node from a merged response
+ */
+bool SyncInOptions::hasField(const char *name)
+{
     for (JsonVariant field : fields)
+        if (field.is<char *>() && !strcmp(field.as<const char *>(), name))
+            return true;
+
+    return false;
+}
+
+/**
+ * @returns "n" option if it has a valid id for each field, otherwise null array
+ */
+JsonArray SyncInOptions::_idOptions(JsonVariant options, JsonArray fields)
+{
+    if (!options.containsKey(SYNC_IDS))
+        return JsonArray();
+
+    JsonVariant idsVar = options[SYNC_IDS];
+    if (!idsVar.is<JsonArray>())
+        return JsonArray();
+
+    JsonArray ids = idsVar.as<JsonArray>();
+    if (ids.size() != fields.size())
+        return JsonArray();
+
+    for (JsonVariant id : ids)
+        if (!id.is<unsigned int>() || !id.as<unsigned int>() || id.as<unsigned int>() > 0xFFFF)
+            return JsonArray();
+
+    return ids;
+}
+
+bool SyncInOptions::_initIds(JsonArray fields, JsonArray ids, DefinitionArena *arena)
+{
+    uint16_t size = fields.size();
+
+    _ids = (uint16_t *)arena->alloc(MEM_SYNC_IN, size * sizeof(uint16_t));
+    _names = (const char **)arena->alloc(MEM_SYNC_IN, size * sizeof(char *));
+    if (!_ids || !_names)
+        return false;
+
+    // names point into the definition, which outlives this table
+    _count = 0;
+    for (uint16_t i = 0; i < size; i++)
+    {
+        if (!fields[i].is<char *>())
+            continue;
+
+        _ids[_count] = ids[i].as<unsigned int>();
+        _names[_count] = fields[i].as<const char *>();
+        _count++;
+    }
+
+    return true;
+}
+
+void SyncInOptions::_buildRequestPath(JsonArray fields, JsonArray ids, DefinitionArena *arena)
+{
+    bool withIds = !ids.isNull();
+    const char *base = withIds ? HUB_REQUEST_PATH_COMPACT : HUB_REQUEST_PATH;
+    uint16_t urlLen = _calculateUrlQuerySize(fields, withIds) + strlen(base) + 1;
+
+    // carve from definition arena, released together with the definition
+    char *url = (char *)arena->alloc(MEM_SYNC_IN, urlLen);
+    if (!url)
+        return;
+
+    strcpy(url, base);
+
+    uint8_t count = 0;
+    for (uint16_t i = 0; i < fields.size(); i++)
     {
+        JsonVariant field = fields[i];
         if (!field.is<char *>())
             continue;
 
@@ -48,13 +167,20 @@ void SyncInOptions::_buildRequestUrl(JsonArray fields, const char *baseUrl)
         {
             strcat(url, (char *)(count++ ? "&" : "?"));
             strcat(url, fieldName);
+
+            if (withIds)
+            {
+                char id[7];
+                snprintf(id, sizeof(id), "=%u", ids[i].as<unsigned int>());
+                strcat(url, id);
+            }
         }
     }
 
-    requestUrl = (const char *)url;
+    requestPath = (const char *)url;
 }
 
-uint16_t SyncInOptions::_calculateUrlQuerySize(JsonArray fields)
+uint16_t SyncInOptions::_calculateUrlQuerySize(JsonArray fields, bool withIds)
 {
     uint16_t size = 0;
     uint16_t fieldCount = 0;
@@ -75,5 +201,11 @@ uint16_t SyncInOptions::_calculateUrlQuerySize(JsonArray fields)
     // add '?' and '&' inside query path, eg. ?node1.param1&node2.param3
     size += fieldCount;
 
+    // "=65535" per field
+    if (withIds)
+        size += fieldCount * 6;
+
     return size;
 }
+
+#endif
@@ -3,34 +3,61 @@
 
 #include <ArduinoJson.h>
 
+#include "../NodeConnectorConfig.h"
+#include "../MemoryTracker/MemoryTracker.h"
+#include "../DefinitionArena/DefinitionArena.h"
+
 /**
  * SyncIn options:
  * {
  *   "f": string[]
  *   "d": number
+ *   "n": number[]
  * }
  * 
  * "f" - array of field names to read from the hub and write to StateMachine store. Field - node-id.field-name
  * "d" - ms to delay between updates
+ * "n" - optional numeric ids (1..65535), one per field in "f". Then hub is asked for compact response
+ *       [id, value, id, value, ...] instead of field name -> value map, fields are mapped to ids
+ *       in the request: /aggregate/batch/compact?node1.param1=1&node2.param3=2
  */
 
 #define SYNC_FIELDS "f"
 #define SYNC_DELAY "d"
+#define SYNC_IDS "n"
+
+#define DEFAULT_SYNC_DELAY 60000
 
 const char HUB_REQUEST_PATH[] = "/aggregate/batch/flat";
+const char HUB_REQUEST_PATH_COMPACT[] = "/aggregate/batch/compact";
 
 class SyncInOptions
 {
 public:
     SyncInOptions();
-    void init(JsonVariant, const char *);
+    void init(JsonVariant, DefinitionArena *);
+    void reset();
+
+    static size_t arenaSize(JsonVariant);
+
+    const char *fieldName(uint16_t);
+    bool hasField(const char *);
 
-    unsigned long delay = 60000;
-    const char *requestUrl = nullptr;
+    unsigned long delay = DEFAULT_SYNC_DELAY;
+    const char *requestPath = nullptr; // relative to hub address
+    bool compact = false;
+    JsonArray fields; // "f" option, points into the definition
 
 private:
-    void _buildRequestUrl(JsonArray, const char *);
-    uint16_t _calculateUrlQuerySize(JsonArray);
+    // compact mode: field id -> name
+    uint16_t *_ids = nullptr;
+    const char **_names = nullptr;
+    uint16_t _count = 0;
+
+    void _buildRequestPath(JsonArray, JsonArray, DefinitionArena *);
+    bool _initIds(JsonArray, JsonArray, DefinitionArena *);
+    static JsonArray _idOptions(JsonVariant, JsonArray);
+    static uint16_t _calculateUrlQuerySize(JsonArray, bool);
 };
 
 #endif
@@ -1,6 +1,8 @@
 #include "SyncOutElementConfig.h"
 
-SyncOutElementConfig::SyncOutElementConfig(const char *varName, JsonVariant options) : accumulator(0.0f)
+#if NC_FEATURE_SYNC_OUT
+
+SyncOutElementConfig::SyncOutElementConfig(const char *varName, JsonVariant options)
 {
     name = varName;
 
@@ -18,22 +20,23 @@ SyncOutElementConfig::SyncOutElementConfig(const char *varName, JsonVariant opti
         }
     }
 
+    if (options.containsKey(SYNC_PRIORITY))
+    {
+        JsonVariant prio = options[SYNC_PRIORITY];
+        if (prio.is<char *>())
+        {
+            if (strcasecmp(prio, SYNC_PRIORITY_HIGH) == 0)
+                priority = PR_HIGH;
+            else if (strcasecmp(prio, SYNC_PRIORITY_LOW) == 0)
+                priority = PR_LOW;
+        }
+    }
+
     if (options.containsKey(SYNC_PREPROCESS))
     {
         JsonVariant prep = options[SYNC_PREPROCESS];
         if (prep.is<char *>())
-        {
-            if (strcasecmp(prep, SYNC_PREPROCESS_FIRST) == 0)
-                preprocessing = P_FIRST;
-            else if (strcasecmp(prep, SYNC_PREPROCESS_LAST) == 0)
-                preprocessing = P_LAST;
-            else if (strcasecmp(prep, SYNC_PREPROCESS_AVERAGE) == 0)
-                preprocessing = P_AVERAGE;
-            else if (strcasecmp(prep, SYNC_PREPROCESS_MIN) == 0)
-                preprocessing = P_MIN;
-            else if (strcasecmp(prep, SYNC_PREPROCESS_MAX) == 0)
-                preprocessing = P_MAX;
-        }
+            preprocessing = parsePreprocessing(prep.as<const char *>());
     }
 
     if (options.containsKey(SYNC_FRAME_TYPE))
@@ -45,6 +48,8 @@ SyncOutElementConfig::SyncOutElementConfig(const char *varName, JsonVariant opti
                 frameType = F_CYCLE_NUM;
             else if (strcasecmp(frame, SYNC_FRAME_TYPE_DURATION) == 0)
                 frameType = F_DURATION;
+            else if (strcasecmp(frame, SYNC_FRAME_TYPE_WALL_CLOCK) == 0)
+                frameType = F_WALL_CLOCK;
         }
     }
 
@@ -55,6 +60,10 @@ SyncOutElementConfig::SyncOutElementConfig(const char *varName, JsonVariant opti
             frameLength = len;
     }
 
+    // wall clock frames are cut by dividing time, zero length would never end
+    if (frameType == F_WALL_CLOCK && !frameLength)
+        frameType = 0;
+
     if (options.containsKey(SYNC_THRESHOLD))
     {
         JsonVariant th = options[SYNC_THRESHOLD];
@@ -67,4 +76,86 @@ SyncOutElementConfig::SyncOutElementConfig(const char *varName, JsonVariant opti
     {
         threshold = 1.0f;
     }
-}
\ No newline at end of file
+
+    if (options.containsKey(SYNC_HYSTERESIS))
+    {
+        JsonVariant h = options[SYNC_HYSTERESIS];
+        if (h.is<long int>() || h.is<float>())
+            hysteresis = abs(h.as<float>());
+    }
+
+    if (options.containsKey(SYNC_MIN_INTERVAL))
+    {
+        JsonVariant interval = options[SYNC_MIN_INTERVAL];
+        if (interval.is<long int>())
+            minInterval = interval;
+    }
+
+    if (options.containsKey(SYNC_MAX_INTERVAL))
+    {
+        JsonVariant interval = options[SYNC_MAX_INTERVAL];
+        if (interval.is<long int>())
+            maxInterval = interval;
+    }
+
+    if (options.containsKey(SYNC_QUANTILE))
+    {
+        JsonVariant q = options[SYNC_QUANTILE];
+        if (q.is<long int>() || q.is<float>())
+        {
+            float value = q.as<float>();
+            // accept both 0.95 and 95
+            if (value > 1.0f)
+                value /= 100.0f;
+            if (value >= 0.0f && value <= 1.0f)
+                quantile = value;
+        }
+    }
+
+    if (options.containsKey(SYNC_ID))
+    {
+        JsonVariant idVar = options[SYNC_ID];
+        if (idVar.is<unsigned int>() && idVar.as<unsigned int>() <= 0xFFFF)
+            id = idVar.as<unsigned int>();
+    }
+}
+
+/**
+ * Number of values emitted per frame
+ */
+uint8_t SyncOutElementConfig::aggregateCount()
+{
+    return syncType == T_PREPROCESS ? __builtin_popcount(preprocessing) : 1;
+}
+
+/**
+ * Number of quantile estimators needed (quantile and median are separate)
+ */
+uint8_t SyncOutElementConfig::quantileCount()
+{
+    return syncType == T_PREPROCESS ? __builtin_popcount(preprocessing & P_NEEDS_QUANTILE) : 0;
+}
+
+/**
+ * Translate preprocessing string (one or more aggregate letters) into aggregate flags
+ */
+uint16_t SyncOutElementConfig::parsePreprocessing(const char *prep)
+{
+    static const char letters[] = {
+        SYNC_PREPROCESS_FIRST[0], SYNC_PREPROCESS_LAST[0], SYNC_PREPROCESS_AVERAGE[0],
+        SYNC_PREPROCESS_MIN[0], SYNC_PREPROCESS_MAX[0], SYNC_PREPROCESS_COUNT[0],
+        SYNC_PREPROCESS_SUM[0], SYNC_PREPROCESS_VARIANCE[0], SYNC_PREPROCESS_STDDEV[0],
+        SYNC_PREPROCESS_QUANTILE[0], SYNC_PREPROCESS_MEDIAN[0]};
+
+    uint16_t result = 0;
+    for (; *prep; prep++)
+    {
+        char letter = tolower(*prep);
+        for (uint8_t i = 0; i < sizeof(letters); i++)
+            if (letters[i] == letter)
+                result |= 1 << i;
+    }
+    return result;
+}
+
+#endif
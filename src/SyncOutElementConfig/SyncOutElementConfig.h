@@ -4,14 +4,39 @@
 #include <ArduinoJson.h>
 #include <StateMachine.h>
 
+#include "../NodeConnectorConfig.h"
+
 /*
  * Sync out options (defines how variable from state machine is emitted to the hub)
  *  {
  *    SYNC_TYPE: "i" | "p" | "c", // i - instant (on update), p - with preprocessing, c - on value change
- *    PREPROCESSING: "f" | "l" | "a" | "n" | "x",   // f - first, l - last, a - average, n - min, x - max
- *    FRAME_TYPE: "c" | "d", // c - number of state machine cycles, d - approximate duration in ms
+ *    PREPROCESSING: "f" | "l" | "a" | "n" | "x" | "c" | "s" | "v" | "d" | "q" | "m",
+ *                   // f - first, l - last, a - average, n - min, x - max,
+ *                   // c - count, s - sum, v - variance, d - standard deviation,
+ *                   // q - quantile (see QUANTILE), m - median
+ *                   // Several aggregates can be combined, eg. "nxa". Then they are emitted
+ *                   // as one array per frame, always in the order listed above: [min, max, average]
+ *    FRAME_TYPE: "c" | "d" | "w", // c - number of state machine cycles, d - approximate duration in ms,
+ *                                 // w - wall clock aligned, FRAME_LENGTH in seconds (eg. 300 - every :00, :05, ...)
+ *                                 // Wall clock frames are emitted as [frame start (unix time, UTC), aggregates...]
+ *                                 // and only once local time is synced with the hub.
  *    FRAME_LENGTH: <number>
  *    THRESHOLD: <number>
+ *    PRIORITY: "h" | "n" | "l", // h - high, posted first in its own request each cycle, retried on failure,
+ *                               //     a failed batch is resent once per cycle until NC_HIGH_PRIORITY_MAX_AGE,
+ *                               //     normal and low batches wait meanwhile
+ *                               // n - normal (default), batched per cycle,
+ *                               // l - low, batched every NC_LOW_PRIORITY_PERIOD, deferred while hub link is congested
+ *                               //     and dropped if deferred for NC_LOW_PRIORITY_MAX_DEFER.
+ *                               //     Preprocessing frames of deferred variables are merged into one.
+ *    // on change only:
+ *    HYSTERESIS: <number>   // change against previous direction must exceed THRESHOLD + HYSTERESIS
+ *    MIN_INTERVAL: <number> // ms, rate limit, changes in between are merged and sent when interval elapses
+ *    MAX_INTERVAL: <number> // ms, heartbeat, last value is re-sent when nothing changed for so long
+ *    QUANTILE: <number> // quantile for "q" preprocessing, 0..1 or percent, defaults to 0.95
+ *    ID: <number> // 1..65535, numeric id for compact payloads. If every sync out variable has one,
+ *                 // batches are posted as [schema version, id, value, id, value, ...] instead of
+ *                 // name -> value map. Schema version is definition's last modified stamp (unix time).
  *  }
  */
 
@@ -26,44 +51,93 @@
 #define SYNC_PREPROCESS_AVERAGE "a"
 #define SYNC_PREPROCESS_MIN "n"
 #define SYNC_PREPROCESS_MAX "x"
+#define SYNC_PREPROCESS_COUNT "c"
+#define SYNC_PREPROCESS_SUM "s"
+#define SYNC_PREPROCESS_VARIANCE "v"
+#define SYNC_PREPROCESS_STDDEV "d"
+#define SYNC_PREPROCESS_QUANTILE "q"
+#define SYNC_PREPROCESS_MEDIAN "m"
 
 #define SYNC_FRAME_TYPE "f"
 #define SYNC_FRAME_TYPE_CYCLE_NUM "c"
 #define SYNC_FRAME_TYPE_DURATION "d"
+#define SYNC_FRAME_TYPE_WALL_CLOCK "w"
 
 #define SYNC_FRAME_LENGTH "l"
 #define SYNC_THRESHOLD "t"
+#define SYNC_HYSTERESIS "h"
+#define SYNC_MIN_INTERVAL "r"
+#define SYNC_MAX_INTERVAL "b"
+
+#define SYNC_PRIORITY "u"
+#define SYNC_PRIORITY_HIGH "h"
+#define SYNC_PRIORITY_NORMAL "n"
+#define SYNC_PRIORITY_LOW "l"
+#define SYNC_QUANTILE "q"
+#define SYNC_ID "i"
 
 #define T_INSTANT 1
 #define T_PREPROCESS 2
 #define T_ON_CHANGE 3
 
-#define P_FIRST 1
-#define P_LAST 2
-#define P_AVERAGE 3
-#define P_MIN 4
-#define P_MAX 5
+// preprocessing aggregates, bit flags in emit order
+#define P_FIRST 0x0001
+#define P_LAST 0x0002
+#define P_AVERAGE 0x0004
+#define P_MIN 0x0008
+#define P_MAX 0x0010
+#define P_COUNT 0x0020
+#define P_SUM 0x0040
+#define P_VARIANCE 0x0080
+#define P_STDDEV 0x0100
+#define P_QUANTILE 0x0200
+#define P_MEDIAN 0x0400
+#define P_LAST_AGGREGATE P_MEDIAN
+
+// aggregates needing running sum, Welford state or quantile estimators
+#define P_NEEDS_SUM (P_AVERAGE | P_SUM)
+#define P_NEEDS_WELFORD (P_VARIANCE | P_STDDEV)
+#define P_NEEDS_QUANTILE (P_QUANTILE | P_MEDIAN)
+
+#define DEFAULT_QUANTILE 0.95f
 
 #define F_CYCLE_NUM 1
 #define F_DURATION 2
+#define F_WALL_CLOCK 3
+
+// priority lanes, bit flags so lanes can be combined
+#define PR_HIGH 0x01
+#define PR_NORMAL 0x02
+#define PR_LOW 0x04
+#define PR_ALL (PR_HIGH | PR_NORMAL | PR_LOW)
 
+/*
+ * Read-mostly variable sync config.
+ * Mutable aggregation state lives in SyncOutState, under the same index.
+ */
 class SyncOutElementConfig
 {
 public:
     SyncOutElementConfig(const char *, JsonVariant);
 
     uint8_t syncType = 0;
-    uint8_t preprocessing = 0;
+    uint8_t priority = PR_NORMAL;
+    uint16_t preprocessing = 0;
     uint8_t frameType = 0;
     unsigned long frameLength = 0;
     float threshold = 0.0f;
+    float hysteresis = 0.0f;
+    unsigned long minInterval = 0;
+    unsigned long maxInterval = 0;
+    float quantile = DEFAULT_QUANTILE;
+    uint16_t id = 0; // 0 - none
 
     const char *name;
-    VarStruct accumulator;
-    unsigned long updateCounter = 0;
-    bool canEmit = false;
-    unsigned long lastEmit = 0;
-    unsigned long frameNum = 0;
+
+    uint8_t aggregateCount();
+    uint8_t quantileCount();
+
+    static uint16_t parsePreprocessing(const char *);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "../SyncOutElementConfig/SyncOutElementConfig.h"
+#include "SyncOutState.h"
+
+#if NC_FEATURE_SYNC_OUT
+
+/**
+ * Carve state arrays from the definition arena
+ * @param size number of variables
+ * @param aggregates preprocessing flags of all variables combined
+ * @param quantileSize number of quantile estimators
+ */
+bool SyncOutState::init(DefinitionArena *arena, uint16_t size, uint16_t aggregates, uint16_t quantileSize)
+{
+    reset();
+
+    if (!size)
+        return true;
+
+    bool failed = false;
+
+    accumulator = _alloc<VarStruct>(arena, size, true, &failed);
+    updateCounter = _alloc<unsigned long>(arena, size, true, &failed);
+    lastEmit = _alloc<unsigned long>(arena, size, true, &failed);
+    flags = _alloc<uint8_t>(arena, size, true, &failed);
+
+    first = _alloc<VarStruct>(arena, size, aggregates & P_FIRST, &failed);
+    minimum = _alloc<AggregateValue>(arena, size, aggregates & P_MIN, &failed);
+    maximum = _alloc<AggregateValue>(arena, size, aggregates & P_MAX, &failed);
+    sum = _alloc<AggregateSum>(arena, size, aggregates & P_NEEDS_SUM, &failed);
+    mean = _alloc<float>(arena, size, aggregates & P_NEEDS_WELFORD, &failed);
+    m2 = _alloc<float>(arena, size, aggregates & P_NEEDS_WELFORD, &failed);
+    quantileSlot = _alloc<uint16_t>(arena, size, quantileSize, &failed);
+    quantiles = _alloc<QuantileEstimator>(arena, quantileSize, true, &failed);
+
+    if (failed)
+    {
+        reset();
+        return false;
+    }
+
+    for (uint16_t i = 0; i < size; i++)
+    {
+        new (&accumulator[i]) VarStruct(0.0f);
+        if (first)
+            new (&first[i]) VarStruct(0.0f);
+        updateCounter[i] = 0;
+        lastEmit[i] = 0;
+        flags[i] = 0;
+    }
+
+    for (uint16_t i = 0; i < quantileSize; i++)
+        new (&quantiles[i]) QuantileEstimator();
+
+    count = size;
+    quantileCount = quantileSize;
+    return true;
+}
+
+/**
+ * Drop arrays, memory itself goes back with the definition arena
+ */
+void SyncOutState::reset()
+{
+    count = 0;
+    accumulator = nullptr;
+    updateCounter = nullptr;
+    lastEmit = nullptr;
+    flags = nullptr;
+    first = nullptr;
+    minimum = nullptr;
+    maximum = nullptr;
+    sum = nullptr;
+    mean = nullptr;
+    m2 = nullptr;
+    quantileCount = 0;
+    quantiles = nullptr;
+    quantileSlot = nullptr;
+}
+
+size_t SyncOutState::arenaSize(uint16_t size, uint16_t aggregates, uint16_t quantileSize)
+{
+    size_t perVar = sizeof(VarStruct) + 2 * sizeof(unsigned long) + sizeof(uint8_t);
+
+    if (aggregates & P_FIRST)
+        perVar += sizeof(VarStruct);
+    if (aggregates & P_MIN)
+        perVar += sizeof(AggregateValue);
+    if (aggregates & P_MAX)
+        perVar += sizeof(AggregateValue);
+    if (aggregates & P_NEEDS_SUM)
+        perVar += sizeof(AggregateSum);
+    if (aggregates & P_NEEDS_WELFORD)
+        perVar += 2 * sizeof(float);
+    if (quantileSize)
+        perVar += sizeof(uint16_t);
+
+    // each array may lose a few bytes to alignment
+    return size * perVar + quantileSize * sizeof(QuantileEstimator) + 12 * ARENA_ALIGNMENT;
+}
+
+#endif
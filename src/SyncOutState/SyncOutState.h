@@ -0,0 +1,84 @@
+#ifndef syncoutstate_h
+#define syncoutstate_h
+
+#include <Arduino.h>
+#include <StateMachine.h>
+
+#include "../NodeConnectorConfig.h"
+#include "../DefinitionArena/DefinitionArena.h"
+#include "../QuantileEstimator/QuantileEstimator.h"
+
+/*
+ * Mutable aggregation state of all sync out variables.
+ *
+ * Kept apart from read-mostly SyncOutElementConfig, in contiguous arrays
+ * grouped by type and indexed by variable index, so per cycle sweeps
+ * (frame finalization, emitting) walk memory linearly.
+ * Arrays needed only by some aggregates are allocated only if any variable uses them.
+ */
+
+// flags
+#define SYNC_OUT_CAN_EMIT 0x01
+#define SYNC_OUT_FRAME_STARTED 0x02
+#define SYNC_OUT_FRAME_FLOAT 0x04 // frame aggregates use float kernel
+#define SYNC_OUT_PENDING 0x08      // on change value held back by rate limit
+#define SYNC_OUT_RISING 0x10       // direction of last on change emit
+#define SYNC_OUT_FALLING 0x20
+
+typedef union AggregateValue
+{
+    long vInt;
+    float vFloat;
+} AggregateValue;
+
+typedef union AggregateSum
+{
+    long long vInt;
+    float vFloat;
+} AggregateSum;
+
+class SyncOutState
+{
+public:
+    bool init(DefinitionArena *, uint16_t, uint16_t, uint16_t);
+    void reset();
+
+    static size_t arenaSize(uint16_t, uint16_t, uint16_t);
+
+    uint16_t count = 0;
+
+    // all variables
+    VarStruct *accumulator = nullptr; // last value (on change: last emitted or pending value)
+    unsigned long *updateCounter = nullptr;
+    unsigned long *lastEmit = nullptr;
+    uint8_t *flags = nullptr;
+
+    // only if some variable needs the aggregate
+    VarStruct *first = nullptr;
+    AggregateValue *minimum = nullptr;
+    AggregateValue *maximum = nullptr;
+    AggregateSum *sum = nullptr;
+
+    // running mean and sum of squared differences (Welford)
+    float *mean = nullptr;
+    float *m2 = nullptr;
+
+    // estimators of quantile / median variables, starting at `quantileSlot`
+    uint16_t quantileCount = 0;
+    QuantileEstimator *quantiles = nullptr;
+    uint16_t *quantileSlot = nullptr;
+
+private:
+    template <typename T>
+    static T *_alloc(DefinitionArena *arena, uint16_t size, bool needed, bool *failed)
+    {
+        if (!needed || !size)
+            return nullptr;
+        T *result = (T *)arena->alloc(MEM_SYNC_OUT, sizeof(T) * size);
+        if (!result)
+            *failed = true;
+        return result;
+    }
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include <limits.h>
+#include <TimeLib.h>
 #include "Utils.h"
 
 unsigned long diff(unsigned long from, unsigned long to)
@@ -14,4 +15,86 @@ unsigned long diff(unsigned long from, unsigned long to)
 unsigned long getTimeout(unsigned long start)
 {
   return diff(start, millis());
-}
\ No newline at end of file
+}
+
+/**
+ * @returns number of `length` digits or -1 if there is a non digit
+ */
+static int _httpDateNumber(const char *str, uint8_t length)
+{
+    int result = 0;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        if (str[i] < '0' || str[i] > '9')
+            return -1;
+        result = result * 10 + (str[i] - '0');
+    }
+    return result;
+}
+
+/**
+ * @returns month 1..12 or 0 if not recognized
+ */
+static uint8_t _httpDateMonth(const char *str)
+{
+    static const char months[] = "janfebmaraprmayjunjulaugsepoctnovdec";
+
+    char name[3] = {(char)tolower(str[0]), (char)tolower(str[1]), (char)tolower(str[2])};
+    for (uint8_t i = 0; i < 12; i++)
+        if (!strncmp(months + i * 3, name, 3))
+            return i + 1;
+
+    return 0;
+}
+
+/**
+ * Parse HTTP date without allocations
+ * Time format: "Wed, 21 Oct 2015 07:28:00 GMT"
+ *               01234567890123456789012345678
+ */
+bool parseHttpDate(const char *timeStamp, time_t *result)
+{
+    if (!timeStamp)
+        return false;
+
+    // all fields must be there, stop at the terminator
+    for (uint8_t i = 0; i < 25; i++)
+        if (!timeStamp[i])
+            return false;
+
+    // All time related types and functions are from TimeLib.h
+    // https://github.com/PaulStoffregen/Time
+    int day = _httpDateNumber(timeStamp + 5, 2);
+    uint8_t month = _httpDateMonth(timeStamp + 8);
+    int year = _httpDateNumber(timeStamp + 12, 4);
+    int hour = _httpDateNumber(timeStamp + 17, 2);
+    int minute = _httpDateNumber(timeStamp + 20, 2);
+    int second = _httpDateNumber(timeStamp + 23, 2);
+
+    if (day < 1 || !month || year < 1970 || hour < 0 || minute < 0 || second < 0)
+        return false;
+
+    tmElements_t tm;
+    tm.Day = day;
+    tm.Month = month;
+    tm.Year = CalendarYrToTm(year);
+    tm.Hour = hour;
+    tm.Minute = minute;
+    tm.Second = second;
+
+    *result = makeTime(tm);
+    return true;
+}
+
+/**
+ * Continue FNV-1a hash over more bytes, start with HASH_SEED
+ */
+uint32_t hashBytes(uint32_t hash, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619ul;
+    }
+    return hash;
+}
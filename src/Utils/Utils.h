@@ -3,7 +3,12 @@
 
 #include <Arduino.h>
 
+// FNV-1a, see http://www.isthe.com/chongo/tech/comp/fnv/
+#define HASH_SEED 2166136261ul
+
 unsigned long diff(unsigned long, unsigned long);
 unsigned long getTimeout(unsigned long);
+bool parseHttpDate(const char *, time_t *);
+uint32_t hashBytes(uint32_t, const uint8_t *, size_t);
 
 #endif
\ No newline at end of file